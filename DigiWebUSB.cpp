@@ -8,31 +8,51 @@ and Digistump LLC (digistump.com)
 */
 
 #include "DigiWebUSB.h"
+#include "oddebug.h"
 #include <Arduino.h>
 #include <avr/eeprom.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <avr/sleep.h>
 #include <stdint.h>
 #include <util/delay.h>
+
+#if HW_CDC_REPORT_PROFILE
+/* The per-MCU profile (DigiWebUSB.h, usbconfig.h), once per build. */
+#define HW_CDC_STR(x) #x
+#define HW_CDC_XSTR(x) HW_CDC_STR(x)
+#pragma message("DigiWebUSB profile: " HW_CDC_PROFILE ", rx/tx rings "          \
+                HW_CDC_XSTR(HW_CDC_RX_BUF_SIZE) "/" HW_CDC_XSTR(               \
+                    HW_CDC_TX_BUF_SIZE) " bytes, trace " HW_CDC_XSTR(          \
+                    HW_CDC_TRACE_SIZE) " events, fast CRC " HW_CDC_XSTR(       \
+                    USB_USE_FAST_CRC) ", min " HW_CDC_XSTR(HW_CDC_MIN))
+#endif
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+static uint8_t tmp[HW_CDC_BULK_IN_SIZE];
+static uint8_t tmpIndex = 0;
+
+static RingBuffer_t rxBuf;
+static uint8_t rxBuf_Data[HW_CDC_RX_BUF_SIZE];
+
+static RingBuffer_t txBuf;
+static uint8_t txBuf_Data[HW_CDC_TX_BUF_SIZE];
+
 static const WebUSBURL *urls;
 static uint8_t numUrls;
 static uint8_t landingPage;
 static uint8_t pluggedInterface;
 static const uint8_t *allowedOrigins;
 static uint8_t numAllowedOrigins;
-extern uchar _deb[20];
+extern uchar usbDeviceAddr;
 static uchar buffer[64];
-#define USB_BOS_DESCRIPTOR_TYPE (15)
-#define MS_OS_20_DESCRIPTOR_LENGTH (0x1e)
-const uint8_t SerialNR[] PROGMEM = "53d6d48090f9401240a6515705d1cf61";
-const uint8_t BOS_DESCRIPTOR_PREFIX[] PROGMEM = {
-    // BOS descriptor header
-    0x05, 0x0F, 0x39, 0x00, 0x02,
-
+#define MS_OS_20_DESCRIPTOR_LENGTH (0x2e) /* the whole set, see below */
+// The BOS descriptor: a header made up by buildBosDescriptor() and the
+// capabilities of the features compiled in.
+#if HW_CDC_WEBUSB
+const uint8_t WEBUSB_CAPABILITY[] PROGMEM = {
     // WebUSB Platform Capability descriptor
     0x18, // Descriptor size (24 bytes)
     0x10, // Descriptor type (Device Capability)
@@ -46,9 +66,11 @@ const uint8_t BOS_DESCRIPTOR_PREFIX[] PROGMEM = {
     0x00, 0x01,        // WebUSB version 1.0
     WL_REQUEST_WEBUSB, // Vendor-assigned WebUSB request code
 };
-// Landing page (1 byte) sent in the middle.
+// Landing page (1 byte) sent after this.
+#endif
 
-const uint8_t BOS_DESCRIPTOR_SUFFIX[] PROGMEM{
+#if HW_CDC_WINUSB
+const uint8_t MS_OS_20_CAPABILITY[] PROGMEM = {
     // Microsoft OS 2.0 Platform Capability Descriptor
     // Thanks http://janaxelson.com/files/ms_os_20_descriptors.c
     0x1C, // Descriptor size (28 bytes)
@@ -71,12 +93,12 @@ const uint8_t MS_OS_20_DESCRIPTOR_PREFIX[] PROGMEM = {
     0x0A, 0x00,             // Descriptor size (10 bytes)
     0x00, 0x00,             // MS OS 2.0 descriptor set header
     0x00, 0x00, 0x03, 0x06, // Windows version (8.1) (0x06030000)
-    0x2e, 0x00,             // Size, MS OS 2.0 descriptor set
+    MS_OS_20_DESCRIPTOR_LENGTH, 0x00, // Size, MS OS 2.0 descriptor set
 
     // Microsoft OS 2.0 configuration subset header
     0x08, 0x00, // Descriptor size (8 bytes)
     0x01, 0x00, // MS OS 2.0 configuration subset header
-    0x00,       // bConfigurationValue
+    0x00,       // bConfigurationValue, an index, see below
     0x00,       // Reserved
     0x24, 0x00, // Size, MS OS 2.0 configuration subset
 
@@ -97,12 +119,268 @@ const uint8_t MS_OS_20_DESCRIPTOR_SUFFIX[] PROGMEM = {
     'W', 'I', 'N', 'U', 'S', 'B', 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
     0x00, 0x00, 0x00,
 };
+#endif
 
 #ifdef __cplusplus
 } // extern "C"
 #endif
 uchar sendEmptyFrame;
 static uchar intr3Status; /* used to control interrupt endpoint transmissions */
+static uchar idleSleepEnabled; /* sleep in delay() instead of busy waiting */
+static uint32_t sleptMicros; /* total time spent in sleep_cpu() */
+static uchar deviceState;  /* USB_STATE_* flags */
+static uchar lineState;    /* DTR/RTS bits from SET_CONTROL_LINE_STATE */
+static void (*readyCallback)(void); /* called when the host configures us */
+#if USB_COUNT_SOF
+static uchar lastSofCount;
+static uint32_t lastSofMillis;
+#endif
+#if HW_CDC_BENCHMARK
+enum {
+  BENCH_RING_BUFFER,
+  BENCH_CRC16,
+  BENCH_BOS_DESCRIPTOR,
+  BENCH_MS_OS_20_DESCRIPTOR,
+  BENCH_POLL,
+  BENCH_KERNELS /* also the empty kernel that measures the overhead */
+};
+enum { BENCH_IDLE, BENCH_REQUESTED, BENCH_RUNNING };
+static uchar benchState;
+static uchar benchRuns; /* completed runs, see WL_REQUEST_BENCHMARK */
+static uint16_t benchCycles[BENCH_KERNELS];
+static uchar benchReply[4 + sizeof(benchCycles)];
+#endif
+#if HW_CDC_STATS || HW_CDC_WATCHDOG
+static uint32_t lastPollMicros;
+static uchar polled; /* lastPollMicros is valid */
+#endif
+#if HW_CDC_WATCHDOG
+volatile uint8_t hwCdcIrqOffMax, hwCdcIrqOffLong, hwCdcIrqOffLast;
+static uint16_t pollIntervalMax, pollLate;
+static uint8_t irqOffReported; /* hwCdcIrqOffLong at the last callback */
+static void (*deadlineCallback)(uint8_t what, uint16_t value);
+#endif
+#if HW_CDC_STATS
+/* Updated from usbPoll() callbacks and write(), never from an interrupt. */
+static DigiWebUSBStats driverStats;
+#define STATS(code) code
+#else
+#define STATS(code)
+#endif
+#if HW_CDC_TRACE
+#if HW_CDC_TRACE_SIZE & (HW_CDC_TRACE_SIZE - 1)
+#error "HW_CDC_TRACE_SIZE must be a power of 2"
+#endif
+static DigiWebUSBTraceEvent traceRing[HW_CDC_TRACE_SIZE];
+static uchar traceHead;  /* where the next event goes */
+static uchar traceCount; /* events in the ring */
+static uchar traceLost;  /* events overwritten since the last drain */
+
+/* Appends an event, overwriting the oldest one if the ring is full. Only
+ * called from usbPoll() callbacks and the library's own calls, like the
+ * drain, so the ring needs no locking.
+ */
+static inline void traceEvent(uchar event, uchar arg0, uchar arg1) {
+  DigiWebUSBTraceEvent *e = &traceRing[traceHead];
+
+  traceHead = (traceHead + 1) & (HW_CDC_TRACE_SIZE - 1);
+  if (traceCount < HW_CDC_TRACE_SIZE)
+    traceCount++;
+  else if (traceLost != 0xff)
+    traceLost++;
+  e->event = event;
+#if USB_COUNT_SOF
+  e->time = usbSofCount;
+#else
+  e->time = TCNT0;
+#endif
+  e->arg[0] = arg0;
+  e->arg[1] = arg1;
+}
+
+/* Moves up to max events, oldest first, out of the ring. */
+static uchar traceDrain(DigiWebUSBTraceEvent *events, uchar max) {
+  uchar n = traceCount < max ? traceCount : max;
+  uchar tail = (traceHead - traceCount) & (HW_CDC_TRACE_SIZE - 1);
+
+  for (uchar i = 0; i < n; i++) {
+    events[i] = traceRing[tail];
+    tail = (tail + 1) & (HW_CDC_TRACE_SIZE - 1);
+  }
+  traceCount -= n;
+  return n;
+}
+#define TRACE(event, arg0, arg1) traceEvent(event, arg0, arg1)
+#else
+#define TRACE(event, arg0, arg1)
+#endif
+#if HW_CDC_STACK_CHECK
+#ifndef __AVR__
+#error "HW_CDC_STACK_CHECK needs the avr-gcc linker symbols"
+#endif
+#define STACK_CANARY 0xc5
+extern uint8_t _end;    /* end of .bss and .noinit, where the heap starts */
+extern uint8_t __stack; /* top of the stack, RAMEND */
+
+/* Fills the RAM from the end of the static data to the top of the stack
+ * with STACK_CANARY. Runs in .init3, after the C runtime has set SP and
+ * before it initializes .data and .bss, so it may use no stack and no
+ * variables; nothing below SP is in use yet.
+ */
+static void paintStack(void) __attribute__((naked, used, section(".init3")));
+static void paintStack(void) {
+  __asm__ __volatile__("    ldi r30, lo8(_end)\n"
+                       "    ldi r31, hi8(_end)\n"
+                       "    ldi r24, %0\n"
+                       "    ldi r25, hi8(__stack + 1)\n"
+                       "    rjmp 2f\n"
+                       "1:  st Z+, r24\n"
+                       "2:  cpi r30, lo8(__stack + 1)\n"
+                       "    cpc r31, r25\n"
+                       "    brlo 1b\n" ::"M"(STACK_CANARY));
+}
+
+static uint16_t stackUntouched(void) {
+  const uint8_t *p = &_end;
+
+  while (p <= &__stack && *p == STACK_CANARY)
+    p++;
+  return p - &_end;
+}
+#endif
+
+/* Derives the device state from what the driver has seen so far. Suspend is
+ * detected by the absence of SOF (or low speed keep-alive) markers, which the
+ * host sends every millisecond while the bus is active.
+ */
+static void updateDeviceState(void) {
+  uchar state = deviceState & USB_STATE_ATTACHED;
+
+  if (state && usbDeviceAddr != 0) {
+    state |= USB_STATE_ADDRESSED;
+    if (usbConfiguration != 0) {
+      state |= USB_STATE_CONFIGURED;
+      if (lineState & 1)
+        state |= USB_STATE_PORT_OPEN;
+    }
+  } else {
+    lineState = 0; /* bus reset closes the port */
+  }
+#if USB_COUNT_SOF
+  uint32_t now = millis();
+  uchar sofCount = usbSofCount;
+  if (sofCount != lastSofCount) {
+    lastSofCount = sofCount;
+    lastSofMillis = now;
+  } else if (now - lastSofMillis >= HW_CDC_SUSPEND_MS) {
+    state |= USB_STATE_SUSPENDED;
+  }
+#endif
+  uchar previous = deviceState;
+  if (state != previous)
+    TRACE(WL_TRACE_STATE, state, previous);
+  /* before the callback: it may write(), which polls and gets here again */
+  deviceState = state;
+  if ((state & ~previous & USB_STATE_CONFIGURED) && readyCallback)
+    readyCallback();
+}
+
+/* Bulk OUT flow control, see HW_CDC_RX_HIGH_WATER. Called from the driver's
+ * callback and from polls, so the driver is never in the middle of a packet
+ * when usbRxLen changes.
+ */
+#if HW_CDC_STATS
+static uint32_t rxStopMillis;
+#endif
+static uint32_t rxWaitMillis; /* the stop began or read() last took a byte */
+static uint8_t rxWaitCount;   /* bytes in rxBuf then */
+static uint8_t rxOverflow;    /* a stop timed out, drop what does not fit */
+
+static void stopRx(void) {
+  usbDisableAllRequests();
+  rxWaitMillis = millis();
+  rxWaitCount = RingBuffer_GetCount(&rxBuf);
+  STATS(driverStats.flowStops++; rxStopMillis = millis());
+  TRACE(WL_TRACE_FLOW, 1, rxWaitCount);
+}
+
+static void resumeRx(uint8_t timeout) {
+#if HW_CDC_STATS
+  uint32_t ms = millis() - rxStopMillis;
+  if (ms > 0xffff)
+    ms = 0xffff;
+  driverStats.throttledMs += ms;
+  if (ms > driverStats.throttledMaxMs)
+    driverStats.throttledMaxMs = ms;
+#endif
+  TRACE(WL_TRACE_FLOW, timeout ? 2 : 0, RingBuffer_GetCount(&rxBuf));
+  usbEnableAllRequests();
+}
+
+static void checkRx(void) {
+  uint8_t count = RingBuffer_GetCount(&rxBuf);
+
+  if (!usbAllRequestsAreDisabled()) {
+    if (count <= HW_CDC_RX_LOW_WATER)
+      rxOverflow = 0;
+  } else if (count <= HW_CDC_RX_LOW_WATER) {
+    resumeRx(0);
+  } else if (count < rxWaitCount) { /* a slow reader, wait on */
+    rxWaitMillis = millis();
+    rxWaitCount = count;
+  } else if (millis() - rxWaitMillis >= HW_CDC_RX_STOP_MS) {
+    rxOverflow = 1;
+    resumeRx(1);
+  }
+}
+
+#if HW_CDC_STATS
+static void updateHighWater(uint8_t *mark, RingBuffer_t *ring) {
+  uint8_t count = RingBuffer_GetCount(ring);
+  if (count > *mark)
+    *mark = count;
+}
+
+static void countPoll(uint16_t interval) {
+  driverStats.polls++;
+  if (interval > driverStats.pollIntervalMax)
+    driverStats.pollIntervalMax = interval;
+}
+#endif
+
+#if HW_CDC_STATS || HW_CDC_WATCHDOG
+/* Returns the time since the last poll in us, up to 65535, or 0 for the
+ * first one.
+ */
+static uint16_t pollInterval(void) {
+  uint32_t now = micros();
+  uint32_t interval = polled ? now - lastPollMicros : 0;
+
+  lastPollMicros = now;
+  polled = 1;
+  return interval > 0xffff ? 0xffff : interval;
+}
+#endif
+
+#if HW_CDC_WATCHDOG
+/* Runs at the end of a poll, so that the callback may write() or poll. */
+static void checkDeadlines(uint16_t interval) {
+  uint8_t irqOffLong = hwCdcIrqOffLong;
+
+  if (interval > pollIntervalMax)
+    pollIntervalMax = interval;
+  if (interval > HW_CDC_POLL_LIMIT_US) {
+    pollLate++;
+    if (deadlineCallback)
+      deadlineCallback(HW_CDC_MISSED_POLL, interval);
+  }
+  if (irqOffLong != irqOffReported) {
+    irqOffReported = irqOffLong;
+    if (deadlineCallback)
+      deadlineCallback(HW_CDC_MISSED_IRQ_OFF, hwCdcIrqOffLast * 64);
+  }
+}
+#endif
 
 DigiWebUSBDevice::DigiWebUSBDevice(const WebUSBURL *_urls, uint8_t _numUrls,
                                    uint8_t _landingPage,
@@ -114,37 +392,149 @@ DigiWebUSBDevice::DigiWebUSBDevice(const WebUSBURL *_urls, uint8_t _numUrls,
   numAllowedOrigins = _numAllowedOrigins;
   urls = _urls;
   numUrls = _numUrls;
-  _deb[0] = 0;
+}
+
+/* Puts the CPU into idle mode until the next interrupt. The USB pin change
+ * interrupt and the timer 0 overflow (millis) both wake us up, so usbPoll()
+ * still runs at least once per millisecond. The time spent here includes the
+ * interrupt routine that woke us.
+ */
+static void sleepUntilInterrupt(void) {
+  uint32_t start = micros();
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_mode();
+  sleptMicros += micros() - start;
 }
 
 void DigiWebUSBDevice::delay(long milli) {
-  unsigned long last = millis();
+  uint32_t last = millis();
   while (milli > 0) {
-    unsigned long now = millis();
+    uint32_t now = millis();
     milli -= now - last;
     last = now;
-    refresh();
+    if (idleSleepEnabled) {
+      usbPollWrapper();
+      sleepUntilInterrupt();
+    } else {
+      refresh();
+    }
+  }
+}
+
+void DigiWebUSBDevice::setIdleSleep(bool enable) { idleSleepEnabled = enable; }
+
+uint32_t DigiWebUSBDevice::sleepMicros() { return sleptMicros; }
+
+#if HW_CDC_WATCHDOG
+/* The callback is called from a poll, after the library's work is done. */
+void DigiWebUSBDevice::onDeadlineMissed(void (*callback)(uint8_t what,
+                                                         uint16_t value)) {
+  deadlineCallback = callback;
+}
+
+void DigiWebUSBDevice::watchdog(DigiWebUSBWatchdog *w) {
+  w->pollIntervalMax = pollIntervalMax;
+  w->pollLate = pollLate;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    w->irqOffMax = hwCdcIrqOffMax * 64;
+    w->irqOffLong = hwCdcIrqOffLong;
+  }
+}
+
+void DigiWebUSBDevice::clearWatchdog() {
+  pollIntervalMax = 0;
+  pollLate = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    hwCdcIrqOffMax = 0;
+    hwCdcIrqOffLong = 0;
+    irqOffReported = 0;
   }
 }
+#endif
+
+#if HW_CDC_TRACE
+/* Drains up to max events into events and returns their number. If lost is
+ * given, it gets the number of events overwritten since the last drain.
+ */
+uchar DigiWebUSBDevice::trace(DigiWebUSBTraceEvent *events, uchar max,
+                              uchar *lost) {
+  if (lost)
+    *lost = traceLost;
+  traceLost = 0;
+  return traceDrain(events, max);
+}
+#endif
+
+#if HW_CDC_STACK_CHECK
+/* Returns the bytes above the static data that the stack has never reached
+ * since reset. Heap blocks (String, malloc) sit at the bottom of that area
+ * and count as used. A stack byte that happens to equal STACK_CANARY right
+ * at the deepest point counts as free.
+ */
+uint16_t DigiWebUSBDevice::stackFree() { return stackUntouched(); }
+#endif
+
+#if HW_CDC_STATS
+/* The counters only change in the library's own calls, so the copy is
+ * consistent.
+ */
+void DigiWebUSBDevice::stats(DigiWebUSBStats *s) {
+  memcpy(s, &driverStats, sizeof(driverStats));
+}
+
+void DigiWebUSBDevice::clearStats() {
+  memset(&driverStats, 0, sizeof(driverStats));
+}
+#endif
 
 void DigiWebUSBDevice::flush() {
-  cli();
-  RingBuffer_InitBuffer(&rxBuf, rxBuf_Data, sizeof(rxBuf_Data));
-  sei();
+  ATOMIC_BLOCK(HW_CDC_WATCHED_RESTORESTATE) {
+    RingBuffer_InitBuffer(&rxBuf, rxBuf_Data, sizeof(rxBuf_Data));
+  }
 }
 
+/* Connects to the bus and returns as soon as the host has configured the
+ * device, or after HW_CDC_ENUM_TIMEOUT_MS if it doesn't.
+ */
 void DigiWebUSBDevice::begin() {
-
   usbBegin();
-  DigiWebUSBDevice::delay(500); // delay to allow enumeration and such
+  uint32_t start = millis();
+  while (!(deviceState & USB_STATE_CONFIGURED) &&
+         millis() - start < HW_CDC_ENUM_TIMEOUT_MS) {
+    usbPollWrapper();
+  }
+}
+
+/* The baud rate is meaningless for USB, accepted for Serial compatibility. */
+void DigiWebUSBDevice::begin(unsigned long x) { begin(); }
+
+void DigiWebUSBDevice::onReady(void (*callback)(void)) {
+  readyCallback = callback;
 }
 
 size_t DigiWebUSBDevice::write(uint8_t c) {
+  if ((deviceState & (USB_STATE_CONFIGURED | USB_STATE_PORT_OPEN |
+                      USB_STATE_SUSPENDED)) !=
+      (USB_STATE_CONFIGURED | USB_STATE_PORT_OPEN)) {
+    usbPollWrapper(); /* keep enumeration going without waiting */
+    if (!(deviceState & USB_STATE_CONFIGURED))
+      return 0; /* nobody is listening, drop the byte */
+    /* park the byte until the port is opened or the bus resumes */
+    if (RingBuffer_IsFull(&txBuf)) {
+      STATS(driverStats.txFull++);
+      return 0;
+    }
+    RingBuffer_Insert(&txBuf, c);
+    STATS(updateHighWater(&driverStats.txHighWater, &txBuf));
+    return 1;
+  }
   if (RingBuffer_IsFull(&txBuf)) {
+    STATS(driverStats.txFull++);
     refresh();
     return 0;
   } else {
     RingBuffer_Insert(&txBuf, c);
+    STATS(updateHighWater(&driverStats.txHighWater, &txBuf));
     DigiWebUSBDevice::delay(
         5); // gives 4.2-4.7ms per character for usb transfer at low speed
     return 1;
@@ -185,50 +575,121 @@ void DigiWebUSBDevice::refresh(void) {
 void DigiWebUSBDevice::end(void) {
   // drive both USB pins low to disconnect
   usbDeviceDisconnect();
-  cli();
-  RingBuffer_InitBuffer(&rxBuf, rxBuf_Data, sizeof(rxBuf_Data));
-  sei();
+  deviceState = 0;
+  ATOMIC_BLOCK(HW_CDC_WATCHED_RESTORESTATE) {
+    RingBuffer_InitBuffer(&rxBuf, rxBuf_Data, sizeof(rxBuf_Data));
+  }
 }
 
 DigiWebUSBDevice::operator bool() {
   refresh();
-  return true;
+  return (deviceState & (USB_STATE_CONFIGURED | USB_STATE_PORT_OPEN |
+                         USB_STATE_SUSPENDED)) ==
+         (USB_STATE_CONFIGURED | USB_STATE_PORT_OPEN);
 }
 
-void DigiWebUSBDevice::usbBegin() {
-  cli();
+uchar DigiWebUSBDevice::state() { return deviceState; }
 
-  PORTB &= ~(_BV(USB_CFG_DMINUS_BIT) | _BV(USB_CFG_DPLUS_BIT));
-  usbDeviceDisconnect();
-  _delay_ms(250);
-  usbDeviceConnect();
-  usbInit();
+/* Signals remote wakeup to a suspended host and waits until the bus resumes.
+ * Data written before the call is handed to the driver while waiting, so it
+ * goes out with the first IN transaction after the resume sequence.
+ */
+bool DigiWebUSBDevice::wakeup() {
+#if USB_CFG_IMPLEMENT_REMOTE_WAKEUP && USB_COUNT_SOF
+  updateDeviceState();
+  if (!(deviceState & USB_STATE_SUSPENDED) || !usbRemoteWakeupEnabled)
+    return false;
+  /* millis() steps about once per ms and runs 3% fast at 16.5 MHz: two
+   * more counts make sure the bus was idle for the full time */
+  while (millis() - lastSofMillis < HW_CDC_WAKEUP_IDLE_MS + 2)
+    ;
+
+  /* drive K state (D+ high, D- low at low speed) with the USB interrupt off;
+   * the other interrupts stay on, only the port and mask updates are atomic
+   */
+  ATOMIC_BLOCK(HW_CDC_WATCHED_RESTORESTATE) {
+    USB_INTR_ENABLE &= ~(1 << USB_INTR_ENABLE_BIT);
+    USBOUT = (USBOUT & ~USBMASK) | (1 << USBPLUS);
+    USBDDR |= USBMASK;
+  }
+  _delay_ms(HW_CDC_RESUME_MS);
+  ATOMIC_BLOCK(HW_CDC_WATCHED_RESTORESTATE) {
+    USBDDR &= ~USBMASK;
+    USBOUT &= ~USBMASK;
+    USB_INTR_PENDING = 1 << USB_INTR_PENDING_BIT;
+    USB_INTR_ENABLE |= 1 << USB_INTR_ENABLE_BIT;
+  }
 
+  uint32_t start = millis();
+  do {
+    usbPollWrapper();
+  } while ((deviceState & USB_STATE_SUSPENDED) &&
+           millis() - start < HW_CDC_RESUME_TIMEOUT_MS);
+  return !(deviceState & USB_STATE_SUSPENDED);
+#else
+  return false;
+#endif
+}
+
+/* Only the USB interrupt is off while the device is disconnected, so
+ * millis() keeps counting; the driver's state is reset before usbInit()
+ * lets the interrupt in again.
+ */
+void DigiWebUSBDevice::usbBegin() {
+  ATOMIC_BLOCK(HW_CDC_WATCHED_RESTORESTATE) {
+    USB_INTR_ENABLE &= ~(1 << USB_INTR_ENABLE_BIT);
+    PORTB &= ~(_BV(USB_CFG_DMINUS_BIT) | _BV(USB_CFG_DPLUS_BIT));
+    usbDeviceDisconnect();
+  }
   RingBuffer_InitBuffer(&txBuf, txBuf_Data, sizeof(txBuf_Data));
   RingBuffer_InitBuffer(&rxBuf, rxBuf_Data, sizeof(rxBuf_Data));
 
   intr3Status = 0;
   sendEmptyFrame = 0;
-
-  sei();
+  lineState = 0;
+  rxOverflow = 0;
+  deviceState = USB_STATE_ATTACHED;
+
+  _delay_ms(HW_CDC_DISCONNECT_MS);
+  ATOMIC_BLOCK(HW_CDC_WATCHED_RESTORESTATE) {
+    usbDeviceConnect();
+    usbInit();
+  }
 }
-uchar *DigiWebUSBDevice::deb() { return _deb; }
 
 void DigiWebUSBDevice::usbPollWrapper() {
+#if HW_CDC_STATS || HW_CDC_WATCHDOG
+  uint16_t interval = pollInterval();
+#endif
+  STATS(countPoll(interval));
   usbPoll();
-  while ((!(RingBuffer_IsEmpty(&txBuf))) && (index < 9)) {
-    tmp[index++] = RingBuffer_Remove(&txBuf);
+  calibrateOscillatorPoll();
+  updateDeviceState();
+  checkRx();
+#if HW_CDC_BENCHMARK
+  if (benchState == BENCH_REQUESTED) {
+    benchState = BENCH_RUNNING; /* the kernels call us again */
+    runBenchmark();
+    benchState = BENCH_IDLE;
+  }
+#endif
+  /* at most one packet: tmp[] and the endpoint take HW_CDC_BULK_IN_SIZE */
+  while ((!(RingBuffer_IsEmpty(&txBuf))) && (tmpIndex < HW_CDC_BULK_IN_SIZE)) {
+    tmp[tmpIndex++] = RingBuffer_Remove(&txBuf);
   }
 
   if (usbInterruptIsReady()) {
     if (sendEmptyFrame) {
       usbSetInterrupt(tmp, 0);
       sendEmptyFrame = 0;
-    } else if (index > 0) {
-      usbSetInterrupt(tmp, index);
-      usbEnableAllRequests();
+      STATS(driverStats.inPackets++);
+      TRACE(WL_TRACE_IN, 0, RingBuffer_GetCount(&txBuf));
+    } else if (tmpIndex > 0) {
+      usbSetInterrupt(tmp, tmpIndex);
+      STATS(driverStats.inPackets++; driverStats.inBytes += tmpIndex);
+      TRACE(WL_TRACE_IN, tmpIndex, RingBuffer_GetCount(&txBuf));
       sendEmptyFrame = 1;
-      index = 0;
+      tmpIndex = 0;
     }
   }
 
@@ -242,8 +703,12 @@ void DigiWebUSBDevice::usbPollWrapper() {
     } else {
       usbSetInterrupt3(serialStateNotification + 8, 2);
     }
+    STATS(driverStats.notifyPackets++);
     intr3Status--;
   }
+#if HW_CDC_WATCHDOG
+  checkDeadlines(interval);
+#endif
 }
 
 #ifdef __cplusplus
@@ -264,9 +729,8 @@ enum {
 const uchar *pmResponsePtr = NULL;
 uchar pmResponseBytesRemaining = 0;
 
-// Microsoft OS 2.0 Descriptor Set
-//
-// See https://goo.gl/4T73ef for discussion about bConfigurationValue:
+// bConfigurationValue in the MS OS 2.0 configuration subset header, see
+// https://goo.gl/4T73ef:
 //
 // "It looks like we'll need to update the MSOS 2.0 Descriptor docs to
 // match the implementation in USBCCGP. The bConfigurationValue in the
@@ -276,48 +740,12 @@ uchar pmResponseBytesRemaining = 0;
 // Try changing the value to 0 and see if that resolves the issue.
 // Sorry for the confusion."
 #define WINUSB_REQUEST_DESCRIPTOR (0x07)
-const uchar MS_OS_20_DESCRIPTOR_SET[MS_OS_20_DESCRIPTOR_LENGTH] PROGMEM = {
-    // Microsoft OS 2.0 descriptor set header (table 10)
-    0x0A,
-    0x00, // Descriptor size (10 bytes)
-    0x00,
-    0x00, // MS OS 2.0 descriptor set header
-    0x00, 0x00, 0x03,
-    0x06, // Windows version (8.1) (0x06030000)
-    MS_OS_20_DESCRIPTOR_LENGTH,
-    0x00, // Size, MS OS 2.0 descriptor set
 
-    // Microsoft OS 2.0 compatible ID descriptor (table 13)
-    0x14,
-    0x00, // wLength
-    0x03,
-    0x00, // MS_OS_20_FEATURE_COMPATIBLE_ID
-    'W', 'I', 'N', 'U', 'S', 'B', 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00,
-};
-
-/*
-const PROGMEM char usbDescriptorDevice[] = {
- // USB device descriptor
-  0x12,  // sizeof(usbDescriptorDevice): length of descriptor in bytes
-  USBDESCR_DEVICE,        // descriptor type
-  0x10, 0x02,             // USB version supported == 2.1
-  USB_CFG_DEVICE_CLASS,
-  USB_CFG_DEVICE_SUBCLASS,
-  0,                      // protocol
-  8,                      // max packet size
-  // the following two casts affect the first byte of the constant only, but
-  // that's sufficient to avoid a warning with the default values.
-  (char)USB_CFG_VENDOR_ID,
-  (char)USB_CFG_DEVICE_ID,
-  USB_CFG_DEVICE_VERSION,
-  1,  // manufacturer string index
-  2,  // product string index
-  3,  // serial number string index
-  1,  // number of configurations
-};
-*/
-static const PROGMEM char configDescrCDC[] = {
+/* The device descriptor is the driver's (usbdrv.c), the configuration
+ * descriptor is served by the driver from here, see
+ * USB_CFG_DESCR_PROPS_CONFIGURATION in usbconfig.h.
+ */
+const PROGMEM char usbDescriptorConfiguration[] = {
     /* USB configuration descriptor */
     9,               /* sizeof(usbDescrConfig): length of descriptor in bytes */
     USBDESCR_CONFIG, /* descriptor type */
@@ -325,11 +753,14 @@ static const PROGMEM char configDescrCDC[] = {
     2,     /* number of interfaces in this configuration */
     1,     /* index of this configuration */
     0,     /* configuration name string index */
+    (char)((1 << 7) |
 #if USB_CFG_IS_SELF_POWERED
-    (1 << 7) | USBATTR_SELFPOWER, /* attributes */
-#else
-    (1 << 7), /* attributes */
+           USBATTR_SELFPOWER |
+#endif
+#if USB_CFG_IMPLEMENT_REMOTE_WAKEUP
+           USBATTR_REMOTEWAKE |
 #endif
+           0), /* attributes */
     USB_CFG_MAX_BUS_POWER / 2, /* max USB current in 2mA units */
 
     /* interface descriptor follows inline: */
@@ -369,10 +800,10 @@ static const PROGMEM char configDescrCDC[] = {
     /* Endpoint Descriptor */
     7,                          /* sizeof(usbDescrEndpoint) */
     USBDESCR_ENDPOINT,          /* descriptor type = endpoint */
-    0x80 | USB_CFG_EP3_NUMBER,  /* IN endpoint number 3 */
+    (char)(0x80 | USB_CFG_EP3_NUMBER), /* IN endpoint number 3 */
     0x03,                       /* attrib: Interrupt endpoint */
     8, 0,                       /* maximum packet size */
-    USB_CFG_INTR_POLL_INTERVAL, /* in ms */
+    (char)USB_CFG_INTR_POLL_INTERVAL, /* in ms */
 
     /* Interface Descriptor  */
     9, /* sizeof(usbDescrInterface): length of descriptor in bytes */
@@ -395,58 +826,72 @@ static const PROGMEM char configDescrCDC[] = {
     /* Endpoint Descriptor */
     7,                      /* sizeof(usbDescrEndpoint) */
     USBDESCR_ENDPOINT,      /* descriptor type = endpoint */
-    0x81,                   /* IN endpoint number 1 */
+    (char)0x81,             /* IN endpoint number 1 */
     0x02,                   /* attrib: Bulk endpoint */
     HW_CDC_BULK_IN_SIZE, 0, /* maximum packet size */
     0,                      /* in ms */
 };
 
-const char _usbDescriptorDevice[] PROGMEM = {
-    // USB device descriptor
-    0x12, // sizeof(usbDescriptorDevice): length of descriptor in bytes
-    USBDESCR_DEVICE, // descriptor type
-    0x10, 0x02,      // USB version supported == 2.1
-    USB_CFG_DEVICE_CLASS, USB_CFG_DEVICE_SUBCLASS,
-    0, // protocol
-    8, // max packet size
-    // the following two casts affect the first byte of the constant only, but
-    // that's sufficient to avoid a warning with the default values.
-    (char)USB_CFG_VENDOR_ID, (char)USB_CFG_DEVICE_ID, USB_CFG_DEVICE_VERSION,
-    1, // manufacturer string index
-    2, // product string index
-    3, // serial number string index
-    1, // number of configurations
-};
+static_assert(sizeof(usbDescriptorConfiguration) ==
+                  USB_PROP_LENGTH(USB_CFG_DESCR_PROPS_CONFIGURATION),
+              "usbconfig.h has the wrong configuration descriptor length");
 
-uchar usbFunctionDescriptor(usbRequest_t *rq) {
-  pmResponseBytesRemaining = 0;
-  switch (rq->wValue.bytes[1]) {
+/* Assemble the descriptors with run time fields in buffer and return their
+ * length.
+ */
+#if USB_CFG_HAVE_BOS_DESCRIPTOR || HW_CDC_BENCHMARK
+static uchar buildBosDescriptor(void) {
+  uchar length = 5;
+#if HW_CDC_WEBUSB
+  memcpy_P(&buffer[length], &WEBUSB_CAPABILITY, sizeof(WEBUSB_CAPABILITY));
+  length += sizeof(WEBUSB_CAPABILITY);
+  buffer[length++] = landingPage;
+#endif
+#if HW_CDC_WINUSB
+  memcpy_P(&buffer[length], &MS_OS_20_CAPABILITY, sizeof(MS_OS_20_CAPABILITY));
+  length += sizeof(MS_OS_20_CAPABILITY);
+#endif
+  buffer[0] = 5; /* BOS descriptor header */
+  buffer[1] = USB_BOS_DESCRIPTOR_TYPE;
+  buffer[2] = length;
+  buffer[3] = 0;
+  buffer[4] = HW_CDC_WEBUSB + HW_CDC_WINUSB; /* bNumDeviceCaps */
+  return length;
+}
+#endif
 
-  case USB_BOS_DESCRIPTOR_TYPE: {
+#if HW_CDC_WINUSB
+static_assert(sizeof(MS_OS_20_DESCRIPTOR_PREFIX) + 1 +
+                      sizeof(MS_OS_20_DESCRIPTOR_SUFFIX) ==
+                  MS_OS_20_DESCRIPTOR_LENGTH,
+              "MS_OS_20_DESCRIPTOR_LENGTH does not match the descriptor set");
+
+static uchar buildMsOs20DescriptorSet(void) {
+  uchar length = sizeof(MS_OS_20_DESCRIPTOR_PREFIX);
+  memcpy_P(buffer, &MS_OS_20_DESCRIPTOR_PREFIX, length);
+  memcpy(&buffer[length], &pluggedInterface, 1);
+  length++;
+  memcpy_P(&buffer[length], &MS_OS_20_DESCRIPTOR_SUFFIX,
+           sizeof(MS_OS_20_DESCRIPTOR_SUFFIX));
+  length += sizeof(MS_OS_20_DESCRIPTOR_SUFFIX);
+  return length;
+}
+#endif
 
-    int length = sizeof(BOS_DESCRIPTOR_PREFIX);
-    memcpy_P(buffer, &BOS_DESCRIPTOR_PREFIX, length);
-    memcpy(&buffer[length], &landingPage, 1);
-    length++;
-    memcpy_P(&buffer[length], &BOS_DESCRIPTOR_SUFFIX,
-             sizeof(BOS_DESCRIPTOR_SUFFIX));
-    length += sizeof(BOS_DESCRIPTOR_SUFFIX);
+/* Called by the driver for the descriptors it does not have itself. */
+uchar usbFunctionDescriptor(usbRequest_t *rq) {
+  STATS(driverStats.descriptorRequests++);
+  TRACE(WL_TRACE_DESCRIPTOR, rq->wValue.bytes[1], rq->wValue.bytes[0]);
+  pmResponseBytesRemaining = 0;
+#if USB_CFG_HAVE_BOS_DESCRIPTOR
+  if (rq->wValue.bytes[1] == USB_BOS_DESCRIPTOR_TYPE) {
     pmResponsePtr = buffer;
-    pmResponseBytesRemaining = length;
+    pmResponseBytesRemaining = buildBosDescriptor();
     usbMsgPtr = (uchar *)(NULL);
     return USB_NO_MSG;
-  } break;
-  case WL_REQUEST_WEBUSB:
-    _deb[0] = 1;
-    _deb[1] = 2;
-    break;
-  case USBDESCR_DEVICE:
-    usbMsgPtr = (uchar *)_usbDescriptorDevice;
-    return _usbDescriptorDevice[0];
-  case USBDESCR_CONFIG:
-    usbMsgPtr = (uchar *)configDescrCDC;
-    return sizeof(configDescrCDC);
   }
+#endif
+  return 0;
 }
 
 /* -------------------------------------------------------------------------
@@ -455,33 +900,34 @@ uchar usbFunctionDescriptor(usbRequest_t *rq) {
  */
 /* -------------------------------------------------------------------------
  */
-static uint16_t currentValue, currentIndex;
 // static uchar currentPosition, bytesRemaining;
 // uchar currentRequest;
 uchar currentRequest;
 uchar usbFunctionSetup(uchar data[8]) {
-  uint8_t urlLength;
-  uint8_t descriptorLength;
   usbRequest_t *rq = (usbRequest_t *)((void *)data);
   currentRequest = rq->bRequest;
-  currentValue = rq->wValue.word;
-  currentIndex = rq->wIndex.word;
   pmResponseBytesRemaining = 0;
+#if HW_CDC_STATS
+  if ((rq->bmRequestType & USBRQ_TYPE_MASK) == USBRQ_TYPE_CLASS)
+    driverStats.classRequests++;
+  else if ((rq->bmRequestType & USBRQ_TYPE_MASK) == USBRQ_TYPE_VENDOR)
+    driverStats.vendorRequests++;
+#endif
+  TRACE(WL_TRACE_SETUP, rq->bmRequestType, rq->bRequest);
 
   switch (rq->bRequest) {
+#if HW_CDC_WEBUSB
   case WL_REQUEST_WEBUSB:
 
     switch (rq->wIndex.word) {
     case WEBUSB_REQUEST_GET_ALLOWED_ORIGINS: {
-      _deb[0] = 3;
-      _deb[3] = 13;
       uint8_t allowedOriginsPrefix[] = {
           // Allowed Origins Header, bNumConfigurations = 1
-          0x05, 0x00, 0x0c + numAllowedOrigins, 0x00, 0x01,
+          0x05, 0x00, (uint8_t)(0x0c + numAllowedOrigins), 0x00, 0x01,
           // Configuration Subset Header, bNumFunctions = 1
           0x04, 0x01, 0x01, 0x01,
           // Function Subset Header, bFirstInterface = pluggedInterface
-          0x03 + numAllowedOrigins, 0x02, pluggedInterface};
+          (uint8_t)(0x03 + numAllowedOrigins), 0x02, pluggedInterface};
       memcpy(buffer, allowedOriginsPrefix, sizeof(allowedOriginsPrefix));
       memcpy(&buffer[sizeof(allowedOriginsPrefix)], allowedOrigins,
              numAllowedOrigins);
@@ -494,8 +940,8 @@ uchar usbFunctionSetup(uchar data[8]) {
     case WEBUSB_REQUEST_GET_URL: {
 
       const WebUSBURL &url = urls[rq->wValue.bytes[0] - 1];
-      urlLength = strlen(url.url);
-      descriptorLength = urlLength + 3;
+      uint8_t urlLength = strlen(url.url);
+      uint8_t descriptorLength = urlLength + 3;
       buffer[0] = descriptorLength;
       buffer[1] = 3;
       buffer[2] = url.scheme;
@@ -508,24 +954,95 @@ uchar usbFunctionSetup(uchar data[8]) {
     }
     }
     break;
+#endif
+#if HW_CDC_WINUSB
   case WL_REQUEST_WINUSB:
-_deb[0] = 3;
-    _deb[1] = 77;
     switch (rq->wIndex.word) {
     case WINUSB_REQUEST_DESCRIPTOR:
-      int length = sizeof(MS_OS_20_DESCRIPTOR_PREFIX);
-      memcpy_P(buffer, &MS_OS_20_DESCRIPTOR_PREFIX, length);
-      memcpy(&buffer[length], &pluggedInterface, 1);
-      length++;
-      memcpy_P(&buffer[length], &MS_OS_20_DESCRIPTOR_SUFFIX,
-               sizeof(MS_OS_20_DESCRIPTOR_SUFFIX));
-      length += sizeof(MS_OS_20_DESCRIPTOR_SUFFIX);
       pmResponsePtr = buffer;
-      pmResponseBytesRemaining = length;
+      pmResponseBytesRemaining = buildMsOs20DescriptorSet();
       usbMsgPtr = (uchar *)(NULL);
       return USB_NO_MSG;
     }
     break;
+#endif
+#if !HW_CDC_MIN
+  case WL_REQUEST_GET_OSCCAL:
+    buffer[0] = OSCCAL;
+#ifdef OSCCAL_EEPROM_ADDR
+    buffer[1] = eeprom_read_byte((uint8_t *)OSCCAL_EEPROM_ADDR);
+#else
+    buffer[1] = 0xff;
+#endif
+#ifdef USB_SOF_HOOK
+    buffer[2] = osctuneCorrections;
+#else
+    buffer[2] = 0;
+#endif
+    usbMsgPtr = buffer;
+    return 3;
+#endif
+#if HW_CDC_BENCHMARK
+  case WL_REQUEST_BENCHMARK:
+    /* The new run starts before the answer is sent and its kernels use
+     * buffer, so the answer is a copy of the last results.
+     */
+    if (benchState == BENCH_IDLE)
+      benchState = BENCH_REQUESTED;
+    benchReply[0] = benchRuns;
+    benchReply[1] = BENCH_KERNELS;
+    benchReply[2] = (F_CPU / 1000) & 0xff;
+    benchReply[3] = (F_CPU / 1000) >> 8;
+    memcpy(&benchReply[4], benchCycles, sizeof(benchCycles));
+    usbMsgPtr = benchReply;
+    return sizeof(benchReply);
+#endif
+#if HW_CDC_STATS
+  case WL_REQUEST_GET_STATS:
+    memcpy(buffer, &driverStats, sizeof(driverStats));
+    if (rq->wValue.bytes[0] & 1)
+      memset(&driverStats, 0, sizeof(driverStats));
+    usbMsgPtr = buffer;
+    return sizeof(driverStats);
+#endif
+#if HW_CDC_TRACE
+  case WL_REQUEST_GET_TRACE: {
+    uchar max = (sizeof(buffer) - 2) / sizeof(DigiWebUSBTraceEvent);
+    if (rq->wLength.word < 2)
+      return 0;
+    if (rq->wLength.word < sizeof(buffer))
+      max = (rq->wLength.word - 2) / sizeof(DigiWebUSBTraceEvent);
+    buffer[1] = traceLost;
+    traceLost = 0;
+    buffer[0] = traceDrain((DigiWebUSBTraceEvent *)&buffer[2], max);
+    usbMsgPtr = buffer;
+    return 2 + buffer[0] * sizeof(DigiWebUSBTraceEvent);
+  }
+#endif
+#if HW_CDC_STACK_CHECK
+  case WL_REQUEST_GET_RAM: {
+    uint16_t ram[3];
+    ram[0] = stackUntouched();
+    ram[1] = SP + 1 - (uint16_t)&_end;
+    ram[2] = (uint16_t)&_end - RAMSTART;
+    memcpy(buffer, ram, sizeof(ram));
+    usbMsgPtr = buffer;
+    return sizeof(ram);
+  }
+#endif
+#if DEBUG_LEVEL > 0 && ODDBG_RING
+  case WL_REQUEST_GET_DEBUG_LOG: {
+    uchar max = sizeof(buffer);
+    if (rq->wLength.word < max)
+      max = rq->wLength.word;
+    if (max == 0)
+      return 0;
+    buffer[0] = odDebugDropped;
+    odDebugDropped = 0;
+    usbMsgPtr = buffer;
+    return 1 + odDebugDrain(buffer + 1, max - 1);
+  }
+#endif
   }
   if ((rq->bmRequestType & USBRQ_TYPE_MASK) ==
       USBRQ_TYPE_CLASS) { /* class request type */
@@ -536,6 +1053,7 @@ _deb[0] = 3;
       /*    SET_LINE_CODING -> usbFunctionWrite()    */
     }
     if (rq->bRequest == SET_CONTROL_LINE_STATE) {
+      lineState = rq->wValue.bytes[0];
       /* Report serial state (carrier detect). On several Unix platforms,
        * tty devices can only be opened when carrier detect is set.
        */
@@ -547,51 +1065,183 @@ _deb[0] = 3;
     if ((rq->bmRequestType & USBRQ_DIR_MASK) == USBRQ_DIR_HOST_TO_DEVICE)
       sendEmptyFrame = 1;
   }
+  return 0;
 }
 /*---------------------------------------------------------------------------*/
 /* usbFunctionRead                                                          */
 /*---------------------------------------------------------------------------*/
-int i = 0;
 uchar usbFunctionRead(uchar *data, uchar len) {
-  if (currentValue == WEBUSB_REQUEST_GET_URL) {
-    _deb[0] = 3;
-    _deb[3] = 9;
-  }
-  if (pmResponseBytesRemaining == 0)
-    return 0;
-  /*i++;
-  _deb[0] = i ;
-  if(i <10){
-    _deb[i] = pmResponsePtr[0];
-  } */
   if (len > pmResponseBytesRemaining) {
     len = pmResponseBytesRemaining;
   }
   memcpy(data, pmResponsePtr, len);
   pmResponsePtr += len;
   pmResponseBytesRemaining -= len;
+  TRACE(WL_TRACE_READ, len, pmResponseBytesRemaining);
   return len;
 }
 
 /*---------------------------------------------------------------------------*/
 /* usbFunctionWrite                                                          */
 /*---------------------------------------------------------------------------*/
-uchar usbFunctionWrite(uchar *data, uchar len) { return 0; }
+#if USB_CFG_IMPLEMENT_FN_WRITE
+uchar usbFunctionWrite(uchar *data, uchar len) {
+  TRACE(WL_TRACE_WRITE, len, 0);
+  return 0;
+}
+#endif
 
 void usbFunctionWriteOut(uchar *data, uchar len) {
   uint8_t qw = 0;
+  STATS(driverStats.outPackets++; driverStats.outBytes += len);
   for (qw = 0; qw < len; qw++) {
     if (!RingBuffer_IsFull(&rxBuf)) {
       RingBuffer_Insert(&rxBuf, data[qw]);
+    } else {
+      STATS(driverStats.rxDropped++);
     }
   }
+  STATS(updateHighWater(&driverStats.rxHighWater, &rxBuf));
+  TRACE(WL_TRACE_OUT, len, RingBuffer_GetCount(&rxBuf));
 
-  /* postpone receiving next data */
-  if (RingBuffer_GetCount(&rxBuf) >= HW_CDC_BULK_OUT_SIZE) {
-    usbDisableAllRequests();
-  }
+  /* postpone receiving next data until read() makes room */
+  if (RingBuffer_GetCount(&rxBuf) > HW_CDC_RX_HIGH_WATER && !rxOverflow)
+    stopRx();
 }
 
 #ifdef __cplusplus
 } // extern "C"
 #endif
+
+#if HW_CDC_BENCHMARK
+/* Timer 1 is borrowed while the kernels run and restored afterwards. It
+ * counts CPU cycles; the 8 bit timer of the ATtiny25/45/85 counts them in
+ * steps of 8 to reach 2040.
+ */
+#if defined(TCCR1)
+#define BENCH_CYCLES_PER_TICK 8
+static uchar savedTccr1, savedTcnt1, savedPllcsr;
+
+static void benchTimerSave(void) {
+  savedTccr1 = TCCR1;
+  savedTcnt1 = TCNT1;
+  savedPllcsr = PLLCSR;
+  PLLCSR &= ~_BV(PCKE); /* synchronous clock */
+}
+
+static void benchTimerRestore(void) {
+  PLLCSR = savedPllcsr;
+  TCNT1 = savedTcnt1;
+  TCCR1 = savedTccr1;
+}
+
+static void benchTimerStart(void) {
+  TCCR1 = 0;
+  TCNT1 = 0;
+  TIFR = _BV(TOV1);
+  GTCCR |= _BV(PSR1);
+  TCCR1 = _BV(CS12); /* CK/8 */
+}
+
+static uint16_t benchTimerStop(void) {
+  uchar ticks = TCNT1;
+  TCCR1 = 0;
+  return (TIFR & _BV(TOV1)) ? 0xffff : ticks * BENCH_CYCLES_PER_TICK;
+}
+#elif defined(TIFR1) /* 16 bit timer 1 */
+static uchar savedTccr1a, savedTccr1b;
+static uint16_t savedTcnt1;
+
+static void benchTimerSave(void) {
+  savedTccr1a = TCCR1A;
+  savedTccr1b = TCCR1B;
+  savedTcnt1 = TCNT1;
+  TCCR1A = 0;
+}
+
+static void benchTimerRestore(void) {
+  TCNT1 = savedTcnt1;
+  TCCR1A = savedTccr1a;
+  TCCR1B = savedTccr1b;
+}
+
+static void benchTimerStart(void) {
+  TCCR1B = 0;
+  TCNT1 = 0;
+  TIFR1 = _BV(TOV1);
+  TCCR1B = _BV(CS10); /* CK/1 */
+}
+
+static uint16_t benchTimerStop(void) {
+  uint16_t ticks = TCNT1;
+  TCCR1B = 0;
+  return (TIFR1 & _BV(TOV1)) ? 0xffff : ticks;
+}
+#else
+#error "HW_CDC_BENCHMARK needs the timer 1 of an ATtiny25/45/85 or a 16 bit one"
+#endif
+
+static volatile unsigned benchSink; /* keeps results alive */
+
+static void benchRingBuffer(void) {
+  static RingBuffer_t ring;
+  static uint8_t data[HW_CDC_BULK_OUT_SIZE];
+
+  RingBuffer_InitBuffer(&ring, data, sizeof(data));
+  for (uchar i = 0; i < sizeof(data); i++)
+    RingBuffer_Insert(&ring, i);
+  for (uchar i = 0; i < sizeof(data); i++)
+    benchSink = RingBuffer_Remove(&ring);
+}
+
+/* Runs each kernel HW_CDC_BENCHMARK_RUNS times and keeps the fastest run,
+ * the one least disturbed by the USB interrupt, which stays enabled. The
+ * poll kernel goes last: the usbPoll() it calls may start a control transfer
+ * that reads from buffer.
+ */
+void DigiWebUSBDevice::runBenchmark() {
+  uint16_t best[BENCH_KERNELS + 1], t;
+
+  benchTimerSave();
+  for (uchar k = 0; k <= BENCH_KERNELS; k++) {
+    /* the empty kernel first, its time is subtracted from the others */
+    uchar kernel = k == 0 ? BENCH_KERNELS : k - 1;
+    best[kernel] = 0xffff;
+    for (uchar run = 0; run < HW_CDC_BENCHMARK_RUNS; run++) {
+      benchTimerStart();
+      switch (kernel) {
+      case BENCH_RING_BUFFER:
+        benchRingBuffer();
+        break;
+      case BENCH_CRC16:
+        benchSink = usbCrc16(buffer, HW_CDC_BULK_IN_SIZE);
+        break;
+      case BENCH_BOS_DESCRIPTOR:
+        benchSink = buildBosDescriptor();
+        break;
+      case BENCH_MS_OS_20_DESCRIPTOR:
+#if HW_CDC_WINUSB
+        benchSink = buildMsOs20DescriptorSet();
+#endif
+        break;
+      case BENCH_POLL:
+        usbPollWrapper();
+        break;
+      }
+      t = benchTimerStop();
+      if (t < best[kernel])
+        best[kernel] = t;
+    }
+  }
+  benchTimerRestore();
+
+  for (uchar k = 0; k < BENCH_KERNELS; k++) {
+    t = best[k];
+    if (t != 0xffff)
+      t = t > best[BENCH_KERNELS] ? t - best[BENCH_KERNELS] : 0;
+    benchCycles[k] = t;
+  }
+  if (++benchRuns == 0)
+    benchRuns = 1;
+}
+#endif
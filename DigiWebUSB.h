@@ -11,12 +11,150 @@ and Digistump LLC (digistump.com)
 #include "usbdrv.h"
 
 #include "Stream.h"
+#ifndef HW_CDC_WATCHDOG
+#define HW_CDC_WATCHDOG 0 /* 1: check poll intervals and interrupts-off time */
+#endif
+#ifndef HW_CDC_POLL_LIMIT_US
+#define HW_CDC_POLL_LIMIT_US 10000 /* longest time between two polls */
+#endif
+#ifndef HW_CDC_IRQ_OFF_LIMIT
+#define HW_CDC_IRQ_OFF_LIMIT 1 /* timer 0 ticks (64 cycles), see below */
+#endif
+#if HW_CDC_WATCHDOG
+#include <avr/io.h>
+#include <util/atomic.h>
+
+/* The time with interrupts off is read from timer 0, which the Arduino core
+ * runs at F_CPU/64. A window of n ticks lasted between n-1 and n+1 times 64
+ * cycles, so only windows of more than HW_CDC_IRQ_OFF_LIMIT ticks count as
+ * too long: at the default of 1, windows of certainly more than 64 cycles.
+ * Shorter windows can still make the driver miss a packet; they are not
+ * told apart from harmless ones at this resolution.
+ * Windows are measured for ATOMIC_BLOCK(HW_CDC_WATCHED_RESTORESTATE),
+ * which the library uses throughout; wrap the sketch's critical sections
+ * in it too. Plain cli()/sei() pairs and the time spent in other interrupt
+ * routines (the core's timer 0 overflow, the sketch's own) are not seen.
+ * Windows longer than 255 ticks (about 1 ms) wrap around.
+ */
+extern volatile uint8_t hwCdcIrqOffMax;  /* longest window, ticks */
+extern volatile uint8_t hwCdcIrqOffLong; /* windows over the limit, to 255 */
+extern volatile uint8_t hwCdcIrqOffLast; /* length of the last such window */
+
+static inline uint16_t hwCdcWatchEnter(void) { return (SREG << 8) | TCNT0; }
+
+static inline void hwCdcWatchLeave(const uint16_t *save) {
+  uint8_t ticks = TCNT0 - (uint8_t)*save;
+
+  SREG = *save >> 8; /* the bookkeeping does not need interrupts off */
+  if (!(*save & 0x8000))
+    return; /* they were off already, in an interrupt routine */
+  if (ticks > hwCdcIrqOffMax)
+    hwCdcIrqOffMax = ticks;
+  if (ticks > HW_CDC_IRQ_OFF_LIMIT) {
+    hwCdcIrqOffLast = ticks;
+    if (hwCdcIrqOffLong != 0xff)
+      hwCdcIrqOffLong++;
+  }
+}
+
+#define HW_CDC_WATCHED_RESTORESTATE                                           \
+  uint16_t hw_cdc_watch_save __attribute__((__cleanup__(hwCdcWatchLeave))) = \
+      hwCdcWatchEnter()
+#define RINGBUFFER_RESTORESTATE HW_CDC_WATCHED_RESTORESTATE
+#else
+#include <util/atomic.h>
+#define HW_CDC_WATCHED_RESTORESTATE ATOMIC_RESTORESTATE
+#endif
 #include "ringBuffer.h"
+#include "requests.h"
 
-#define HW_CDC_TX_BUF_SIZE 32
-#define HW_CDC_RX_BUF_SIZE 32
+/* Per-MCU profile: ring and trace sizes scale with the RAM of the part,
+ * the ATtiny45/461 (256 bytes) get half of what the ATtiny85/167/861 (512
+ * bytes) get, parts with 1 KB or more get twice as much. Each size may be
+ * set on the compiler's command line instead. Flash does not enter into
+ * it: the ATtiny167's 16 KB buy the faster CRC (USB_USE_FAST_CRC in
+ * usbconfig.h, 32 bytes of code) but no RAM, and with the same 512 bytes
+ * as the ATtiny85 it gets the same rings. With HW_CDC_REPORT_PROFILE set
+ * to 1 on the compiler's command line, DigiWebUSB.cpp prints the result
+ * when it is compiled.
+ */
+#ifndef HW_CDC_REPORT_PROFILE
+#define HW_CDC_REPORT_PROFILE 0
+#endif
+#if RAMEND - RAMSTART + 1 >= 1024
+#define HW_CDC_PROFILE "1 KB RAM or more"
+#define HW_CDC_PROFILE_RING 64
+#define HW_CDC_PROFILE_TRACE 32
+#elif RAMEND - RAMSTART + 1 >= 512
+#define HW_CDC_PROFILE "512 bytes RAM"
+#define HW_CDC_PROFILE_RING 32
+#define HW_CDC_PROFILE_TRACE 16
+#else
+#define HW_CDC_PROFILE "256 bytes RAM"
+#define HW_CDC_PROFILE_RING 16
+#define HW_CDC_PROFILE_TRACE 8
+#endif
+#ifndef HW_CDC_TX_BUF_SIZE
+#define HW_CDC_TX_BUF_SIZE HW_CDC_PROFILE_RING
+#endif
+#ifndef HW_CDC_RX_BUF_SIZE
+#define HW_CDC_RX_BUF_SIZE HW_CDC_PROFILE_RING
+#endif
 #define HW_CDC_BULK_OUT_SIZE 8
 #define HW_CDC_BULK_IN_SIZE 8
+/* Flow control of bulk OUT: the driver stops taking packets when rxBuf holds
+ * more than HW_CDC_RX_HIGH_WATER bytes and goes on once read() has drained it
+ * to HW_CDC_RX_LOW_WATER or less. A stop holds off control requests too (the
+ * driver cannot stop one endpoint alone), so it is bounded: if read() takes
+ * nothing for HW_CDC_RX_STOP_MS, the driver goes on and OUT bytes that do
+ * not fit are dropped (rxDropped) until rxBuf is down to the low mark.
+ * A sketch that never reads keeps answering the host that way.
+ */
+#ifndef HW_CDC_RX_HIGH_WATER
+#define HW_CDC_RX_HIGH_WATER (HW_CDC_RX_BUF_SIZE - HW_CDC_BULK_OUT_SIZE)
+#endif
+#ifndef HW_CDC_RX_LOW_WATER
+#define HW_CDC_RX_LOW_WATER (HW_CDC_RX_BUF_SIZE / 2)
+#endif
+#ifndef HW_CDC_RX_STOP_MS
+#define HW_CDC_RX_STOP_MS 250
+#endif
+#if HW_CDC_RX_HIGH_WATER > HW_CDC_RX_BUF_SIZE - HW_CDC_BULK_OUT_SIZE
+#error "HW_CDC_RX_HIGH_WATER must leave room for a packet in rxBuf"
+#endif
+#if HW_CDC_RX_LOW_WATER > HW_CDC_RX_HIGH_WATER
+#error "HW_CDC_RX_LOW_WATER must not be above HW_CDC_RX_HIGH_WATER"
+#endif
+#define HW_CDC_SUSPEND_MS 3 /* bus idle time without SOF that means suspend */
+#define HW_CDC_WAKEUP_IDLE_MS 5 /* bus idle time required before resume */
+#define HW_CDC_RESUME_MS 10     /* K state duration of remote wakeup, 1..15 */
+#define HW_CDC_RESUME_TIMEOUT_MS 50 /* wait for SOFs after remote wakeup */
+#ifndef HW_CDC_DISCONNECT_MS
+#define HW_CDC_DISCONNECT_MS 50 /* forced disconnect before connecting */
+#endif
+#ifndef HW_CDC_ENUM_TIMEOUT_MS
+#define HW_CDC_ENUM_TIMEOUT_MS 500 /* max time begin() waits for the host */
+#endif
+#ifndef HW_CDC_BENCHMARK
+#define HW_CDC_BENCHMARK 0 /* 1: WL_REQUEST_BENCHMARK, borrows timer 1 */
+#endif
+#define HW_CDC_BENCHMARK_RUNS 8 /* runs per kernel, the fastest counts */
+#ifndef HW_CDC_STATS
+#define HW_CDC_STATS 0 /* 1: count traffic, see DigiWebUSBStats */
+#endif
+#ifndef HW_CDC_TRACE
+#define HW_CDC_TRACE 0 /* 1: event trace ring, see WL_REQUEST_GET_TRACE */
+#endif
+#ifndef HW_CDC_TRACE_SIZE
+#define HW_CDC_TRACE_SIZE HW_CDC_PROFILE_TRACE /* events, a power of 2 */
+#endif
+#ifndef HW_CDC_STACK_CHECK
+#define HW_CDC_STACK_CHECK 0 /* 1: paint the free RAM, see stackFree() */
+#endif
+#if HW_CDC_MIN && (HW_CDC_WATCHDOG || HW_CDC_BENCHMARK || HW_CDC_STATS ||      \
+                   HW_CDC_TRACE || HW_CDC_STACK_CHECK || DEBUG_LEVEL > 0)
+#error "HW_CDC_MIN (usbconfig.h) leaves out the diagnostic features"
+#endif
 #define USB_BOS_DESCRIPTOR_TYPE 15
 #define WL_REQUEST_WINUSB    (252)
 #define WL_REQUEST_WEBUSB    (254)
@@ -28,6 +166,14 @@ and Digistump LLC (digistump.com)
 #define MS_OS_20_REQUEST_DESCRIPTOR 0x07
 
 #define MS_OS_20_REQUEST_DESCRIPTOR 0x07
+
+/* Device state flags returned by DigiWebUSBDevice::state() */
+#define USB_STATE_ATTACHED 0x01   /* pull-up connected, usbInit() done */
+#define USB_STATE_ADDRESSED 0x02  /* SET_ADDRESS seen since the last reset */
+#define USB_STATE_CONFIGURED 0x04 /* SET_CONFIGURATION with a non-zero value */
+#define USB_STATE_PORT_OPEN 0x08  /* host asserted DTR */
+#define USB_STATE_SUSPENDED 0x10  /* no SOF for HW_CDC_SUSPEND_MS */
+
 typedef struct {
   uint8_t len;   // 9
   uint8_t dtype; // 4
@@ -61,27 +207,84 @@ typedef struct {
   const char *url;
 } WebUSBURL;
 
-/* library functions and variables start */
-static uint8_t tmp[HW_CDC_BULK_IN_SIZE];
-static uint8_t index = 0;
+#if HW_CDC_STATS
+/* Driver counters, returned by DigiWebUSBDevice::stats() and
+ * WL_REQUEST_GET_STATS. The 16 bit ones wrap around.
+ */
+typedef struct {
+  uint16_t outPackets; /* bulk OUT packets received */
+  uint16_t outBytes;
+  uint16_t inPackets; /* bulk IN packets queued, zero length ones included */
+  uint16_t inBytes;
+  uint16_t notifyPackets;   /* interrupt IN packets (serial state) queued */
+  uint16_t rxDropped;       /* OUT bytes lost because rxBuf was full */
+  uint16_t txFull;          /* write() calls that found txBuf full */
+  uint16_t flowStops;       /* bulk OUT stopped at HW_CDC_RX_HIGH_WATER */
+  uint16_t polls;           /* usbPollWrapper() calls */
+  uint16_t pollIntervalMax; /* longest time between two polls in us */
+  uint16_t descriptorRequests; /* GET_DESCRIPTOR passed to the library */
+  uint16_t classRequests;
+  uint16_t vendorRequests;
+  uint8_t rxHighWater; /* most bytes ever waiting in rxBuf */
+  uint8_t txHighWater; /* and in txBuf */
+  uint16_t throttledMs;    /* time bulk OUT was stopped, ended stops only */
+  uint16_t throttledMaxMs; /* longest single stop */
+} DigiWebUSBStats;
+#endif
 
-static RingBuffer_t rxBuf;
-static uint8_t rxBuf_Data[HW_CDC_RX_BUF_SIZE];
+#if HW_CDC_WATCHDOG
+/* Returned by DigiWebUSBDevice::watchdog() */
+typedef struct {
+  uint16_t pollIntervalMax; /* longest time between two polls in us */
+  uint16_t pollLate;        /* intervals of more than HW_CDC_POLL_LIMIT_US */
+  uint16_t irqOffMax;       /* longest interrupts-off window in cycles */
+  uint8_t irqOffLong;       /* windows over HW_CDC_IRQ_OFF_LIMIT, to 255 */
+} DigiWebUSBWatchdog;
+
+/* what of the onDeadlineMissed() callback */
+#define HW_CDC_MISSED_POLL 1    /* value: time since the last poll in us */
+#define HW_CDC_MISSED_IRQ_OFF 2 /* value: interrupts-off window in cycles */
+#endif
 
-static RingBuffer_t txBuf;
-static uint8_t txBuf_Data[HW_CDC_TX_BUF_SIZE];
+#if HW_CDC_TRACE
+typedef struct {
+  uint8_t event; /* WL_TRACE_* */
+  uint8_t time;  /* SOF count or timer 0, see WL_REQUEST_GET_TRACE */
+  uint8_t arg[2];
+} DigiWebUSBTraceEvent;
+#endif
 
+/* library functions and variables start */
 class DigiWebUSBDevice : public Stream {
 public:
   DigiWebUSBDevice(const WebUSBURL *urls, uint8_t numUrls, uint8_t landingPage,
                    const uint8_t *allowedOrigins, uint8_t numAllowedOrigins);
 
   void begin(), begin(unsigned long x);
+  void onReady(void (*callback)(void));
   void end();
   void refresh();
   void task();
   void delay(long milli);
-  uchar* deb();
+  void setIdleSleep(bool enable);
+  uint32_t sleepMicros();
+  uchar state();
+  bool wakeup();
+#if HW_CDC_STATS
+  void stats(DigiWebUSBStats *s);
+  void clearStats();
+#endif
+#if HW_CDC_WATCHDOG
+  void onDeadlineMissed(void (*callback)(uint8_t what, uint16_t value));
+  void watchdog(DigiWebUSBWatchdog *w);
+  void clearWatchdog();
+#endif
+#if HW_CDC_TRACE
+  uchar trace(DigiWebUSBTraceEvent *events, uchar max, uchar *lost = NULL);
+#endif
+#if HW_CDC_STACK_CHECK
+  uint16_t stackFree();
+#endif
   virtual int available(void);
   virtual int peek(void);
   virtual int read(void);
@@ -93,6 +296,9 @@ public:
 private:
   void usbBegin();
   void usbPollWrapper();
+#if HW_CDC_BENCHMARK
+  void runBenchmark();
+#endif
 };
 
 
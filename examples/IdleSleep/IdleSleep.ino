@@ -0,0 +1,45 @@
+#include <DigiWebUSB.h>
+
+const WebUSBURL urls[] = {
+    {1, "digistump.com"}, // scheme 1 = https://
+};
+const uint8_t allowedOrigins[] = {1};
+
+DigiWebUSBDevice WebUSB(urls, 1, 1, allowedOrigins, 1);
+
+uint32_t lastReport;
+uint32_t lastSlept;
+bool loaded;
+
+void setup() {
+  WebUSB.begin();
+  WebUSB.setIdleSleep(true); // sleep between USB events inside WebUSB.delay()
+  lastReport = micros();
+}
+
+// the loop routine runs over and over again forever:
+void loop() {
+  if (WebUSB.available()) {
+    // send '0' for the idle measurement, '1' to add some load
+    loaded = WebUSB.read() == '1';
+  }
+
+  if (loaded) {
+    volatile uint16_t work = 0;
+    for (uint16_t i = 0; i < 2000; i++)
+      work += i;
+  }
+
+  uint32_t now = micros();
+  if (now - lastReport >= 1000000) {
+    uint32_t slept = WebUSB.sleepMicros();
+    uint32_t active = (now - lastReport) - (slept - lastSlept);
+    lastReport = now;
+    lastSlept = slept;
+    WebUSB.print(loaded ? F("load ") : F("idle "));
+    // active cycles per second = active microseconds * cycles per microsecond
+    WebUSB.println(active * (F_CPU / 1000000L));
+  }
+
+  WebUSB.delay(10); // keep usb alive, sleeping while there is nothing to do
+}
@@ -0,0 +1,282 @@
+/* Name: avrcore.cpp
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+/*
+General Description:
+Arduino core and avr-libc functions for the host build. Time comes from the
+simulator's device clock: timer 0 runs with a prescaler of 64 as set up by
+the core, and millis() and micros() are derived from its overflows with the
+integer arithmetic of wiring.c. At 16.5 MHz this makes millis() run 3% fast
+against the USB frame clock, as it does on the device. Both return uint32_t,
+the unsigned long of the AVR, and wrap as they do there: micros() after about
+71 minutes.
+*/
+
+#include <Arduino.h>
+#include <avr/eeprom.h>
+#include "sim.h"
+
+#define CORE_CALL_CYCLES    40  /* cost of a millis() or micros() call */
+
+#define MICROSECONDS_PER_TIMER0_OVERFLOW    (64 * 256 / clockCyclesPerMicrosecond())
+#define MILLIS_INC  (MICROSECONDS_PER_TIMER0_OVERFLOW / 1000)
+#define FRACT_INC   ((MICROSECONDS_PER_TIMER0_OVERFLOW % 1000) >> 3)
+#define FRACT_MAX   (1000 >> 3)
+
+extern "C" {
+
+/* ------------------------------------------------------------------------- */
+
+uint32_t millis(void)
+{
+    uint64_t    overflows;
+
+    simRun(CORE_CALL_CYCLES);
+    overflows = simCycles() / (64 * 256);
+    return (uint32_t)(overflows * MILLIS_INC + overflows * FRACT_INC / FRACT_MAX);
+}
+
+uint32_t micros(void)
+{
+    uint64_t    ticks;
+
+    simRun(CORE_CALL_CYCLES);
+    ticks = simCycles() / 64;
+    return (uint32_t)(ticks * (64 / clockCyclesPerMicrosecond()));
+}
+
+void    delay(uint32_t ms)
+{
+    simRun((uint64_t)ms * 1000 * clockCyclesPerMicrosecond());
+}
+
+void    delayMicroseconds(unsigned int us)
+{
+    simRun((uint64_t)us * clockCyclesPerMicrosecond());
+}
+
+void    pinMode(uint8_t pin, uint8_t mode)
+{
+    if(mode == OUTPUT){
+        DDRB |= _BV(pin);
+    }else{
+        DDRB &= ~_BV(pin);
+        if(mode == INPUT_PULLUP){
+            PORTB |= _BV(pin);
+        }else{
+            PORTB &= ~_BV(pin);
+        }
+    }
+}
+
+void    digitalWrite(uint8_t pin, uint8_t value)
+{
+    if(value){
+        PORTB |= _BV(pin);
+    }else{
+        PORTB &= ~_BV(pin);
+    }
+}
+
+int     digitalRead(uint8_t pin)
+{
+    return (PINB >> pin) & 1;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static uint8_t  eeprom[E2END + 1];
+
+static struct EepromErase {
+    EepromErase() { memset(eeprom, 0xff, sizeof(eeprom)); }
+} eepromErase;
+
+#define EEPROM_CELL(addr)   eeprom[(uintptr_t)(addr) & E2END]
+
+uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+    return EEPROM_CELL(addr);
+}
+
+void    eeprom_write_byte(uint8_t *addr, uint8_t value)
+{
+    EEPROM_CELL(addr) = value;
+}
+
+void    eeprom_update_byte(uint8_t *addr, uint8_t value)
+{
+    EEPROM_CELL(addr) = value;
+}
+
+void    eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+        ((uint8_t *)dst)[i] = EEPROM_CELL((const uint8_t *)src + i);
+}
+
+void    eeprom_write_block(const void *src, void *dst, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+        EEPROM_CELL((uint8_t *)dst + i) = ((const uint8_t *)src)[i];
+}
+
+void    eeprom_update_block(const void *src, void *dst, size_t n)
+{
+    eeprom_write_block(src, dst, n);
+}
+
+} /* extern "C" */
+
+/* ------------------------------------------------------------------------- */
+/* --------------------------------- Print --------------------------------- */
+/* ------------------------------------------------------------------------- */
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t  n = 0;
+
+    while(size--){
+        if(!write(*buffer++))
+            break;
+        n++;
+    }
+    return n;
+}
+
+size_t Print::write(const char *str)
+{
+    return str == NULL ? 0 : write((const uint8_t *)str, strlen(str));
+}
+
+size_t Print::print(const __FlashStringHelper *s)
+{
+    const char  *p = (const char *)s;
+    size_t      n = 0;
+    uint8_t     c;
+
+    while((c = pgm_read_byte(p++)) != 0){
+        if(!write(c))
+            break;
+        n++;
+    }
+    return n;
+}
+
+size_t Print::print(const char s[])
+{
+    return write(s);
+}
+
+size_t Print::print(char c)
+{
+    return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char b, int base)
+{
+    return print((unsigned int)b, base);
+}
+
+size_t Print::print(int n, int base)
+{
+    if(base == DEC && n < 0)
+        return print('-') + printNumber(-(uint32_t)n, DEC);
+    return printNumber((uint32_t)n, base);
+}
+
+size_t Print::print(unsigned int n, int base)
+{
+    return printNumber(n, base);
+}
+
+size_t Print::print(long n, int base)
+{
+    if(base == DEC && n < 0)
+        return print('-') + printNumber(-(unsigned long)n, DEC);
+    return printNumber((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    return printNumber(n, base);
+}
+
+size_t Print::println(void)
+{
+    return write("\r\n");
+}
+
+size_t Print::println(const __FlashStringHelper *s)
+{
+    size_t  n = print(s);
+
+    return n + println();
+}
+
+size_t Print::println(const char s[])
+{
+    size_t  n = print(s);
+
+    return n + println();
+}
+
+size_t Print::println(char c)
+{
+    size_t  n = print(c);
+
+    return n + println();
+}
+
+size_t Print::println(unsigned char b, int base)
+{
+    size_t  n = print(b, base);
+
+    return n + println();
+}
+
+size_t Print::println(int num, int base)
+{
+    size_t  n = print(num, base);
+
+    return n + println();
+}
+
+size_t Print::println(unsigned int num, int base)
+{
+    size_t  n = print(num, base);
+
+    return n + println();
+}
+
+size_t Print::println(long num, int base)
+{
+    size_t  n = print(num, base);
+
+    return n + println();
+}
+
+size_t Print::println(unsigned long num, int base)
+{
+    size_t  n = print(num, base);
+
+    return n + println();
+}
+
+size_t Print::printNumber(unsigned long n, uint8_t base)
+{
+    char    buf[8 * sizeof(n) + 1];
+    char    *str = &buf[sizeof(buf) - 1];
+
+    *str = '\0';
+    if(base < 2)
+        base = 10;
+    do{
+        char c = n % base;
+        n /= base;
+        *--str = c < 10 ? c + '0' : c + 'A' - 10;
+    }while(n);
+    return write(str);
+}
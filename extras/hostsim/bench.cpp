@@ -0,0 +1,217 @@
+/* Name: bench.cpp
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+/*
+General Description:
+Times the kernels of benchkernels.cpp. Each kernel is run in batches that
+take about 10 ms of host time; the fastest of 15 batches is reported in ns
+per operation, which is the least disturbed by other processes.
+Results go to stdout as a table and, with --json, to a file. With
+--compare, each result is checked against a file written earlier and the
+program fails if any kernel got slower by more than the threshold. The
+comparison is relative to the calibration kernel, which runs no library
+code: if the whole host runs 10% slower than when the baseline was taken
+(clock scaling, a busy neighbour), that is not a regression.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bench.h"
+#include "sim.h"
+
+#define BATCH_NS    (10 * SIM_MS)
+#define ROUNDS      15
+#define BENCH_MAX_KERNELS   32
+
+static double   threshold = 15;     /* percent */
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [options]\n", name);
+    fprintf(stderr, "  --json FILE          write the results as JSON\n");
+    fprintf(stderr, "  --compare FILE       compare with results written earlier\n");
+    fprintf(stderr, "  --threshold PCT      slowdown that counts as a regression (15)\n");
+    fprintf(stderr, "  --filter NAME        run the kernels whose name contains NAME\n");
+    exit(2);
+}
+
+static double wallNs(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/* Returns the number of calls of the kernel that take about BATCH_NS. */
+static unsigned batchSize(const BenchKernel *k)
+{
+    unsigned    n = 1;
+    double      t;
+
+    for(;;){
+        t = wallNs();
+        k->run(n);
+        t = wallNs() - t;
+        if(t >= BATCH_NS / 4 || n >= 1u << 30)
+            break;
+        n *= 2;
+    }
+    n = (unsigned)(n * (BATCH_NS / (t > 1 ? t : 1)));
+    return n ? n : 1;
+}
+
+/* Runs a batch of each selected kernel per round, so that a disturbance
+ * hits all of them alike, and keeps the fastest batch of each in ns per
+ * operation.
+ */
+static void measure(double *results, const unsigned *sizes)
+{
+    double  t;
+
+    for(int round = 0; round < ROUNDS; round++){
+        for(int i = 0; i < benchKernelCount; i++){
+            const BenchKernel *k = &benchKernels[i];
+            if(sizes[i] == 0)
+                continue;
+            t = wallNs();
+            k->run(sizes[i]);
+            t = (wallNs() - t) / sizes[i] / k->ops;
+            if(round == 0 || t < results[i])
+                results[i] = t;
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void writeJson(const char *path, const double *results)
+{
+    FILE    *f = fopen(path, "w");
+
+    if(f == NULL){
+        perror(path);
+        exit(2);
+    }
+    fprintf(f, "{\n  \"unit\": \"ns/op\",\n  \"benchmarks\": [\n");
+    for(int i = 0, first = 1; i < benchKernelCount; i++){
+        if(results[i] < 0)
+            continue;
+        fprintf(f, "%s    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"description\": \"%s\"}",
+                first ? "" : ",\n", benchKernels[i].name, results[i],
+                benchKernels[i].description);
+        first = 0;
+    }
+    fprintf(f, "\n  ]\n}\n");
+    fclose(f);
+}
+
+/* Reads the value of "ns_per_op" that follows "name": "<name>" in a file
+ * written by writeJson(). Returns -1 if there is none.
+ */
+static double baselineValue(const char *json, const char *name)
+{
+    char        key[80];
+    const char  *p;
+
+    snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+    if((p = strstr(json, key)) == NULL || (p = strstr(p, "\"ns_per_op\":")) == NULL)
+        return -1;
+    return strtod(p + 12, NULL);
+}
+
+static char *readFile(const char *path)
+{
+    FILE    *f = fopen(path, "rb");
+    char    *data;
+    size_t  n;
+
+    if(f == NULL){
+        perror(path);
+        exit(2);
+    }
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    rewind(f);
+    data = (char *)malloc(n + 1);
+    data[fread(data, 1, n, f)] = 0;
+    fclose(f);
+    return data;
+}
+
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char **argv)
+{
+    const char  *jsonPath = NULL, *filter = NULL;
+    char        *baseline = NULL;
+    double      results[BENCH_MAX_KERNELS], base, speed = 1;
+    unsigned    sizes[BENCH_MAX_KERNELS];
+    int         regressions = 0;
+
+    for(int i = 1; i < argc; i++){
+        if(i + 1 >= argc)
+            usage(argv[0]);
+        if(strcmp(argv[i], "--json") == 0){
+            jsonPath = argv[++i];
+        }else if(strcmp(argv[i], "--compare") == 0){
+            baseline = readFile(argv[++i]);
+        }else if(strcmp(argv[i], "--threshold") == 0){
+            threshold = strtod(argv[++i], NULL);
+        }else if(strcmp(argv[i], "--filter") == 0){
+            filter = argv[++i];
+        }else{
+            usage(argv[0]);
+        }
+    }
+    simInit();
+    benchSetup();
+    for(int i = 0; i < benchKernelCount; i++){
+        sizes[i] = 0;
+        results[i] = -1;
+        if(filter == NULL || strstr(benchKernels[i].name, filter) != NULL)
+            sizes[i] = batchSize(&benchKernels[i]);
+    }
+    sizes[0] = batchSize(&benchKernels[0]);     /* always calibrate */
+    measure(results, sizes);
+    if(baseline != NULL && (base = baselineValue(baseline, BENCH_CALIBRATION)) > 0)
+        speed = base / results[0];  /* > 1 if the host is faster now */
+    printf("%-22s%10s", "kernel", "ns/op");
+    if(baseline != NULL)
+        printf("%10s%9s", "baseline", "change");
+    printf("  operation\n");
+    for(int i = 0; i < benchKernelCount; i++){
+        const BenchKernel *k = &benchKernels[i];
+        if(sizes[i] == 0)
+            continue;
+        printf("%-22s%10.2f", k->name, results[i]);
+        if(baseline != NULL){
+            if((base = baselineValue(baseline, k->name)) > 0){
+                double change = 100 * (results[i] * speed - base) / base;
+                printf("%10.2f%+8.1f%%", base, change);
+                if(change > threshold){
+                    regressions++;
+                    printf(" !");
+                }else{
+                    printf("  ");
+                }
+            }else{
+                printf("%10s%9s  ", "-", "");
+            }
+        }
+        printf("  %s\n", k->description);
+    }
+    if(jsonPath != NULL)
+        writeJson(jsonPath, results);
+    if(baseline != NULL){
+        printf("%d regressions above %.0f%%, host speed %.2f of the baseline's\n",
+               regressions, threshold, speed);
+        free(baseline);
+    }
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,37 @@
+/* Name: bench.h
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+/*
+General Description:
+Microbenchmarks of the library's hot paths, compiled for the host. The
+kernels (benchkernels.cpp) are built like the firmware and call the library
+as it is; bench.cpp times them with the host's clock, writes the results
+as JSON and compares them with a stored baseline. Host nanoseconds are not
+AVR cycles, but a change that makes a kernel slower here almost always
+does on the device too, and this runs in a second.
+*/
+
+#ifndef __bench_h_included__
+#define __bench_h_included__
+
+struct BenchKernel {
+    const char  *name;          /* key in the JSON output */
+    const char  *description;
+    int         ops;            /* operations per call of run */
+    void        (*run)(unsigned n); /* runs the kernel n times */
+};
+
+#define BENCH_CALIBRATION   "calibration"   /* name of the first kernel */
+
+extern const BenchKernel    benchKernels[];
+extern const int            benchKernelCount;
+
+void    benchSetup(void);
+/* Puts the library into the state the kernels expect: attached and
+ * configured, with the port closed. Call once before running any.
+ */
+
+#endif /* __bench_h_included__ */
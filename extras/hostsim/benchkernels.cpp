@@ -0,0 +1,172 @@
+/* Name: benchkernels.cpp
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+/*
+General Description:
+The kernels of the benchmark. This unit is compiled like the firmware
+(include/hostcompat.h) and runs the library's code without a host model:
+where the host would take a packet from the device, the kernel marks the
+driver's tx buffer free itself.
+*/
+
+extern "C" {
+#include "usbdrv.h"     /* usbCrc16() with C linkage, see usbisr.cpp */
+}
+#include <DigiCDC.h>
+#include "bench.h"
+
+extern "C" uchar    usbDeviceAddr;  /* defined in usbdrv.c */
+
+static volatile unsigned sink;     /* keeps results alive */
+static uchar    packet[8] = {0x54, 0x45, 0x53, 0x54, 0x21, 0x0d, 0x0a, 0x00};
+
+/* ------------------------------------------------------------------------- */
+
+/* No library code: a fixed amount of integer work that tells how fast the
+ * host runs at the moment (see bench.cpp).
+ */
+static void calibration(unsigned n)
+{
+    uint32_t    x = 1;
+
+    while(n--){
+        for(int i = 0; i < 16; i++){
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+        }
+    }
+    sink = x;
+}
+
+/* Fills and drains a ring the size of the library's, byte by byte. */
+static void ringBuffer(unsigned n)
+{
+    static RingBuffer_t ring;
+    static uint8_t      data[HW_CDC_RX_BUF_SIZE];
+    uint8_t             sum = 0;
+
+    RingBuffer_InitBuffer(&ring, data, sizeof(data));
+    while(n--){
+        for(int i = 0; i < HW_CDC_RX_BUF_SIZE; i++)
+            RingBuffer_Insert(&ring, i);
+        for(int i = 0; i < HW_CDC_RX_BUF_SIZE; i++)
+            sum += RingBuffer_Remove(&ring);
+    }
+    sink = sum;
+}
+
+/* The CRC of a full data packet, as usbSetInterrupt() computes it. */
+static void crc16(unsigned n)
+{
+    unsigned    crc = 0;
+
+    while(n--){
+        packet[0] = n;
+        crc += usbCrc16(packet, sizeof(packet));
+    }
+    sink = crc;
+}
+
+/* Reads a descriptor that is assembled in RAM through usbFunctionRead() in
+ * 8 byte pieces, as the driver does for a control-IN transfer.
+ */
+static void drain(void)
+{
+    uchar   data[8];
+    uchar   sum = 0;
+
+    while(usbFunctionRead(data, sizeof(data)) == sizeof(data))
+        sum += data[0];
+    sink = sum;
+}
+
+static void bosDescriptor(unsigned n)
+{
+    usbRequest_t    rq;
+
+    memset(&rq, 0, sizeof(rq));
+    rq.bmRequestType = USBRQ_DIR_DEVICE_TO_HOST;
+    rq.bRequest = USBRQ_GET_DESCRIPTOR;
+    rq.wValue.bytes[1] = USB_BOS_DESCRIPTOR_TYPE;
+    rq.wLength.word = 255;
+    while(n--){
+        usbFunctionDescriptor(&rq);
+        drain();
+    }
+}
+
+static void msOs20Descriptor(unsigned n)
+{
+    usbRequest_t    rq;
+
+    memset(&rq, 0, sizeof(rq));
+    rq.bmRequestType = USBRQ_DIR_DEVICE_TO_HOST | USBRQ_TYPE_VENDOR;
+    rq.bRequest = WL_REQUEST_WINUSB;
+    rq.wIndex.word = MS_OS_20_REQUEST_DESCRIPTOR;
+    rq.wLength.word = 255;
+    while(n--){
+        usbFunctionSetup((uchar *)&rq);
+        drain();
+    }
+}
+
+/* A bulk OUT packet stored by the driver's callback and read by the sketch
+ * as Echo does. One packet stays below HW_CDC_RX_HIGH_WATER, so the
+ * callback never stops the driver here.
+ */
+static void writeOut(unsigned n)
+{
+    int     sum = 0;
+
+    while(n--){
+        usbFunctionWriteOut(packet, sizeof(packet));
+        for(int i = 0; i < (int)sizeof(packet); i++)
+            sum += SerialUSB.read();
+    }
+    sink = sum;
+}
+
+/* Eight bytes written and sent: write() parks them in txBuf while the port
+ * is closed, refresh() runs usbPollWrapper(), which moves them into the
+ * interrupt buffer. The host takes each packet before the next poll.
+ */
+static void pollTx(unsigned n)
+{
+    while(n--){
+        for(int i = 0; i < (int)sizeof(packet); i++)
+            SerialUSB.write(packet[i]);
+        for(int i = 0; i < 2; i++){
+            usbTxLen1 = USBPID_NAK;
+            SerialUSB.refresh();
+        }
+    }
+    usbTxLen1 = USBPID_NAK;
+}
+
+/* ------------------------------------------------------------------------- */
+
+const BenchKernel benchKernels[] = {
+    {BENCH_CALIBRATION, "16 xorshift steps, no library code", 1, calibration},
+    {"ring_buffer", "RingBuffer_Insert() or RingBuffer_Remove()", 2 * HW_CDC_RX_BUF_SIZE,
+     ringBuffer},
+    {"usb_crc16", "usbCrc16() of 8 bytes", 1, crc16},
+    {"bos_descriptor", "BOS descriptor assembled and read", 1, bosDescriptor},
+    {"ms_os_20_descriptor", "MS OS 2.0 descriptor set assembled and read", 1,
+     msOs20Descriptor},
+    {"write_out", "bulk OUT packet stored and read()", 1, writeOut},
+    {"poll_tx", "8 bytes written and sent by usbPollWrapper()", 1, pollTx},
+};
+
+const int benchKernelCount = sizeof(benchKernels) / sizeof(benchKernels[0]);
+
+void    benchSetup(void)
+{
+    SerialUSB.begin();      /* times out: there is no host */
+    usbDeviceAddr = 1 << 1;
+    usbConfiguration = 1;
+    SerialUSB.refresh();
+}
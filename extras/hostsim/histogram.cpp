@@ -0,0 +1,78 @@
+/* Name: histogram.cpp
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+#include <stdio.h>
+#include "histogram.h"
+
+/* Values 0..3 have a bucket each, from 4 on a value with its highest bit
+ * at position e goes to one of the four buckets of e, chosen by the two
+ * bits below the highest.
+ */
+static int bucketOf(uint64_t v)
+{
+    int     e = 63 - __builtin_clzll(v | 1);
+    int     n;
+
+    if(e < 2)
+        return (int)v;
+    n = 4 * (e - 1) + (int)((v >> (e - 2)) & 3);
+    return n < HISTOGRAM_BUCKETS ? n : HISTOGRAM_BUCKETS - 1;
+}
+
+static uint64_t bucketLimit(int n)
+{
+    int     e = n / 4 + 1;
+
+    if(n < 4)
+        return n;
+    return ((uint64_t)(4 + n % 4 + 1) << (e - 2)) - 1;
+}
+
+void    histogramAdd(Histogram *h, uint64_t ns)
+{
+    if(h->count == 0 || ns < h->min)
+        h->min = ns;
+    if(ns > h->max)
+        h->max = ns;
+    h->count++;
+    h->sum += ns;
+    h->bucket[bucketOf(ns)]++;
+}
+
+uint64_t histogramPercentile(const Histogram *h, double percent)
+{
+    uint64_t    rank = (uint64_t)(h->count * percent / 100 + 0.5), seen = 0;
+    int         n;
+
+    if(h->count == 0)
+        return 0;
+    if(rank < 1)
+        rank = 1;
+    for(n = 0; n < HISTOGRAM_BUCKETS; n++){
+        seen += h->bucket[n];
+        if(seen >= rank)
+            break;
+    }
+    return bucketLimit(n) < h->max ? bucketLimit(n) : h->max;
+}
+
+void    histogramPrintHeader(void)
+{
+    printf("%-20s %10s %10s %10s %10s %10s %10s %10s\n", "latency (us)", "count",
+           "mean", "p50", "p90", "p99", "p99.9", "max");
+}
+
+void    histogramPrint(const char *name, const Histogram *h)
+{
+    printf("%-20s %10llu", name, (unsigned long long)h->count);
+    if(h->count == 0){
+        printf("\n");
+        return;
+    }
+    printf(" %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", h->sum / h->count / 1e3,
+           histogramPercentile(h, 50) / 1e3, histogramPercentile(h, 90) / 1e3,
+           histogramPercentile(h, 99) / 1e3, histogramPercentile(h, 99.9) / 1e3, h->max / 1e3);
+}
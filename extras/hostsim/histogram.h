@@ -0,0 +1,37 @@
+/* Name: histogram.h
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+/*
+General Description:
+Latency histograms with logarithmic buckets: four buckets per power of two,
+so a percentile is known within 19% (the upper bound of its bucket is
+reported). Values are nanoseconds of virtual time.
+*/
+
+#ifndef __histogram_h_included__
+#define __histogram_h_included__
+
+#include <stdint.h>
+
+#define HISTOGRAM_BUCKETS   (4 * 48)    /* up to 2^48 ns, 78 hours */
+
+struct Histogram {
+    uint64_t    count;
+    uint64_t    min, max;
+    double      sum;
+    uint64_t    bucket[HISTOGRAM_BUCKETS];
+};
+
+void        histogramAdd(Histogram *h, uint64_t ns);
+uint64_t    histogramPercentile(const Histogram *h, double percent);
+/* Returns the upper bound of the bucket holding the given percentile, but
+ * never more than the maximum. 0 if the histogram is empty.
+ */
+void        histogramPrintHeader(void);
+void        histogramPrint(const char *name, const Histogram *h);
+/* Prints count, mean, p50, p90, p99, p99.9 and maximum in microseconds. */
+
+#endif /* __histogram_h_included__ */
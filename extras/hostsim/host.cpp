@@ -0,0 +1,1025 @@
+/* Name: host.cpp
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "host.h"
+#include "trace.h"
+#include "usbdrv.h"
+#include "usbisr.h"
+#include "usbwire.h"
+
+#define DEBOUNCE_MS         100     /* connect debounce */
+#define RETRY_MS            100     /* pause before resetting a device that failed */
+#define RESET_MS            50      /* root port reset */
+#define RESET_RECOVERY_MS   10
+#define SET_ADDRESS_MS      10      /* Linux waits this long after SET_ADDRESS */
+#define RESUME_MS           20      /* resume signalling of the host */
+#define WAKEUP_IDLE_MS      5       /* bus idle before the device may signal */
+#define WAKEUP_MIN_MS       1       /* remote wakeup signalling, TDRSMUP */
+#define WAKEUP_MAX_MS       15
+#define WAKEUP_SAMPLE_NS    (100 * SIM_US)
+#define CONTROL_TIMEOUT_MS  5000
+#define CONTROL_ERRORS      3       /* consecutive errors that fail a transaction */
+#define INTR_INTERVAL       128     /* frames, bInterval 255 rounded down to 2^n */
+#define FRAME_BUDGET_NS     (900 * SIM_US)
+#define TIMEOUT_NS          (18 * USB_LS_BIT_NS)
+#define SOF_DELAY_LIMIT     (SIM_MS - FRAME_BUDGET_NS)
+
+enum {PORT_DETACHED, PORT_DEBOUNCE, PORT_RESET, PORT_ENABLED, PORT_SUSPENDED, PORT_RESUME};
+enum {XACT_ACK, XACT_NAK, XACT_STALL, XACT_ERROR};
+enum {STAGE_SETUP, STAGE_DATA, STAGE_STATUS};
+
+HostStats   hostStats;
+HostFaults  hostFaults = {0, 0, 0, 50 * SIM_US, 0, 20 * SIM_MS};
+int         hostVerbose;
+void        (*hostBulkIn)(const uint8_t *data, int len);
+int         (*hostBulkOut)(uint8_t *data);
+void        (*hostBulkOutDone)(int len);
+
+static struct {
+    int         state;
+    simtime_t   since;
+    uint8_t     address;
+    uint8_t     lastAddress;
+    int         open;           /* configured, DTR set */
+    simtime_t   retryAt;        /* reset again at this time if nonzero */
+    simtime_t   enumStart;      /* first reset of the current enumeration */
+    int         remoteWakeup;   /* DEVICE_REMOTE_WAKEUP set by the host */
+    int         wokenUp;        /* the device ended the last suspend */
+    simtime_t   wakeupStart;    /* the device drives K since, 0 if not */
+} port;
+
+static struct {
+    int         active;
+    int         nakked;         /* no more tries in this frame */
+    int         stage;
+    int         errors;
+    uint8_t     setup[8];
+    uint8_t     data[256];
+    int         length;         /* wLength */
+    int         actual;
+    uint8_t     toggle;
+    simtime_t   notBefore;
+    simtime_t   deadline;
+    void        (*done)(int status);
+    void        (*userDone)(int status, const uint8_t *data, int len);
+    uint64_t    urb;
+} ctl;
+
+struct InPipe {
+    uint8_t         endpoint;
+    HostPipeStats   *stats;
+    uint8_t         toggle;
+    int             active;
+    int             nakked;
+    int             paused;
+    unsigned        interval;   /* frames, 0 for bulk */
+    unsigned long   nextFrame;
+    simtime_t       since;      /* first poll waiting for data, 0 if none */
+    uint64_t        urb;        /* pending, 0 if none */
+};
+
+static InPipe       bulkIn = {1, &hostStats.bulkIn};
+static InPipe       intrIn = {USB_CFG_EP3_NUMBER, &hostStats.intrIn};
+
+static struct {
+    int         active;
+    int         nakked;
+    uint8_t     toggle;
+    uint8_t     data[8];
+    int         length;         /* of the pending packet, -1 if none */
+    simtime_t   since;          /* first try of the pending packet */
+    uint64_t    urb;
+} bulkOut = {0, 0, 0, {0}, -1};
+
+static simtime_t    frameStart;
+static simtime_t    stallEnd;   /* poll stall in progress until then */
+static int          busScheduled;
+static int          bulkTurn;   /* bulk endpoint to try first */
+static uint64_t     urbSeq;
+
+/* ------------------------------------------------------------------------- */
+
+char    *hostFormatTime(char *buffer, simtime_t t)
+{
+    unsigned long s = t / SIM_S;
+
+    sprintf(buffer, "%lu:%02lu:%02lu.%06lu", s / 3600, s / 60 % 60, s % 60,
+            (unsigned long)(t % SIM_S / SIM_US));
+    return buffer;
+}
+
+void    hostLog(const char *format, ...)
+{
+    char    buffer[24];
+    va_list args;
+
+    if(!hostVerbose)
+        return;
+    va_start(args, format);
+    printf("[%s] ", hostFormatTime(buffer, simNow));
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+}
+
+uint8_t hostLineState(void)
+{
+    if(port.state == PORT_RESET)
+        return 0;               /* SE0 */
+    if(port.state == PORT_RESUME)
+        return _BV(USBPLUS);    /* K */
+    return _BV(USBMINUS);       /* J */
+}
+
+int     hostConfigured(void)
+{
+    return port.open;
+}
+
+const char *hostStatusName(int status)
+{
+    static const char *names[] = {"ok", "stall", "no response", "timeout"};
+
+    return names[status];
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* usbmon events for the trace, see trace.h */
+static uint64_t urbSubmit(int type, uint8_t endpoint, const uint8_t *setup, int length,
+                          const uint8_t *data, int dataLength)
+{
+    if(traceActive)
+        traceUrb(simNow, 'S', urbSeq + 1, type, endpoint, port.address, setup, URB_PENDING,
+                 length, data, dataLength);
+    return ++urbSeq;
+}
+
+static void urbComplete(simtime_t t, uint64_t id, int type, uint8_t endpoint, int status,
+                        int length, const uint8_t *data, int dataLength)
+{
+    if(traceActive)
+        traceUrb(t, 'C', id, type, endpoint, port.address, NULL, status, length, data,
+                 dataLength);
+}
+
+/* ------------------------------------------------------------------------- */
+/* ------------------------------ Transactions ----------------------------- */
+/* ------------------------------------------------------------------------- */
+
+/* Flips one bit of the packet with the probability that any of its bits
+ * is hit at the configured bit error rate. Returns nonzero if it did.
+ */
+static int bitError(uint8_t *packet, int len)
+{
+    double  p;
+
+    if(hostFaults.bitErrorRate <= 0)
+        return 0;
+    p = 1 - pow(1 - hostFaults.bitErrorRate, usbWirePacketNs(len) / USB_LS_BIT_NS);
+    if(simRandomUniform() >= p)
+        return 0;
+    packet[simRandom() % len] ^= 1 << simRandom() % 8;
+    hostStats.faults.bitErrors++;
+    return 1;
+}
+
+static int ackLost(const uint8_t *packet, int len)
+{
+    if(hostFaults.ackLoss <= 0 || len != 1 || packet[0] != USBPID_ACK ||
+       simRandomUniform() >= hostFaults.ackLoss)
+        return 0;
+    hostStats.faults.acksLost++;
+    return 1;
+}
+
+/* Puts a packet on the bus and adds its time and the time of the answer to
+ * *busy. Returns the length of the device's answer in reply, 0 for none.
+ */
+static int sendPacket(const uint8_t *packet, int len, uint8_t *reply, simtime_t *busy)
+{
+    uint8_t garbled[USB_BUFSIZE];
+    int     n = 0;
+
+    if(hostFaults.bitErrorRate > 0 && len <= (int)sizeof(garbled)){
+        memcpy(garbled, packet, len);
+        if(bitError(garbled, len))
+            packet = garbled;
+    }
+    if(traceActive)
+        tracePacket(simNow + *busy, packet, len);
+    *busy += usbWirePacketNs(len) + USB_LS_GAP_BITS * USB_LS_BIT_NS;
+    if(ackLost(packet, len))
+        return 0;
+    n = usbIsrPacket(packet, len, reply);
+    if(n <= 0)
+        return 0;
+    if(ackLost(reply, n)){
+        *busy += usbWirePacketNs(n) + USB_LS_GAP_BITS * USB_LS_BIT_NS;
+        return 0;
+    }
+    bitError(reply, n);
+    if(traceActive)
+        tracePacket(simNow + *busy, reply, n);
+    *busy += usbWirePacketNs(n) + USB_LS_GAP_BITS * USB_LS_BIT_NS;
+    return n;
+}
+
+static int handshake(const uint8_t *reply, int n, int ackOk, simtime_t *busy)
+{
+    hostStats.transactions++;
+    if(n == 1 && reply[0] == USBPID_ACK && ackOk){
+        hostStats.acks++;
+        return XACT_ACK;
+    }
+    if(n == 1 && reply[0] == USBPID_NAK){
+        hostStats.naks++;
+        return XACT_NAK;
+    }
+    if(n == 1 && reply[0] == USBPID_STALL){
+        hostStats.stalls++;
+        return XACT_STALL;
+    }
+    if(n == 0){
+        hostStats.timeouts++;
+        *busy += TIMEOUT_NS;
+    }else{
+        hostStats.crcErrors++;  /* garbage instead of a handshake */
+    }
+    return XACT_ERROR;
+}
+
+static void countTransaction(HostPipeStats *stats, int r)
+{
+    stats->transactions++;
+    if(r == XACT_NAK){
+        stats->naks++;
+    }else if(r != XACT_ACK && r != XACT_STALL){
+        stats->errors++;
+    }
+}
+
+/* SETUP or OUT transaction with a data packet of len bytes. */
+static int xactOut(uint8_t pid, uint8_t endpoint, uint8_t toggle,
+                   const uint8_t *data, int len, simtime_t *busy)
+{
+    uint8_t packet[USB_BUFSIZE], reply[USB_BUFSIZE];
+    int     n;
+
+    sendPacket(packet, usbWireToken(packet, pid, port.address, endpoint), reply, busy);
+    n = usbWireData(packet, toggle ? USBPID_DATA1 : USBPID_DATA0, data, len);
+    n = sendPacket(packet, n, reply, busy);
+    return handshake(reply, n, 1, busy);
+}
+
+/* IN transaction. The payload goes to data, its length to *len; a data
+ * packet with the wrong toggle is a retransmission, acknowledged and
+ * dropped with *len = -1.
+ */
+static int xactIn(uint8_t endpoint, uint8_t *toggle, uint8_t *data, int *len, simtime_t *busy)
+{
+    uint8_t packet[3], reply[USB_BUFSIZE];
+    int     n;
+
+    *len = 0;
+    n = sendPacket(packet, usbWireToken(packet, USBPID_IN, port.address, endpoint), reply, busy);
+    if(n < 3 || (reply[0] != USBPID_DATA0 && reply[0] != USBPID_DATA1))
+        return handshake(reply, n, 0, busy);
+    hostStats.transactions++;
+    if(!usbWireDataOk(reply, n)){
+        hostStats.crcErrors++;
+        return XACT_ERROR;
+    }
+    packet[0] = USBPID_ACK;
+    sendPacket(packet, 1, packet + 1, busy);
+    hostStats.acks++;
+    if((reply[0] == USBPID_DATA1) != *toggle){
+        hostStats.toggleErrors++;
+        *len = -1;
+        return XACT_ACK;
+    }
+    *toggle ^= 1;
+    *len = n - 3;
+    memcpy(data, reply + 1, n - 3);
+    return XACT_ACK;
+}
+
+/* ------------------------------------------------------------------------- */
+/* --------------------------- Control transfers --------------------------- */
+/* ------------------------------------------------------------------------- */
+
+static void controlDone(int status)
+{
+    static const int    urbStatus[] = {URB_OK, URB_STALL, URB_PROTOCOL, URB_KILLED};
+    int                 in = ctl.setup[0] & USBRQ_DIR_MASK;
+
+    urbComplete(simNow, ctl.urb, URB_CONTROL, in ? 0x80 : 0, urbStatus[status], ctl.actual,
+                in ? ctl.data : NULL, in ? ctl.actual : 0);
+    ctl.active = 0;
+    histogramAdd(&hostStats.control.latency, simNow - ctl.notBefore);
+    if(status == HOST_OK)
+        hostStats.control.bytes += ctl.actual;
+    if(status == HOST_OK && ctl.setup[0] == (USBRQ_TYPE_STANDARD | USBRQ_RCPT_DEVICE) &&
+       (ctl.setup[1] == USBRQ_SET_FEATURE || ctl.setup[1] == USBRQ_CLEAR_FEATURE) &&
+       ctl.setup[2] == 1 && ctl.setup[3] == 0)  /* DEVICE_REMOTE_WAKEUP */
+        port.remoteWakeup = ctl.setup[1] == USBRQ_SET_FEATURE;
+    ctl.done(status);
+}
+
+static void controlSubmit(uint8_t type, uint8_t request, unsigned value, unsigned index,
+                          int length, const uint8_t *data, void (*done)(int), int delayMs)
+{
+    memset(&ctl, 0, sizeof(ctl));
+    ctl.setup[0] = type;
+    ctl.setup[1] = request;
+    ctl.setup[2] = value;
+    ctl.setup[3] = value >> 8;
+    ctl.setup[4] = index;
+    ctl.setup[5] = index >> 8;
+    ctl.setup[6] = length;
+    ctl.setup[7] = length >> 8;
+    ctl.length = length;
+    if(data != NULL)
+        memcpy(ctl.data, data, length);
+    ctl.done = done;
+    ctl.notBefore = simNow + delayMs * SIM_MS;
+    ctl.deadline = ctl.notBefore + CONTROL_TIMEOUT_MS * SIM_MS;
+    ctl.active = 1;
+    if(type & USBRQ_DIR_MASK){
+        ctl.urb = urbSubmit(URB_CONTROL, 0x80, ctl.setup, length, NULL, 0);
+    }else{
+        ctl.urb = urbSubmit(URB_CONTROL, 0, ctl.setup, length, ctl.data, length);
+    }
+}
+
+static simtime_t controlTransaction(void)
+{
+    simtime_t   busy = 0;
+    uint8_t     buffer[8];
+    int         r, len, in = ctl.setup[0] & USBRQ_DIR_MASK;
+    int         statusStage = ctl.stage == STAGE_STATUS;
+
+    switch(ctl.stage){
+    case STAGE_SETUP:
+        r = xactOut(USBPID_SETUP, 0, 0, ctl.setup, 8, &busy);
+        if(r == XACT_ACK){
+            ctl.toggle = 1;
+            ctl.stage = ctl.length ? STAGE_DATA : STAGE_STATUS;
+        }
+        break;
+    case STAGE_DATA:
+        if(in){
+            r = xactIn(0, &ctl.toggle, buffer, &len, &busy);
+            if(r == XACT_ACK && len >= 0){
+                if(len > ctl.length - ctl.actual)
+                    len = ctl.length - ctl.actual;
+                memcpy(ctl.data + ctl.actual, buffer, len);
+                ctl.actual += len;
+                if(len < 8 || ctl.actual == ctl.length)
+                    ctl.stage = STAGE_STATUS;
+            }
+        }else{
+            len = ctl.length - ctl.actual < 8 ? ctl.length - ctl.actual : 8;
+            r = xactOut(USBPID_OUT, 0, ctl.toggle, ctl.data + ctl.actual, len, &busy);
+            if(r == XACT_ACK){
+                ctl.toggle ^= 1;
+                ctl.actual += len;
+                if(ctl.actual == ctl.length)
+                    ctl.stage = STAGE_STATUS;
+            }
+        }
+        break;
+    default:    /* status stage: zero length DATA1 in the other direction */
+        if(in){
+            r = xactOut(USBPID_OUT, 0, 1, NULL, 0, &busy);
+        }else{
+            ctl.toggle = 1;
+            r = xactIn(0, &ctl.toggle, buffer, &len, &busy);
+            if(r == XACT_ACK && len != 0)
+                r = XACT_ERROR;
+        }
+    }
+    countTransaction(&hostStats.control, r);
+    if(r == XACT_ACK && statusStage){
+        controlDone(HOST_OK);
+        return busy;
+    }
+    if(r == XACT_ACK){
+        ctl.errors = 0;
+    }else if(r == XACT_NAK){
+        ctl.nakked = 1;
+    }else if(r == XACT_STALL){
+        controlDone(HOST_STALL);
+        return busy;
+    }else if(++ctl.errors >= CONTROL_ERRORS){
+        controlDone(HOST_ERROR);
+        return busy;
+    }else{
+        ctl.nakked = 1;     /* retry in the next frame */
+    }
+    if(simNow >= ctl.deadline)
+        controlDone(HOST_TIMEOUT);
+    return busy;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static simtime_t inTransaction(InPipe *pipe)
+{
+    simtime_t   busy = 0;
+    uint8_t     buffer[8];
+    int         r, len;
+
+    if(!pipe->since)
+        pipe->since = simNow;
+    if(!pipe->urb)
+        pipe->urb = urbSubmit(pipe->interval ? URB_INTERRUPT : URB_BULK,
+                              0x80 | pipe->endpoint, NULL, 8, NULL, 0);
+    r = xactIn(pipe->endpoint, &pipe->toggle, buffer, &len, &busy);
+    countTransaction(pipe->stats, r);
+    if(r == XACT_ACK && len >= 0){  /* including zero length packets */
+        urbComplete(simNow + busy, pipe->urb, pipe->interval ? URB_INTERRUPT : URB_BULK,
+                    0x80 | pipe->endpoint, URB_OK, len, buffer, len);
+        pipe->urb = 0;
+    }
+    if(r == XACT_ACK && len > 0){
+        pipe->stats->bytes += len;
+        histogramAdd(&pipe->stats->latency, simNow + busy - pipe->since);
+        pipe->since = 0;
+        if(!pipe->interval && hostBulkIn != NULL)
+            hostBulkIn(buffer, len);
+    }
+    if(pipe->interval){
+        pipe->nextFrame = hostStats.frames + pipe->interval;
+    }else if(r != XACT_ACK){
+        pipe->nakked = 1;
+    }
+    return busy;
+}
+
+/* Returns 0 without using the bus if there is nothing to send. */
+static simtime_t outTransaction(void)
+{
+    simtime_t   busy = 0;
+    int         r;
+
+    if(bulkOut.length < 0){
+        if(hostBulkOut == NULL || (bulkOut.length = hostBulkOut(bulkOut.data)) <= 0){
+            bulkOut.length = -1;
+            return 0;
+        }
+        bulkOut.since = simNow;
+        bulkOut.urb = urbSubmit(URB_BULK, 1, NULL, bulkOut.length, bulkOut.data, bulkOut.length);
+    }
+    r = xactOut(USBPID_OUT, 1, bulkOut.toggle, bulkOut.data, bulkOut.length, &busy);
+    countTransaction(&hostStats.bulkOut, r);
+    if(r == XACT_ACK){
+        bulkOut.toggle ^= 1;
+        hostStats.bulkOut.bytes += bulkOut.length;
+        histogramAdd(&hostStats.bulkOut.latency, simNow + busy - bulkOut.since);
+        urbComplete(simNow + busy, bulkOut.urb, URB_BULK, 1, URB_OK, bulkOut.length, NULL, 0);
+        if(hostBulkOutDone != NULL)
+            hostBulkOutDone(bulkOut.length);
+        bulkOut.length = -1;
+    }else{
+        bulkOut.nakked = 1;     /* STALL is not expected: retried like NAK */
+    }
+    return busy;
+}
+
+/* ------------------------------------------------------------------------- */
+/* ------------------------------ Enumeration ------------------------------ */
+/* ------------------------------------------------------------------------- */
+
+#define GET_DESCRIPTOR(type, index, length, delayMs) \
+    controlSubmit(USBRQ_DIR_DEVICE_TO_HOST, USBRQ_GET_DESCRIPTOR, \
+                  ((type) << 8) | (index), 0, length, NULL, enumNext, delayMs)
+
+static void enumNext(int status);
+
+static int      enumStep;
+static uint8_t  deviceDescriptor[18];
+
+static int submitDevice64(void)
+{
+    /* Linux asks for 64 bytes first; the device stops at 18 */
+    GET_DESCRIPTOR(USBDESCR_DEVICE, 0, 64, RESET_RECOVERY_MS);
+    return 1;
+}
+
+static int checkDevice(void)
+{
+    if(ctl.actual < 8 || ctl.data[0] != 18 || ctl.data[1] != USBDESCR_DEVICE)
+        return 0;
+    memcpy(deviceDescriptor, ctl.data, ctl.actual);
+    return 1;
+}
+
+static int submitSetAddress(void)
+{
+    port.lastAddress = port.lastAddress % 127 + 1;
+    controlSubmit(USBRQ_DIR_HOST_TO_DEVICE, USBRQ_SET_ADDRESS, port.lastAddress, 0,
+                  0, NULL, enumNext, 0);
+    return 1;
+}
+
+static int checkSetAddress(void)
+{
+    port.address = port.lastAddress;
+    return 1;
+}
+
+static int submitDevice(void)
+{
+    GET_DESCRIPTOR(USBDESCR_DEVICE, 0, 18, SET_ADDRESS_MS);
+    return 1;
+}
+
+static int checkDevice18(void)
+{
+    return ctl.actual == 18 && checkDevice();
+}
+
+static int submitConfig9(void)
+{
+    GET_DESCRIPTOR(USBDESCR_CONFIG, 0, 9, 0);
+    return 1;
+}
+
+static int checkConfig(void)
+{
+    return ctl.actual == 9 && ctl.data[1] == USBDESCR_CONFIG;
+}
+
+static int submitConfig(void)
+{
+    GET_DESCRIPTOR(USBDESCR_CONFIG, 0, ctl.data[2] | ctl.data[3] << 8, 0);
+    return 1;
+}
+
+static int checkConfigTotal(void)
+{
+    return ctl.actual == ctl.length && ctl.data[1] == USBDESCR_CONFIG;
+}
+
+/* The BOS descriptor exists from bcdUSB 2.01 on. */
+static int submitBos5(void)
+{
+    if((deviceDescriptor[3] << 8 | deviceDescriptor[2]) < 0x201)
+        return 0;
+    GET_DESCRIPTOR(15, 0, 5, 0);
+    return 1;
+}
+
+static int checkBos(void)
+{
+    return ctl.actual >= 5 && ctl.data[1] == 15;
+}
+
+static int submitBos(void)
+{
+    if((deviceDescriptor[3] << 8 | deviceDescriptor[2]) < 0x201)
+        return 0;
+    GET_DESCRIPTOR(15, 0, ctl.data[2] | ctl.data[3] << 8, 0);
+    return 1;
+}
+
+static int submitString(int index)
+{
+    if(index == 0)
+        return 0;
+    GET_DESCRIPTOR(USBDESCR_STRING, index, 255, 0);
+    return 1;
+}
+
+static int submitLanguages(void)
+{
+    GET_DESCRIPTOR(USBDESCR_STRING, 0, 255, 0);
+    return 1;
+}
+
+static int submitProduct(void)
+{
+    return submitString(deviceDescriptor[15]);
+}
+
+static int submitManufacturer(void)
+{
+    return submitString(deviceDescriptor[14]);
+}
+
+static int submitSerial(void)
+{
+    return submitString(deviceDescriptor[16]);
+}
+
+static int checkString(void)
+{
+    return ctl.actual >= 2 && ctl.data[0] == ctl.actual && ctl.data[1] == USBDESCR_STRING;
+}
+
+static int submitSetConfiguration(void)
+{
+    controlSubmit(USBRQ_DIR_HOST_TO_DEVICE, USBRQ_SET_CONFIGURATION, 1, 0, 0, NULL, enumNext, 0);
+    return 1;
+}
+
+static int checkOk(void)
+{
+    return 1;
+}
+
+/* cdc-acm opening the tty: 115200 8N1, then DTR and RTS */
+static int submitLineCoding(void)
+{
+    static const uint8_t lineCoding[7] = {0x00, 0xc2, 0x01, 0x00, 0, 0, 8};
+
+    controlSubmit(USBRQ_DIR_HOST_TO_DEVICE | USBRQ_TYPE_CLASS | USBRQ_RCPT_INTERFACE,
+                  0x20, 0, 0, sizeof(lineCoding), lineCoding, enumNext, 0);
+    return 1;
+}
+
+static int submitLineState(void)
+{
+    controlSubmit(USBRQ_DIR_HOST_TO_DEVICE | USBRQ_TYPE_CLASS | USBRQ_RCPT_INTERFACE,
+                  0x22, 3, 0, 0, NULL, enumNext, 0);
+    return 1;
+}
+
+static const struct {
+    const char  *name;
+    int         optional;
+    int         (*submit)(void);    /* returns 0 to skip the step */
+    int         (*check)(void);
+} enumSteps[] = {
+    {"GET_DESCRIPTOR(device, 64)", 0, submitDevice64, checkDevice},
+    {"SET_ADDRESS", 0, submitSetAddress, checkSetAddress},
+    {"GET_DESCRIPTOR(device)", 0, submitDevice, checkDevice18},
+    {"GET_DESCRIPTOR(config, 9)", 0, submitConfig9, checkConfig},
+    {"GET_DESCRIPTOR(config)", 0, submitConfig, checkConfigTotal},
+    {"GET_DESCRIPTOR(BOS, 5)", 1, submitBos5, checkBos},
+    {"GET_DESCRIPTOR(BOS)", 1, submitBos, checkBos},
+    {"GET_DESCRIPTOR(languages)", 1, submitLanguages, checkString},
+    {"GET_DESCRIPTOR(product)", 1, submitProduct, checkString},
+    {"GET_DESCRIPTOR(manufacturer)", 1, submitManufacturer, checkString},
+    {"GET_DESCRIPTOR(serial)", 1, submitSerial, checkString},
+    {"SET_CONFIGURATION", 0, submitSetConfiguration, checkOk},
+    {"SET_LINE_CODING", 1, submitLineCoding, checkOk},
+    {"SET_CONTROL_LINE_STATE", 0, submitLineState, checkOk},
+};
+
+#define ENUM_STEPS  (int)(sizeof(enumSteps) / sizeof(enumSteps[0]))
+
+static void enumFailed(void)
+{
+    hostStats.enumFailures++;
+    port.retryAt = simNow + RETRY_MS * SIM_MS;  /* keep-alives go on until then */
+}
+
+static void enumSubmit(void)
+{
+    char    buffer[24];
+
+    for(; enumStep < ENUM_STEPS; enumStep++){
+        if(enumSteps[enumStep].submit())
+            return;
+        if(!enumSteps[enumStep].optional){  /* e.g. a BOS step whose header failed */
+            enumFailed();
+            return;
+        }
+    }
+    port.open = 1;
+    bulkIn.active = intrIn.active = bulkOut.active = 1;
+    bulkIn.toggle = intrIn.toggle = bulkOut.toggle = 0; /* reset by SET_CONFIGURATION */
+    bulkIn.since = intrIn.since = 0;
+    bulkOut.since = simNow;
+    intrIn.interval = INTR_INTERVAL;
+    intrIn.nextFrame = hostStats.frames;
+    hostStats.enumerations++;
+    histogramAdd(&hostStats.enumeration, simNow - port.enumStart);
+    port.enumStart = 0;
+    if(!hostStats.firstConfigured)
+        hostStats.firstConfigured = simNow;
+    hostLog("configured, port open (%s since power up)", hostFormatTime(buffer, simNow));
+}
+
+static void enumNext(int status)
+{
+    int     ok = status == HOST_OK && enumSteps[enumStep].check();
+
+    if(!ok){
+        hostLog("%s: %s", enumSteps[enumStep].name,
+                status == HOST_OK ? "bad reply" : hostStatusName(status));
+        if(!enumSteps[enumStep].optional){
+            enumFailed();
+            return;
+        }
+        if(enumSteps[enumStep].submit == submitBos5)
+            enumStep++;     /* no header, no BOS */
+    }
+    enumStep++;
+    enumSubmit();
+}
+
+/* ------------------------------------------------------------------------- */
+/* ------------------------------- Root port ------------------------------- */
+/* ------------------------------------------------------------------------- */
+
+/* The device drives K: D+ high and D- low, both pins outputs. */
+static int deviceDrivesK(void)
+{
+    return (DDRB & USBMASK) == USBMASK && (PORTB & USBMASK) == _BV(USBPLUS);
+}
+
+/* The device pulls D- up; usbDeviceDisconnect() drives it low. With D+
+ * driven high as well that is resume signalling, not a disconnect.
+ */
+static int deviceAttached(void)
+{
+    return !(DDRB & _BV(USBMINUS)) || (PORTB & _BV(USBMINUS)) || deviceDrivesK();
+}
+
+static void killInUrb(InPipe *pipe)
+{
+    if(pipe->urb)
+        urbComplete(simNow, pipe->urb, pipe->interval ? URB_INTERRUPT : URB_BULK,
+                    0x80 | pipe->endpoint, URB_KILLED, 0, NULL, 0);
+    pipe->urb = 0;
+}
+
+/* Cancels what is in progress. A pending bulk OUT packet stays, it is sent
+ * again after the next enumeration.
+ */
+static void portIdle(void)
+{
+    if(ctl.active)
+        urbComplete(simNow, ctl.urb, URB_CONTROL, ctl.setup[0] & USBRQ_DIR_MASK, URB_KILLED,
+                    0, NULL, 0);
+    killInUrb(&bulkIn);
+    killInUrb(&intrIn);
+    ctl.active = 0;
+    bulkIn.active = intrIn.active = bulkOut.active = 0;
+    port.open = 0;
+    port.address = 0;
+    port.retryAt = 0;
+    port.remoteWakeup = 0;
+}
+
+static void startReset(void)
+{
+    hostLog("reset");
+    hostStats.resets++;
+    portIdle();
+    if(!port.enumStart)
+        port.enumStart = simNow;
+    port.state = PORT_RESET;
+    port.since = simNow;
+    simBusEdges++;
+}
+
+static void startResume(void)
+{
+    hostLog("resume");
+    port.state = PORT_RESUME;
+    port.since = simNow;
+    simBusEdges++;
+}
+
+/* The resume ends with a low-speed EOP; the keep-alives start again with
+ * the next frame.
+ */
+static void endResume(void)
+{
+    hostStats.resumes++;
+    port.state = PORT_ENABLED;
+    simBusEdges++;
+}
+
+static void wakeupError(const char *what, simtime_t t)
+{
+    char    buffer[24];
+
+    hostStats.wakeupErrors++;
+    hostLog("remote wakeup %s (%s)", what, hostFormatTime(buffer, t));
+}
+
+/* Samples the lines while the bus is suspended. Resume signalling from the
+ * device makes the host answer with its own; it is timed until the device
+ * lets go of the lines.
+ */
+static void watchWakeup(void *arg)
+{
+    int     k = deviceDrivesK();
+
+    if(port.state == PORT_SUSPENDED && k){
+        hostLog("remote wakeup");
+        hostStats.remoteWakeups++;
+        if(!port.remoteWakeup)
+            wakeupError("not enabled", simNow - port.since);
+        if(simNow - frameStart < WAKEUP_IDLE_MS * SIM_MS)
+            wakeupError("too early after the last keep-alive", simNow - frameStart);
+        port.wakeupStart = simNow;
+        port.wokenUp = 1;
+        startResume();
+    }else if(port.wakeupStart && !k){
+        simtime_t   t = simNow - port.wakeupStart;
+
+        histogramAdd(&hostStats.wakeupSignal, t);
+        if(t < WAKEUP_MIN_MS * SIM_MS || t > WAKEUP_MAX_MS * SIM_MS)
+            wakeupError("K state not 1 to 15 ms", t);
+        port.wakeupStart = 0;
+    }
+    if(port.state == PORT_SUSPENDED || port.wakeupStart)
+        simSchedule(simNow + WAKEUP_SAMPLE_NS, watchWakeup, NULL);
+}
+
+static void updatePort(void)
+{
+    int     attached = deviceAttached();
+
+    switch(port.state){
+    case PORT_DETACHED:
+        if(attached){
+            hostLog("connect");
+            hostStats.connects++;
+            port.state = PORT_DEBOUNCE;
+            port.since = simNow;
+        }
+        break;
+    case PORT_DEBOUNCE:
+        if(!attached){
+            port.state = PORT_DETACHED;
+        }else if(simNow - port.since >= DEBOUNCE_MS * SIM_MS){
+            startReset();
+        }
+        break;
+    case PORT_RESET:
+        if(simNow - port.since >= RESET_MS * SIM_MS){
+            port.state = PORT_ENABLED;
+            simBusEdges++;
+            enumStep = 0;
+            enumSubmit();
+        }
+        break;
+    case PORT_ENABLED:
+    case PORT_SUSPENDED:
+    case PORT_RESUME:
+        if(!attached){
+            hostLog("disconnect");
+            hostStats.disconnects++;
+            portIdle();
+            port.enumStart = 0;
+            port.state = PORT_DETACHED;
+        }else if(port.state == PORT_RESUME && simNow - port.since >= RESUME_MS * SIM_MS){
+            endResume();
+        }else if(port.state == PORT_ENABLED && port.retryAt && simNow >= port.retryAt){
+            startReset();
+        }
+        break;
+    }
+}
+
+static simtime_t bulkTransaction(int out)
+{
+    if(out)
+        return bulkOut.active && !bulkOut.nakked ? outTransaction() : 0;
+    return bulkIn.active && !bulkIn.nakked && !bulkIn.paused ? inTransaction(&bulkIn) : 0;
+}
+
+/* Runs the next transaction of the frame: control first, then the interrupt
+ * endpoint when due, then the bulk endpoints in turns.
+ */
+static void busService(void *arg)
+{
+    simtime_t   busy = 0;
+
+    busScheduled = 0;
+    if(port.state != PORT_ENABLED)
+        return;
+    if(ctl.active && !ctl.nakked && simNow >= ctl.notBefore){
+        busy = controlTransaction();
+    }else if(intrIn.active && hostStats.frames >= intrIn.nextFrame){
+        busy = inTransaction(&intrIn);
+    }else{
+        bulkTurn ^= 1;
+        if((busy = bulkTransaction(bulkTurn)) == 0)
+            busy = bulkTransaction(!bulkTurn);
+    }
+    if(busy && simNow + busy < frameStart + FRAME_BUDGET_NS){
+        busScheduled = 1;
+        simSchedule(simNow + busy, busService, NULL);
+    }
+}
+
+/* Sends the keep-alive and starts the transactions of the frame. */
+static void startFrame(void *arg)
+{
+    if(port.state != PORT_ENABLED)  /* reset while the keep-alive was late */
+        return;
+    frameStart = simNow;
+    usbIsrKeepAlive();
+    ctl.nakked = bulkIn.nakked = bulkOut.nakked = 0;
+    if(simNow < stallEnd)
+        return;
+    if(hostFaults.pollStallRate > 0 && simRandomUniform() < hostFaults.pollStallRate){
+        hostStats.faults.pollStalls++;
+        stallEnd = simNow + hostFaults.pollStallTime;
+        return;
+    }
+    if(!busScheduled && (ctl.active || bulkIn.active)){
+        busScheduled = 1;
+        simSchedule(simNow + USB_LS_KEEPALIVE_NS + USB_LS_GAP_BITS * USB_LS_BIT_NS,
+                    busService, NULL);
+    }
+}
+
+static void frame(void *arg)
+{
+    simtime_t   delay;
+
+    simSchedule(simNow + SIM_MS, frame, NULL);
+    updatePort();
+    if(port.state != PORT_ENABLED)
+        return;
+    hostStats.frames++;
+    if(hostFaults.sofDelayRate > 0 && simRandomUniform() < hostFaults.sofDelayRate){
+        delay = hostFaults.sofDelayMax < SOF_DELAY_LIMIT ? hostFaults.sofDelayMax : SOF_DELAY_LIMIT;
+        delay = (simtime_t)(simRandomUniform() * delay);
+        hostStats.faults.sofsDelayed++;
+        simSchedule(simNow + delay, startFrame, NULL);
+        return;
+    }
+    startFrame(NULL);
+}
+
+void    hostInit(void)
+{
+    simSchedule(SIM_MS, frame, NULL);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void userControlDone(int status)
+{
+    ctl.userDone(status, ctl.data, ctl.actual);
+}
+
+int     hostControl(uint8_t type, uint8_t request, unsigned value, unsigned index,
+                    int length, const uint8_t *data,
+                    void (*done)(int status, const uint8_t *data, int len))
+{
+    if(!port.open || port.state != PORT_ENABLED || ctl.active)
+        return 0;
+    controlSubmit(type, request, value, index, length, data, userControlDone, 0);
+    ctl.userDone = done;
+    return 1;
+}
+
+void    hostPollBulkIn(int enable)
+{
+    bulkIn.paused = !enable;
+    bulkIn.since = 0;   /* a pause is not latency */
+}
+
+void    hostReset(void)
+{
+    if(port.state == PORT_ENABLED || port.state == PORT_SUSPENDED)
+        startReset();
+}
+
+/* Pending bulk transfers stay and go on after the resume. */
+int     hostSuspend(void)
+{
+    if(!port.open || port.state != PORT_ENABLED || ctl.active)
+        return 0;
+    hostLog("suspend");
+    hostStats.suspends++;
+    port.state = PORT_SUSPENDED;
+    port.since = simNow;
+    port.wokenUp = 0;
+    simSchedule(simNow + WAKEUP_SAMPLE_NS, watchWakeup, NULL);
+    return 1;
+}
+
+void    hostResume(void)
+{
+    if(port.state == PORT_SUSPENDED)
+        startResume();
+}
+
+int     hostSuspended(void)
+{
+    return port.state == PORT_SUSPENDED || port.state == PORT_RESUME;
+}
+
+int     hostWokenUp(void)
+{
+    return port.wokenUp;
+}
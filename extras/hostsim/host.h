@@ -0,0 +1,143 @@
+/* Name: host.h
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+/*
+General Description:
+Model of a USB host with the device on a root port. The host sends a
+keep-alive every millisecond while the port is enabled and schedules the
+transactions of each frame after it, one event per transaction. It debounces
+the connect, resets the port, enumerates the device as Linux does for a CDC
+ACM device with a bcdUSB 2.1 device descriptor, opens the port (DTR) and
+then polls bulk IN endpoint 1 once per frame and interrupt endpoint 3 at its
+interval. Bulk OUT endpoint 1 sends what the hostBulkOut callback supplies.
+Failed enumerations are retried with a new reset; a disconnect is noticed at
+the next frame.
+
+hostSuspend() stops the keep-alives until hostResume(), which drives the
+resume (K state) for 20 ms; a reset or a disconnect also ends the suspend.
+While suspended the host samples the lines every 100 us. When the device
+drives K (remote wakeup) the host resumes the bus as if hostResume() had
+been called, and times the device's K state. Remote wakeup counts as an
+error unless the host enabled it with SET_FEATURE(DEVICE_REMOTE_WAKEUP)
+since the last reset, the bus was idle for 5 ms first and the K state
+lasted 1 to 15 ms.
+
+Within a frame the bulk endpoints take turns; an endpoint that NAKs or
+fails is not tried again before the next frame.
+
+Faults of a poor link can be injected at given rates (see HostFaults):
+flipped bits in packets of either direction, lost ACK handshakes, late
+keep-alives and stretches of frames in which the host polls nothing.
+*/
+
+#ifndef __host_h_included__
+#define __host_h_included__
+
+#include <stdint.h>
+#include "sim.h"
+#ifdef __cplusplus
+#include "histogram.h"
+#endif
+
+uint8_t hostLineState(void);
+/* Returns the USB lines as the device reads them from PINB when it does not
+ * drive them: J (D- high), SE0 during a reset or K (D+ high) while the host
+ * signals resume.
+ */
+
+#ifdef __cplusplus
+
+enum {HOST_OK, HOST_STALL, HOST_ERROR, HOST_TIMEOUT};  /* control transfer status */
+
+struct HostPipeStats {
+    unsigned long   transactions, naks, errors;
+    uint64_t        bytes;          /* payload delivered */
+    Histogram       latency;        /* see below */
+};
+/* Latency is measured per data packet for the bulk endpoints: from the first
+ * try until the device took it (OUT) or from the first poll until data came
+ * (IN). For control transfers it is the whole transfer.
+ */
+
+struct HostFaults {
+    double      bitErrorRate;   /* per bit on the wire, both directions */
+    double      ackLoss;        /* fraction of ACK handshakes lost */
+    double      sofDelayRate;   /* fraction of keep-alives sent late */
+    simtime_t   sofDelayMax;    /* uniformly up to this, at most 100 us */
+    double      pollStallRate;  /* per frame: chance a poll stall starts */
+    simtime_t   pollStallTime;  /* no transactions for this long */
+};
+
+struct HostFaultStats {
+    unsigned long   bitErrors, acksLost, sofsDelayed, pollStalls;
+};
+
+struct HostStats {
+    unsigned long   frames;         /* keep-alives sent */
+    unsigned long   connects, disconnects, resets;
+    unsigned long   suspends, resumes;
+    unsigned long   remoteWakeups, wakeupErrors;
+    unsigned long   enumerations, enumFailures;
+    unsigned long   transactions, acks, naks, stalls, timeouts;
+    unsigned long   crcErrors, toggleErrors;
+    HostPipeStats   control, bulkIn, bulkOut, intrIn;
+    Histogram       enumeration;    /* first reset to configured */
+    Histogram       wakeupSignal;   /* K state driven by the device */
+    HostFaultStats  faults;         /* injected */
+    simtime_t       firstConfigured;    /* 0 if never */
+};
+
+extern HostStats    hostStats;
+extern HostFaults   hostFaults;
+extern int          hostVerbose;
+extern void         (*hostBulkIn)(const uint8_t *data, int len);
+/* Called with the payload of each bulk IN data packet received. */
+extern int          (*hostBulkOut)(uint8_t *data);
+/* Called when the bulk OUT endpoint is free: stores the next packet, up to
+ * 8 bytes, in data and returns its length or 0 if there is nothing to send.
+ * A packet that was not acknowledged before a reset is sent after the next
+ * enumeration.
+ */
+extern void         (*hostBulkOutDone)(int len);
+/* Called when the device acknowledged a bulk OUT packet, if set. */
+
+void    hostInit(void);
+/* Schedules the first frame. Call after simInit(). */
+int     hostConfigured(void);
+/* Nonzero while the device is configured and the port is open. */
+int     hostControl(uint8_t type, uint8_t request, unsigned value, unsigned index,
+                    int length, const uint8_t *data,
+                    void (*done)(int status, const uint8_t *data, int len));
+/* Starts a control transfer with up to 256 bytes in the data stage; data is
+ * sent for host to device transfers. done is called with one of the HOST_*
+ * values and what the device returned. Returns 0 if the port is not open or
+ * another control transfer is in progress.
+ */
+void    hostPollBulkIn(int enable);
+/* Stops or resumes polling of bulk IN endpoint 1 (on by default). */
+void    hostReset(void);
+/* Resets the port and enumerates the device again. */
+int     hostSuspend(void);
+/* Suspends the bus: no keep-alives, so the device sees it idle. Returns 0
+ * if the port is not open or a control transfer is in progress.
+ */
+void    hostResume(void);
+/* Signals resume and sends keep-alives again after it. */
+int     hostSuspended(void);
+/* Nonzero from hostSuspend() until the resume signalling ends. */
+int     hostWokenUp(void);
+/* Nonzero if the device signalled remote wakeup since the last
+ * hostSuspend().
+ */
+const char *hostStatusName(int status);
+void    hostLog(const char *format, ...);
+/* Prints a line with the virtual time if hostVerbose is set. */
+char    *hostFormatTime(char *buffer, simtime_t t);
+/* Formats t as h:mm:ss.uuuuuu into buffer[24]. */
+
+#endif /* __cplusplus */
+
+#endif /* __host_h_included__ */
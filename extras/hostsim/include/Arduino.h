@@ -0,0 +1,48 @@
+/* The part of the Arduino core used by the library and the examples, for
+ * the host build. Implemented in avrcore.cpp on top of the simulator's
+ * device clock; millis() and micros() count timer 0 overflows as the core's
+ * wiring.c does.
+ */
+#ifndef __HOSTSIM_ARDUINO_H__
+#define __HOSTSIM_ARDUINO_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#define HIGH    1
+#define LOW     0
+#define INPUT           0
+#define OUTPUT          1
+#define INPUT_PULLUP    2
+#define LED_BUILTIN     1
+
+#define clockCyclesPerMicrosecond() (F_CPU / 1000000L)
+
+typedef uint8_t byte;
+typedef bool    boolean;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+uint32_t        millis(void);
+uint32_t        micros(void);
+void            delay(uint32_t ms);
+void            delayMicroseconds(unsigned int us);
+void            pinMode(uint8_t pin, uint8_t mode);
+void            digitalWrite(uint8_t pin, uint8_t value);
+int             digitalRead(uint8_t pin);
+
+void            setup(void);
+void            loop(void);
+#ifdef __cplusplus
+}
+
+#include "WString.h"
+#include "Stream.h"
+#endif
+
+#endif /* __HOSTSIM_ARDUINO_H__ */
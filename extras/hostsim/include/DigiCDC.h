@@ -0,0 +1,19 @@
+/* The examples Print, Echo and CDC_LED were written for the DigiCDC library
+ * and use its SerialUSB object. For the host build SerialUSB is a
+ * DigiWebUSBDevice with the landing page of the IdleSleep example. This
+ * header defines the object: include it from one unit only, the sketch
+ * or benchkernels.cpp.
+ */
+#ifndef __HOSTSIM_DIGICDC_H__
+#define __HOSTSIM_DIGICDC_H__
+
+#include <DigiWebUSB.h>
+
+static const WebUSBURL digiCdcUrls[] = {
+    {1, "digistump.com"},   /* scheme 1 = https:// */
+};
+static const uint8_t digiCdcAllowedOrigins[] = {1};
+
+DigiWebUSBDevice SerialUSB(digiCdcUrls, 1, 1, digiCdcAllowedOrigins, 1);
+
+#endif /* __HOSTSIM_DIGICDC_H__ */
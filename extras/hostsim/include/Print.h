@@ -0,0 +1,45 @@
+/* Print of the Arduino core for the host build. */
+#ifndef __HOSTSIM_PRINT_H__
+#define __HOSTSIM_PRINT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class Print {
+public:
+    virtual size_t write(uint8_t) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *str);
+
+    size_t print(const __FlashStringHelper *);
+    size_t print(const char[]);
+    size_t print(char);
+    size_t print(unsigned char, int = DEC);
+    size_t print(int, int = DEC);
+    size_t print(unsigned int, int = DEC);
+    size_t print(long, int = DEC);
+    size_t print(unsigned long, int = DEC);
+
+    size_t println(const __FlashStringHelper *);
+    size_t println(const char[]);
+    size_t println(char);
+    size_t println(unsigned char, int = DEC);
+    size_t println(int, int = DEC);
+    size_t println(unsigned int, int = DEC);
+    size_t println(long, int = DEC);
+    size_t println(unsigned long, int = DEC);
+    size_t println(void);
+
+    virtual ~Print() {}
+
+private:
+    size_t printNumber(unsigned long, uint8_t);
+};
+
+#endif /* __HOSTSIM_PRINT_H__ */
@@ -0,0 +1,17 @@
+/* Stream of the Arduino core for the host build, without the timed parsing
+ * functions.
+ */
+#ifndef __HOSTSIM_STREAM_H__
+#define __HOSTSIM_STREAM_H__
+
+#include "Print.h"
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() = 0;
+};
+
+#endif /* __HOSTSIM_STREAM_H__ */
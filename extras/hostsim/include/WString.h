@@ -0,0 +1,10 @@
+/* F() strings; program memory is ordinary memory on the host. */
+#ifndef __HOSTSIM_WSTRING_H__
+#define __HOSTSIM_WSTRING_H__
+
+#include <avr/pgmspace.h>
+
+class __FlashStringHelper;
+#define F(string_literal)   (reinterpret_cast<const __FlashStringHelper *>(PSTR(string_literal)))
+
+#endif /* __HOSTSIM_WSTRING_H__ */
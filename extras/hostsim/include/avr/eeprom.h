@@ -0,0 +1,22 @@
+/* EEPROM of the host build: E2END + 1 bytes, erased (0xff) at start. */
+#ifndef __HOSTSIM_AVR_EEPROM_H__
+#define __HOSTSIM_AVR_EEPROM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <avr/io.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+uint8_t eeprom_read_byte(const uint8_t *addr);
+void    eeprom_write_byte(uint8_t *addr, uint8_t value);
+void    eeprom_update_byte(uint8_t *addr, uint8_t value);
+void    eeprom_read_block(void *dst, const void *src, size_t n);
+void    eeprom_write_block(const void *src, void *dst, size_t n);
+void    eeprom_update_block(const void *src, void *dst, size_t n);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HOSTSIM_AVR_EEPROM_H__ */
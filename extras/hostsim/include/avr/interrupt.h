@@ -0,0 +1,12 @@
+/* Global interrupt flag for the host build. The only interrupt is the USB
+ * interrupt model of the simulator, which checks the I bit in SREG.
+ */
+#ifndef __HOSTSIM_AVR_INTERRUPT_H__
+#define __HOSTSIM_AVR_INTERRUPT_H__
+
+#include <avr/io.h>
+
+#define sei()   (SREG |= 0x80)
+#define cli()   (SREG &= ~0x80)
+
+#endif /* __HOSTSIM_AVR_INTERRUPT_H__ */
@@ -0,0 +1,60 @@
+/* ATtiny85 registers for compiling the library on the host. The I/O space is
+ * an array indexed by the register's I/O address. PINB and TCNT0 are not
+ * stored: the simulator computes them from the bus and the device clock on
+ * every read, so they cannot be written.
+ */
+#ifndef __HOSTSIM_AVR_IO_H__
+#define __HOSTSIM_AVR_IO_H__
+
+#include <stdint.h>
+#include "sim.h"
+
+#define _SFR_IO8(addr)  (simIo[addr])
+
+#define PCMSK   _SFR_IO8(0x15)
+#define PINB    (simReadPinB())
+#define DDRB    _SFR_IO8(0x17)
+#define PORTB   _SFR_IO8(0x18)
+#define EECR    _SFR_IO8(0x1C)
+#define CLKPR   _SFR_IO8(0x26)
+#define PLLCSR  _SFR_IO8(0x27)
+#define TCCR0A  _SFR_IO8(0x2A)
+#define TCCR1   _SFR_IO8(0x30)
+#define OSCCAL  _SFR_IO8(0x31)
+#define TCNT0   (simReadTcnt0())
+#define TCCR0B  _SFR_IO8(0x33)
+#define MCUSR   _SFR_IO8(0x34)
+#define MCUCR   _SFR_IO8(0x35)
+#define TIFR    _SFR_IO8(0x38)
+#define TIMSK   _SFR_IO8(0x39)
+#define GIFR    _SFR_IO8(0x3A)
+#define GIMSK   _SFR_IO8(0x3B)
+#define SREG    _SFR_IO8(0x3F)
+
+#define PB0     0
+#define PB1     1
+#define PB2     2
+#define PB3     3
+#define PB4     4
+#define PB5     5
+
+#define PCIF    5
+#define PCIE    5
+#define INTF0   6
+#define INT0    6
+#define TOIE0   1
+#define TOV0    1
+#define SE      5
+#define SM0     3
+#define SM1     4
+
+#define RAMSTART    0x60
+#define RAMEND      0x25F
+#define E2END       0x1FF
+#define FLASHEND    0x1FFF
+
+#ifndef _BV
+#define _BV(bit)    (1 << (bit))
+#endif
+
+#endif /* __HOSTSIM_AVR_IO_H__ */
@@ -0,0 +1,17 @@
+/* Program memory is ordinary memory on the host. */
+#ifndef __HOSTSIM_AVR_PGMSPACE_H__
+#define __HOSTSIM_AVR_PGMSPACE_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P               const char *
+#define PSTR(s)             (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define memcpy_P            memcpy
+#define strlen_P            strlen
+#define strcmp_P            strcmp
+
+#endif /* __HOSTSIM_AVR_PGMSPACE_H__ */
@@ -0,0 +1,19 @@
+/* Sleep modes of the host build. sleep_cpu() waits for the next event or
+ * timer 0 overflow in virtual time, whatever the mode.
+ */
+#ifndef __HOSTSIM_AVR_SLEEP_H__
+#define __HOSTSIM_AVR_SLEEP_H__
+
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE         0
+#define SLEEP_MODE_ADC          _BV(SM0)
+#define SLEEP_MODE_PWR_DOWN     _BV(SM1)
+
+#define set_sleep_mode(mode)    (MCUCR = (MCUCR & ~(_BV(SM0) | _BV(SM1))) | (mode))
+#define sleep_enable()          (MCUCR |= _BV(SE))
+#define sleep_disable()         (MCUCR &= ~_BV(SE))
+#define sleep_cpu()             do{ if(MCUCR & _BV(SE)) simSleep(); }while(0)
+#define sleep_mode()            do{ sleep_enable(); sleep_cpu(); sleep_disable(); }while(0)
+
+#endif /* __HOSTSIM_AVR_SLEEP_H__ */
@@ -0,0 +1,18 @@
+/* Included ahead of every unit of the host build (see the Makefile), C and
+ * C++, so that all of them see the driver's types alike.
+ *
+ * The driver is written for the AVR's 16 bit int: the string descriptors
+ * are int arrays, usbWord_t overlays an unsigned on two bytes, and buffer
+ * addresses go to usbCrc16() as unsigned. usbportability.h lets the build
+ * choose these types.
+ */
+#ifndef __HOSTSIM_HOSTCOMPAT_H__
+#define __HOSTSIM_HOSTCOMPAT_H__
+
+#include <stdint.h>
+
+#define USB_INT16_T     int16_t
+#define USB_UINT16_T    uint16_t
+#define USB_ADDR_T      uintptr_t
+
+#endif /* __HOSTSIM_HOSTCOMPAT_H__ */
@@ -0,0 +1,30 @@
+/* ATOMIC_BLOCK() as in avr-libc: interrupts off for the block, SREG saved
+ * and restored through a cleanup attribute.
+ */
+#ifndef __HOSTSIM_UTIL_ATOMIC_H__
+#define __HOSTSIM_UTIL_ATOMIC_H__
+
+#include <avr/interrupt.h>
+
+static __inline__ uint8_t __iCliRetVal(void)
+{
+    cli();
+    return 1;
+}
+
+static __inline__ void __iRestore(const uint8_t *sreg)
+{
+    SREG = *sreg;
+}
+
+static __inline__ void __iSeiParam(const uint8_t *unused)
+{
+    (void)unused;
+    sei();
+}
+
+#define ATOMIC_BLOCK(type)  for(type, __ToDo = __iCliRetVal(); __ToDo; __ToDo = 0)
+#define ATOMIC_RESTORESTATE uint8_t sreg_save __attribute__((__cleanup__(__iRestore))) = SREG
+#define ATOMIC_FORCEON      uint8_t sreg_save __attribute__((__cleanup__(__iSeiParam))) = 0
+
+#endif /* __HOSTSIM_UTIL_ATOMIC_H__ */
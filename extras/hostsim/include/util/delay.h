@@ -0,0 +1,19 @@
+/* Busy waits of the host build, counted in device cycles at F_CPU like the
+ * avr-libc loops. Interrupts that occur during the wait stretch it.
+ */
+#ifndef __HOSTSIM_UTIL_DELAY_H__
+#define __HOSTSIM_UTIL_DELAY_H__
+
+#include "sim.h"
+
+static inline void _delay_us(double us)
+{
+    simRun((uint64_t)(us * (F_CPU / 1e6) + 0.5));
+}
+
+static inline void _delay_ms(double ms)
+{
+    simRun((uint64_t)(ms * (F_CPU / 1e3) + 0.5));
+}
+
+#endif /* __HOSTSIM_UTIL_DELAY_H__ */
@@ -0,0 +1,356 @@
+/* Name: load.cpp
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+#include <stdio.h>
+#include "host.h"
+#include "load.h"
+#include "usbdrv.h"
+#include "requests.h"
+
+/* The OUT stream counts modulo a prime below 256 so that a gap in the echo
+ * tells how many bytes are missing (up to 250 in a row).
+ */
+#define STREAM_MODULUS  251
+#define SUSPEND_MS      100     /* bus suspended for this long */
+
+LoadConfig  loadConfig = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, -1};
+
+static struct {
+    double          credit;         /* bytes the rate allows to send now */
+    simtime_t       creditTime;
+    uint8_t         nextOut;
+    uint8_t         nextIn;         /* expected echo */
+    uint64_t        echoed, lost, repeated, corrupt;
+    unsigned long   controlOk, controlFailed, controlSkipped;
+    unsigned long   resets;
+    unsigned long   suspends, suspendSkipped;
+    unsigned long   wakeupsExpected, wakeupFailures;
+    int             wakeupCase, wakeupStep;     /* -1: no case running */
+    int             wakeupEnabled;  /* what the device should hold */
+    simtime_t       wakeupStart;
+} load;
+
+/* ------------------------------------------------------------------------- */
+
+static int outPacket(uint8_t *data)
+{
+    int     len = 8, i;
+
+    if(loadConfig.outRate == 0)
+        return 0;
+    if(loadConfig.outRate > 0){
+        load.credit += (simNow - load.creditTime) * loadConfig.outRate / SIM_S;
+        load.creditTime = simNow;
+        if(load.credit > 8)     /* no catching up after NAKs */
+            load.credit = 8;
+        if(load.credit < 1)
+            return 0;
+        len = load.credit < 8 ? (int)load.credit : 8;
+        load.credit -= len;
+    }
+    for(i = 0; i < len; i++){
+        data[i] = load.nextOut;
+        load.nextOut = (load.nextOut + 1) % STREAM_MODULUS;
+    }
+    return len;
+}
+
+/* A wrong byte followed by the expected next one was corrupted (the driver
+ * does not check the CRC of OUT data). Other gaps of up to half the modulus
+ * count as lost bytes, larger ones as the stream going back after a
+ * duplicate.
+ */
+static void echoIn(const uint8_t *data, int len)
+{
+    int     gap;
+
+    for(int i = 0; i < len; i++){
+        if(data[i] != load.nextIn && (data[i] >= STREAM_MODULUS ||
+           (i + 1 < len && data[i + 1] == (load.nextIn + 1) % STREAM_MODULUS))){
+            load.corrupt++;     /* a single wrong byte, the stream goes on */
+            load.nextIn = (load.nextIn + 1) % STREAM_MODULUS;
+            load.echoed++;
+            continue;
+        }
+        gap = (data[i] - load.nextIn + STREAM_MODULUS) % STREAM_MODULUS;
+        if(gap <= STREAM_MODULUS / 2){
+            load.lost += gap;
+        }else{  /* going back: a packet was delivered twice */
+            load.repeated += STREAM_MODULUS - gap;
+        }
+        load.nextIn = (data[i] + 1) % STREAM_MODULUS;
+        load.echoed++;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void pollOn(void *arg);
+
+static void pollOff(void *arg)
+{
+    hostPollBulkIn(0);
+    simSchedule(simNow + loadConfig.inOff * SIM_MS, pollOn, NULL);
+}
+
+static void pollOn(void *arg)
+{
+    hostPollBulkIn(1);
+    simSchedule(simNow + loadConfig.inOn * SIM_MS, pollOff, NULL);
+}
+
+static void controlDone(int status, const uint8_t *data, int len)
+{
+    if(status == HOST_OK && len == 3){
+        load.controlOk++;
+    }else{
+        load.controlFailed++;
+        hostLog("vendor request: %s", status == HOST_OK ? "short reply" : hostStatusName(status));
+    }
+}
+
+/* Reads the oscillator state, a small vendor control-IN transfer. If the
+ * last one is still going or the port is closed, this one is skipped.
+ */
+static void control(void *arg)
+{
+    simSchedule(simNow + loadConfig.controlPeriod, control, NULL);
+    if(!hostControl(USBRQ_DIR_DEVICE_TO_HOST | USBRQ_TYPE_VENDOR | USBRQ_RCPT_DEVICE,
+                    WL_REQUEST_GET_OSCCAL, 0, 0, 3, NULL, controlDone))
+        load.controlSkipped++;
+}
+
+static void reset(void *arg)
+{
+    simSchedule(simNow + loadConfig.resetPeriod, reset, NULL);
+    hostReset();
+    load.resets++;
+}
+
+static void resume(void *arg)
+{
+    hostResume();
+}
+
+/* Remote wakeup cases of --wakeup, one per suspend in turns. Each sets
+ * DEVICE_REMOTE_WAKEUP, leaves it set or clears it by CLEAR_FEATURE or a
+ * reset, checks with GET_STATUS that the device agrees and suspends the
+ * bus. The device must signal remote wakeup in the first case only.
+ */
+enum {STEP_SET, STEP_CLEAR, STEP_RESET, STEP_STATUS, STEP_SUSPEND, STEP_CHECK};
+
+static const uint8_t    wakeupCases[][6] = {
+    {STEP_SET, STEP_STATUS, STEP_SUSPEND, STEP_CHECK},
+    {STEP_SET, STEP_CLEAR, STEP_STATUS, STEP_SUSPEND, STEP_CHECK},
+    {STEP_SET, STEP_RESET, STEP_STATUS, STEP_SUSPEND, STEP_CHECK},
+};
+static const char       *wakeupCaseNames[] = {"enabled", "cleared", "reset"};
+
+#define WAKEUP_CASES    (int)(sizeof(wakeupCases) / sizeof(wakeupCases[0]))
+
+static void wakeupStep(void *arg);
+
+static void wakeupEnd(void)
+{
+    hostResume();
+    load.wakeupCase = (load.wakeupCase + 1) % WAKEUP_CASES;
+    load.wakeupStep = -1;
+}
+
+static void wakeupFailed(const char *what)
+{
+    load.wakeupFailures++;
+    hostLog("remote wakeup %s: %s", wakeupCaseNames[load.wakeupCase], what);
+    wakeupEnd();
+}
+
+static void wakeupNext(void)
+{
+    load.wakeupStep++;
+    wakeupStep(NULL);
+}
+
+static void featureDone(int status, const uint8_t *data, int len)
+{
+    if(status != HOST_OK){
+        wakeupFailed(hostStatusName(status));
+        return;
+    }
+    load.wakeupEnabled = wakeupCases[load.wakeupCase][load.wakeupStep] == STEP_SET;
+    wakeupNext();
+}
+
+static void statusDone(int status, const uint8_t *data, int len)
+{
+    if(status != HOST_OK || len != 2){
+        wakeupFailed(status == HOST_OK ? "short GET_STATUS" : hostStatusName(status));
+    }else if(!(data[0] & 2) != !load.wakeupEnabled){
+        wakeupFailed("GET_STATUS disagrees");
+    }else{
+        wakeupNext();
+    }
+}
+
+/* Steps that need the port wait for it in 1 ms steps, up to the period. */
+static void wakeupStep(void *arg)
+{
+    int     step = wakeupCases[load.wakeupCase][load.wakeupStep], started = 1;
+
+    switch(step){
+    case STEP_SET:
+    case STEP_CLEAR:
+        started = hostControl(USBRQ_DIR_HOST_TO_DEVICE | USBRQ_TYPE_STANDARD | USBRQ_RCPT_DEVICE,
+                              step == STEP_SET ? USBRQ_SET_FEATURE : USBRQ_CLEAR_FEATURE,
+                              1, 0, 0, NULL, featureDone);  /* DEVICE_REMOTE_WAKEUP */
+        break;
+    case STEP_RESET:
+        hostReset();
+        load.resets++;
+        load.wakeupEnabled = 0;
+        wakeupNext();
+        break;
+    case STEP_STATUS:
+        started = hostControl(USBRQ_DIR_DEVICE_TO_HOST | USBRQ_TYPE_STANDARD | USBRQ_RCPT_DEVICE,
+                              USBRQ_GET_STATUS, 0, 0, 2, NULL, statusDone);
+        break;
+    case STEP_SUSPEND:
+        if((started = hostSuspend()) != 0){
+            load.suspends++;
+            load.wakeupStep++;
+            simSchedule(simNow + SUSPEND_MS * SIM_MS, wakeupStep, NULL);
+        }
+        break;
+    case STEP_CHECK:
+        if(load.wakeupEnabled)
+            load.wakeupsExpected++;
+        if(hostWokenUp() != load.wakeupEnabled){
+            wakeupFailed(load.wakeupEnabled ? "no remote wakeup" : "remote wakeup");
+        }else{
+            wakeupEnd();
+        }
+        break;
+    }
+    if(started)
+        return;
+    if(simNow - load.wakeupStart >= loadConfig.suspendPeriod){
+        wakeupFailed("port not ready");
+    }else{
+        simSchedule(simNow + SIM_MS, wakeupStep, NULL);
+    }
+}
+
+/* Skipped while a control transfer is in progress, the port is closed or
+ * the last remote wakeup case is still running.
+ */
+static void suspend(void *arg)
+{
+    simSchedule(simNow + loadConfig.suspendPeriod, suspend, NULL);
+    if(loadConfig.wakeup){
+        if(load.wakeupStep >= 0){
+            load.suspendSkipped++;
+            return;
+        }
+        load.wakeupStart = simNow;
+        load.wakeupStep = 0;
+        wakeupStep(NULL);
+        return;
+    }
+    if(!hostSuspend()){
+        load.suspendSkipped++;
+        return;
+    }
+    load.suspends++;
+    simSchedule(simNow + SUSPEND_MS * SIM_MS, resume, NULL);
+}
+
+/* ------------------------------------------------------------------------- */
+
+int     loadActive(void)
+{
+    return loadConfig.outRate != 0 || loadConfig.inOff || loadConfig.controlPeriod ||
+           loadConfig.resetPeriod || loadConfig.suspendPeriod || loadConfig.echo;
+}
+
+void    loadInit(void)
+{
+    hostBulkOut = outPacket;
+    if(loadConfig.echo)
+        hostBulkIn = echoIn;
+    if(loadConfig.inOff)
+        simSchedule(0, pollOn, NULL);
+    if(loadConfig.controlPeriod)
+        simSchedule(loadConfig.controlPeriod, control, NULL);
+    if(loadConfig.resetPeriod)
+        simSchedule(loadConfig.resetPeriod, reset, NULL);
+    if(loadConfig.suspendPeriod)
+        simSchedule(loadConfig.suspendPeriod, suspend, NULL);
+    load.wakeupStep = -1;
+}
+
+/* The bulk OUT rate is taken since the first enumeration, like the rates
+ * of the report.
+ */
+int     loadOk(void)
+{
+    double  seconds = 0;
+
+    if(hostStats.firstConfigured)
+        seconds = (double)(simNow - hostStats.firstConfigured) / SIM_S;
+    if(loadConfig.minOutRate > 0 &&
+       (seconds <= 0 || hostStats.bulkOut.bytes / seconds < loadConfig.minOutRate))
+        return 0;
+    if(load.controlOk < loadConfig.minControl)
+        return 0;
+    if(loadConfig.echo && loadConfig.maxLost >= 0 && load.lost > (uint64_t)loadConfig.maxLost)
+        return 0;
+    if(hostStats.wakeupErrors)
+        return 0;
+    if(loadConfig.wakeup && (load.wakeupFailures || load.wakeupsExpected == 0))
+        return 0;
+    return 1;
+}
+
+static void pipeReport(const char *name, const HostPipeStats *pipe, double seconds)
+{
+    printf("%-20s%llu bytes, %.0f B/s, %lu transactions, %lu NAK, %lu errors\n", name,
+           (unsigned long long)pipe->bytes, seconds > 0 ? pipe->bytes / seconds : 0,
+           pipe->transactions, pipe->naks, pipe->errors);
+}
+
+void    loadReport(void)
+{
+    double  seconds = 0;
+
+    if(hostStats.firstConfigured)
+        seconds = (double)(simNow - hostStats.firstConfigured) / SIM_S;
+    printf("\nload (rates since the first enumeration)\n");
+    pipeReport("  bulk OUT", &hostStats.bulkOut, seconds);
+    pipeReport("  bulk IN", &hostStats.bulkIn, seconds);
+    pipeReport("  control", &hostStats.control, seconds);
+    printf("  vendor requests   %lu ok, %lu failed, %lu skipped\n",
+           load.controlOk, load.controlFailed, load.controlSkipped);
+    printf("  re-enumerations   %lu\n", load.resets);
+    if(loadConfig.suspendPeriod)
+        printf("  suspends          %lu, %lu skipped\n", load.suspends, load.suspendSkipped);
+    if(loadConfig.wakeup)
+        printf("  remote wakeup     %lu expected, %lu failed cases\n",
+               load.wakeupsExpected, load.wakeupFailures);
+    if(loadConfig.echo){
+        int64_t inFlight = hostStats.bulkOut.bytes + load.repeated - load.echoed - load.lost;
+        printf("  echo              %llu bytes back, %llu lost, %llu repeated, %lld in flight, "
+               "%llu corrupt\n", (unsigned long long)load.echoed, (unsigned long long)load.lost,
+               (unsigned long long)load.repeated, (long long)inFlight,
+               (unsigned long long)load.corrupt);
+    }
+    printf("\n");
+    histogramPrintHeader();
+    histogramPrint("  bulk OUT packet", &hostStats.bulkOut.latency);
+    histogramPrint("  bulk IN packet", &hostStats.bulkIn.latency);
+    histogramPrint("  control transfer", &hostStats.control.latency);
+    histogramPrint("  enumeration", &hostStats.enumeration);
+    if(hostStats.wakeupSignal.count)
+        histogramPrint("  remote wakeup K", &hostStats.wakeupSignal);
+}
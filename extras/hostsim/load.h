@@ -0,0 +1,48 @@
+/* Name: load.h
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+/*
+General Description:
+Traffic generator for the host model: a bulk OUT stream at a given rate or
+as fast as the device takes it, bulk IN polling in bursts, vendor control
+transfers interleaved with the bulk traffic, and re-enumerations and bus
+suspends at a fixed period. With echo checking, the bulk IN stream must return the OUT stream
+(the Echo example); bytes missing from it were dropped by the device, most
+likely by a full receive buffer. With remote wakeup checking, the suspends
+take turns at leaving DEVICE_REMOTE_WAKEUP set, clearing it and resetting
+the device, and only the first must end by the device's resume signalling.
+*/
+
+#ifndef __load_h_included__
+#define __load_h_included__
+
+#include "sim.h"
+
+struct LoadConfig {
+    double      outRate;        /* bulk OUT bytes per second, < 0 as fast as possible */
+    unsigned    inOn, inOff;    /* bulk IN polled for inOn frames, paused for inOff */
+    simtime_t   controlPeriod;  /* vendor control transfers, 0 for none */
+    simtime_t   resetPeriod;    /* re-enumerations, 0 for none */
+    simtime_t   suspendPeriod;  /* bus suspends of 100 ms, 0 for none */
+    int         wakeup;         /* remote wakeup cases before the suspends */
+    int         echo;           /* check that bulk IN returns the OUT stream */
+    double      minOutRate;     /* fail below this bulk OUT rate, 0 for no check */
+    unsigned long minControl;   /* fail below this many vendor requests answered */
+    long        maxLost;        /* fail if the echo lost more bytes, < 0 for no check */
+};
+
+extern LoadConfig   loadConfig;
+
+void    loadInit(void);
+/* Installs the host callbacks and schedules the load. Call after hostInit(). */
+int     loadActive(void);
+/* Nonzero if loadConfig asks for any load. */
+void    loadReport(void);
+/* Prints throughput, NAKs, latency histograms and the echo check. */
+int     loadOk(void);
+/* Nonzero if the limits set in loadConfig were met. */
+
+#endif /* __load_h_included__ */
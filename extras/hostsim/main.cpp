@@ -0,0 +1,361 @@
+/* Name: main.cpp
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+/*
+General Description:
+Runs a sketch against the host model for a given stretch of virtual time
+and prints a report. The sketch runs in the main thread as on the device;
+the simulation ends from an event when the time is up.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <avr/interrupt.h>
+#include "host.h"
+#include "load.h"
+#include "replay.h"
+#include "trace.h"
+#include "usbdrv.h"
+
+extern "C" void setup(void);
+extern "C" void loop(void);
+
+static simtime_t    duration;           /* 10 s by default */
+static const char   *expect;            /* every line must be this */
+static unsigned long minLines;          /* fail if fewer lines arrive */
+static char         line[256];
+static int          lineLength;
+static unsigned long lineEnumeration;   /* the enumeration the line started in */
+static unsigned long lines, unexpected;
+static double       clockLimit;         /* fraction of F_CPU, 0 = no check */
+static double       clockErrorMax;      /* since the first enumeration */
+static struct timespec  wallStart;
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [options]\n", name);
+    fprintf(stderr, "  --time T         virtual time to run, e.g. 500ms, 90s, 10m, 24h, 7d (10s)\n");
+    fprintf(stderr, "  --expect LINE    fail if the device sends any other line\n");
+    fprintf(stderr, "  --min-lines N    fail if fewer lines arrive\n");
+    fprintf(stderr, "  --osc-error PCT  factory calibration error of the RC oscillator (1.5)\n");
+    fprintf(stderr, "  --osc-drift PCT  amplitude of the oscillator drift (0)\n");
+    fprintf(stderr, "  --osc-period T   period of the drift (1h)\n");
+    fprintf(stderr, "  --clock-limit PCT\n");
+    fprintf(stderr, "                   fail if the device clock leaves F_CPU +/- PCT once\n");
+    fprintf(stderr, "                   configured, or if it is enumerated again\n");
+    fprintf(stderr, "  -v               log port and enumeration events\n");
+    fprintf(stderr, "load:\n");
+    fprintf(stderr, "  --out RATE       bulk OUT bytes per second or 'max' to saturate\n");
+    fprintf(stderr, "  --in-burst N/M   poll bulk IN for N frames, then pause for M\n");
+    fprintf(stderr, "  --control T      vendor control transfer every T\n");
+    fprintf(stderr, "  --reset T        reset and enumerate again every T\n");
+    fprintf(stderr, "  --suspend T      suspend the bus for 100 ms every T\n");
+    fprintf(stderr, "  --wakeup         enable, clear or reset remote wakeup before the\n");
+    fprintf(stderr, "                   suspends and check that only enabled ones wake up\n");
+    fprintf(stderr, "  --echo           check that bulk IN returns the OUT stream (Echo)\n");
+    fprintf(stderr, "  --min-out RATE   fail if bulk OUT takes fewer bytes per second\n");
+    fprintf(stderr, "  --min-control N  fail if fewer vendor requests are answered\n");
+    fprintf(stderr, "  --max-lost N     fail if the echo loses more bytes\n");
+    fprintf(stderr, "trace:\n");
+    fprintf(stderr, "  --pcap FILE          write transfers as Linux usbmon pcap\n");
+    fprintf(stderr, "  --pcap-packets FILE  write every packet as USB 2.0 pcap\n");
+    fprintf(stderr, "  --summary            print bandwidth and gaps per endpoint\n");
+    fprintf(stderr, "replay:\n");
+    fprintf(stderr, "  --replay FILE        send the host side of a usbmon pcap again and\n");
+    fprintf(stderr, "                       compare the answers (time: recording + 10s)\n");
+    fprintf(stderr, "  --replay-slack T     extra latency tolerated per answer (1ms)\n");
+    fprintf(stderr, "faults:\n");
+    fprintf(stderr, "  --bit-errors BER     bit error rate on the wire, e.g. 1e-5\n");
+    fprintf(stderr, "  --ack-loss PCT       ACK handshakes lost\n");
+    fprintf(stderr, "  --sof-delay PCT      keep-alives sent late ...\n");
+    fprintf(stderr, "  --sof-delay-max T    ... by up to T (50us, at most 100us)\n");
+    fprintf(stderr, "  --poll-stall PCT     frames that start a poll stall ...\n");
+    fprintf(stderr, "  --poll-stall-time T  ... of T (20ms)\n");
+    fprintf(stderr, "  --seed N             seed of the fault models (1)\n");
+    exit(2);
+}
+
+static simtime_t parseTime(const char *s, const char *name)
+{
+    char    *end;
+    double  v = strtod(s, &end);
+
+    if(end == s || v < 0)
+        usage(name);
+    if(strcmp(end, "us") == 0){
+        v *= 1e-6;
+    }else if(strcmp(end, "ms") == 0){
+        v *= 1e-3;
+    }else if(strcmp(end, "m") == 0){
+        v *= 60;
+    }else if(strcmp(end, "h") == 0){
+        v *= 3600;
+    }else if(strcmp(end, "d") == 0){
+        v *= 86400;
+    }else if(*end != 0 && strcmp(end, "s") != 0){
+        usage(name);
+    }
+    return (simtime_t)(v * SIM_S);
+}
+
+static double parseRate(const char *s, const char *name)
+{
+    char    *end;
+    double  v;
+
+    if(strcmp(s, "max") == 0)
+        return -1;
+    v = strtod(s, &end);
+    if(end == s || *end != 0 || v < 0)
+        usage(name);
+    return v;
+}
+
+static double parseNumber(const char *s, const char *name)
+{
+    char    *end;
+    double  v = strtod(s, &end);
+
+    if(end == s || *end != 0 || v < 0)
+        usage(name);
+    return v;
+}
+
+static double parsePercent(const char *s, const char *name)
+{
+    return parseNumber(s, name) / 100;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* The sketch writes whether the port is open or not, so the first line after
+ * each enumeration may start anywhere. It is counted but not checked.
+ */
+static void bulkIn(const uint8_t *data, int len)
+{
+    if(lineEnumeration != hostStats.enumerations){
+        lineEnumeration = hostStats.enumerations;
+        lineLength = -1;
+    }
+    for(int i = 0; i < len; i++){
+        char c = data[i];
+        if(c == '\r')
+            continue;
+        if(c != '\n'){
+            if(lineLength >= 0 && lineLength < (int)sizeof(line) - 1)
+                line[lineLength++] = c;
+            continue;
+        }
+        lines++;
+        if(lineLength < 0){
+            lineLength = 0;
+            continue;
+        }
+        line[lineLength] = 0;
+        if(expect != NULL && strcmp(line, expect) != 0){
+            if(unexpected++ < 10)
+                printf("unexpected line: \"%s\"\n", line);
+        }
+        lineLength = 0;
+    }
+}
+
+/* Samples the device clock every 10 ms for --clock-limit. */
+static void checkClock(void *arg)
+{
+    if(hostStats.firstConfigured){
+        double  error = fabs(simDeviceHz() / F_CPU - 1);
+        if(error > clockErrorMax)
+            clockErrorMax = error;
+    }
+    simSchedule(simNow + 10 * SIM_MS, checkClock, NULL);
+}
+
+static double wallSeconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - wallStart.tv_sec) + (now.tv_nsec - wallStart.tv_nsec) * 1e-9;
+}
+
+static void report(void)
+{
+    char    buffer[24];
+    double  wall = wallSeconds(), t = (double)simNow / SIM_S;
+
+    printf("virtual time        %s (%.1f s wall, %.0fx real time)\n",
+           hostFormatTime(buffer, simNow), wall, wall > 0 ? t / wall : 0);
+    printf("frames              %lu\n", hostStats.frames);
+    printf("device clock        %.4f MHz, OSCCAL %u, %u corrections\n",
+           simDeviceHz() / 1e6, OSCCAL, osctuneCorrections);
+    if(clockLimit > 0)
+        printf("clock error         %.2f%% max since the first enumeration, limit %.2f%%\n",
+               100 * clockErrorMax, 100 * clockLimit);
+    printf("interrupt handler   %.2f%% of the time\n",
+           t > 0 ? 100.0 * simIsrTime() / simNow : 0);
+    printf("port                %lu connects, %lu disconnects, %lu resets\n",
+           hostStats.connects, hostStats.disconnects, hostStats.resets);
+    if(hostStats.suspends)
+        printf("suspend             %lu suspends, %lu resumes, %lu remote wakeups, "
+               "%lu errors\n", hostStats.suspends, hostStats.resumes,
+               hostStats.remoteWakeups, hostStats.wakeupErrors);
+    printf("enumerations        %lu ok, %lu failed, first configured at %s\n",
+           hostStats.enumerations, hostStats.enumFailures,
+           hostStats.firstConfigured ? hostFormatTime(buffer, hostStats.firstConfigured) : "-");
+    printf("transactions        %lu: %lu ACK, %lu NAK, %lu STALL, %lu timeouts\n",
+           hostStats.transactions, hostStats.acks, hostStats.naks, hostStats.stalls,
+           hostStats.timeouts);
+    printf("errors              %lu CRC, %lu data toggle\n",
+           hostStats.crcErrors, hostStats.toggleErrors);
+    if(hostStats.faults.bitErrors || hostStats.faults.acksLost ||
+       hostStats.faults.sofsDelayed || hostStats.faults.pollStalls)
+        printf("faults injected     %lu bit errors, %lu ACKs lost, %lu late keep-alives, "
+               "%lu poll stalls\n", hostStats.faults.bitErrors, hostStats.faults.acksLost,
+               hostStats.faults.sofsDelayed, hostStats.faults.pollStalls);
+    printf("bulk IN             %llu bytes", (unsigned long long)hostStats.bulkIn.bytes);
+    if(expect != NULL || minLines)
+        printf(", %lu lines, %lu unexpected", lines, unexpected);
+    printf("\n");
+    printf("interrupt IN        %llu bytes\n", (unsigned long long)hostStats.intrIn.bytes);
+    if(loadActive())
+        loadReport();
+    if(replayActive())
+        replayReport();
+}
+
+static void finish(void *arg)
+{
+    int     ok = hostStats.firstConfigured != 0 && unexpected == 0;
+
+    if(expect != NULL && lines == 0)
+        ok = 0;
+    if(lines < minLines)
+        ok = 0;
+    if(replayActive() && !replayOk())
+        ok = 0;
+    if(loadActive() && !loadOk())
+        ok = 0;
+    if(clockLimit > 0 && (clockErrorMax > clockLimit || hostStats.enumerations != 1))
+        ok = 0;
+    report();
+    traceClose();
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    exit(ok ? 0 : 1);
+}
+
+int main(int argc, char **argv)
+{
+    for(int i = 1; i < argc; i++){
+        const char *arg = argv[i];
+        if(strcmp(arg, "-v") == 0){
+            hostVerbose = 1;
+            continue;
+        }
+        if(strcmp(arg, "--echo") == 0){
+            loadConfig.echo = 1;
+            continue;
+        }
+        if(strcmp(arg, "--wakeup") == 0){
+            loadConfig.wakeup = 1;
+            continue;
+        }
+        if(strcmp(arg, "--summary") == 0){
+            traceEnableSummary();
+            continue;
+        }
+        if(i + 1 >= argc)
+            usage(argv[0]);
+        if(strcmp(arg, "--time") == 0){
+            duration = parseTime(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--expect") == 0){
+            expect = argv[++i];
+        }else if(strcmp(arg, "--min-lines") == 0){
+            minLines = (unsigned long)parseNumber(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--osc-error") == 0){
+            simOscillator.error = parsePercent(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--osc-drift") == 0){
+            simOscillator.drift = parsePercent(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--clock-limit") == 0){
+            clockLimit = parsePercent(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--osc-period") == 0){
+            simOscillator.period = (double)parseTime(argv[++i], argv[0]) / SIM_S;
+        }else if(strcmp(arg, "--out") == 0){
+            loadConfig.outRate = parseRate(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--in-burst") == 0){
+            if(sscanf(argv[++i], "%u/%u", &loadConfig.inOn, &loadConfig.inOff) != 2 ||
+               loadConfig.inOn == 0)
+                usage(argv[0]);
+        }else if(strcmp(arg, "--control") == 0){
+            loadConfig.controlPeriod = parseTime(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--reset") == 0){
+            loadConfig.resetPeriod = parseTime(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--suspend") == 0){
+            loadConfig.suspendPeriod = parseTime(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--min-out") == 0){
+            loadConfig.minOutRate = parseNumber(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--min-control") == 0){
+            loadConfig.minControl = (unsigned long)parseNumber(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--max-lost") == 0){
+            loadConfig.maxLost = (long)parseNumber(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--bit-errors") == 0){
+            hostFaults.bitErrorRate = parseNumber(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--ack-loss") == 0){
+            hostFaults.ackLoss = parsePercent(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--sof-delay") == 0){
+            hostFaults.sofDelayRate = parsePercent(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--sof-delay-max") == 0){
+            hostFaults.sofDelayMax = parseTime(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--poll-stall") == 0){
+            hostFaults.pollStallRate = parsePercent(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--poll-stall-time") == 0){
+            hostFaults.pollStallTime = parseTime(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--pcap") == 0 || strcmp(arg, "--pcap-packets") == 0){
+            const char *path = argv[++i];
+            if(!(strcmp(arg, "--pcap") == 0 ? traceOpenUsbmon(path) : traceOpenPackets(path))){
+                perror(path);
+                exit(2);
+            }
+        }else if(strcmp(arg, "--replay") == 0){
+            if(!replayOpen(argv[++i]))
+                exit(2);
+        }else if(strcmp(arg, "--replay-slack") == 0){
+            replaySlack = parseTime(argv[++i], argv[0]);
+        }else if(strcmp(arg, "--seed") == 0){
+            simSeed(strtoull(argv[++i], NULL, 0));
+        }else{
+            usage(argv[0]);
+        }
+    }
+    if(expect != NULL && loadConfig.echo)
+        usage(argv[0]);     /* both check bulk IN */
+    if(loadConfig.maxLost >= 0 && !loadConfig.echo)
+        usage(argv[0]);     /* only the echo tells lost bytes */
+    if(loadConfig.wakeup && !loadConfig.suspendPeriod)
+        usage(argv[0]);     /* the cases run before the suspends */
+    if(replayActive() && (expect != NULL || loadActive()))
+        usage(argv[0]);     /* the recording is the load */
+    if(duration == 0)
+        duration = replayActive() ? replayLength() + 10 * SIM_S : 10 * SIM_S;
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    clock_gettime(CLOCK_MONOTONIC, &wallStart);
+    hostBulkIn = bulkIn;
+    simInit();
+    hostInit();
+    loadInit();
+    if(replayActive())
+        replayInit(finish);
+    simSchedule(duration, finish, NULL);
+    if(clockLimit > 0)
+        checkClock(NULL);
+    sei();
+    setup();
+    for(;;)
+        loop();
+}
@@ -0,0 +1,523 @@
+/* Name: replay.cpp
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "replay.h"
+#include "trace.h"
+#include "usbdrv.h"
+
+#define PCAP_MAGIC_US       0xa1b2c3d4
+#define PCAP_MAGIC_NS       0xa1b23c4d
+#define LINKTYPE_USBMON_48  189         /* LINKTYPE_USB_LINUX */
+#define LINKTYPE_USBMON     220         /* LINKTYPE_USB_LINUX_MMAPPED */
+#define MAX_FLAGGED         10          /* regressions listed */
+#define REPLAY_GRACE        SIM_S       /* after the last recorded event */
+
+struct ReplayUrb {
+    uint64_t    id;
+    int         type;
+    uint8_t     endpoint;       /* bit 7 set for IN */
+    uint8_t     device;
+    uint8_t     setup[8];
+    simtime_t   submitted, completed;   /* completed is 0 while pending */
+    int         status;
+    int         length;         /* requested, then actual */
+    uint8_t     *data;          /* OUT data when submitted, IN data when complete */
+    int         dataLength;     /* captured, may be less than length */
+};
+
+struct ReplayIn {               /* recorded bulk IN data */
+    uint64_t    end;            /* stream offset after the packet */
+    simtime_t   t;              /* since the alignment point */
+};
+
+simtime_t   replaySlack = SIM_MS;
+
+static const char   *replayPath;
+static ReplayUrb    *urbs;
+static int          urbCount;
+static simtime_t    anchor;     /* recorded SET_CONFIGURATION completion */
+static uint8_t      device;
+static simtime_t    lastEvent;
+
+static int          *controls, controlCount;    /* indices into urbs */
+static int          *outs, outCount;
+static uint8_t      *inStream;
+static ReplayIn     *ins;
+static int          inCount;
+static uint64_t     inLength;
+
+static struct {
+    void            (*done)(void *arg);
+    int             started;    /* the model had the port open */
+    int             control;    /* next control transfer */
+    simtime_t       controlStart;
+    int             out;        /* bulk OUT transfer in progress */
+    int             outSent, outAcked;  /* bytes of it */
+    simtime_t       outStart;
+    uint64_t        inPosition;
+    int             in;         /* next recorded bulk IN packet */
+    uint64_t        inExtra;    /* bytes beyond the recording */
+    int             finished;
+    unsigned long   compared, contentErrors, lateAnswers;
+    Histogram       controlRecorded, controlReplayed;
+    Histogram       outRecorded, outReplayed;
+    Histogram       inLate;
+    int             flaggedCount;
+    char            flagged[MAX_FLAGGED][160];
+} replay;
+
+/* ------------------------------------------------------------------------- */
+/* ------------------------------ Reading pcap ----------------------------- */
+/* ------------------------------------------------------------------------- */
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+    return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+static uint8_t *copyData(const uint8_t *data, int len)
+{
+    uint8_t *p = (uint8_t *)malloc(len > 0 ? len : 1);
+
+    memcpy(p, data, len);
+    return p;
+}
+
+/* usbmon ids are kernel addresses of URBs and are reused: a completion
+ * belongs to the latest pending submission with its id.
+ */
+static ReplayUrb *pendingUrb(uint64_t id)
+{
+    for(int i = urbCount - 1; i >= 0 && i >= urbCount - 1000; i--){
+        if(urbs[i].id == id && !urbs[i].completed)
+            return &urbs[i];
+    }
+    return NULL;
+}
+
+/* One usbmon event: a 48 or 64 byte header in host byte order (little
+ * endian here), then the captured data.
+ */
+static void readEvent(simtime_t t, const uint8_t *p, int len, int headerLength)
+{
+    ReplayUrb   *u;
+    int         dataLength;
+
+    if(len < headerLength)
+        return;
+    dataLength = get32(p + 36);
+    if(dataLength > len - headerLength)
+        dataLength = len - headerLength;
+    if(p[8] == 'S'){
+        if(urbCount % 256 == 0)
+            urbs = (ReplayUrb *)realloc(urbs, (urbCount + 256) * sizeof(ReplayUrb));
+        u = &urbs[urbCount++];
+        memset(u, 0, sizeof(*u));
+        u->id = get64(p);
+        u->type = p[9];
+        u->endpoint = p[10];
+        u->device = p[11];
+        if(p[14] == 0)
+            memcpy(u->setup, p + 40, 8);
+        u->submitted = t;
+        u->length = get32(p + 32);
+        if(!(u->endpoint & 0x80) && p[15] == 0 && dataLength > 0){
+            u->data = copyData(p + headerLength, dataLength);
+            u->dataLength = dataLength;
+        }
+    }else if(p[8] == 'C' && (u = pendingUrb(get64(p))) != NULL){
+        u->completed = t > u->submitted ? t : u->submitted + 1;
+        u->status = (int32_t)get32(p + 28);
+        u->length = get32(p + 32);
+        if((u->endpoint & 0x80) && p[15] == 0 && dataLength > 0){
+            free(u->data);
+            u->data = copyData(p + headerLength, dataLength);
+            u->dataLength = dataLength;
+        }
+    }
+    if(t > lastEvent)
+        lastEvent = t;
+}
+
+static int readPcap(FILE *f)
+{
+    uint8_t     header[24], *record = NULL;
+    uint32_t    magic, linkType, length;
+    int         headerLength, ok = 1;
+    simtime_t   t;
+
+    if(fread(header, 1, sizeof(header), f) != sizeof(header))
+        return 0;
+    magic = get32(header);
+    linkType = get32(header + 20);
+    if(magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS){
+        fprintf(stderr, "%s: not a little endian pcap file (pcapng must be converted)\n",
+                replayPath);
+        return 0;
+    }
+    if(linkType == LINKTYPE_USBMON){
+        headerLength = 64;
+    }else if(linkType == LINKTYPE_USBMON_48){
+        headerLength = 48;
+    }else{
+        fprintf(stderr, "%s: link type %u, not usbmon\n", replayPath, linkType);
+        return 0;
+    }
+    record = (uint8_t *)malloc(get32(header + 16) + 64);
+    while(fread(header, 1, 16, f) == 16){
+        length = get32(header + 8);
+        if(length > get32(header + 12) || fread(record, 1, length, f) != length){
+            ok = 0;
+            break;
+        }
+        t = get32(header) * SIM_S +
+            get32(header + 4) * (magic == PCAP_MAGIC_US ? SIM_US : 1);
+        readEvent(t, record, length, headerLength);
+    }
+    free(record);
+    if(!ok)
+        fprintf(stderr, "%s: truncated\n", replayPath);
+    return ok;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int isRequest(const ReplayUrb *u, uint8_t type, uint8_t request)
+{
+    return u->type == URB_CONTROL && u->setup[0] == type && u->setup[1] == request;
+}
+
+static int *addIndex(int *list, int *count, int i)
+{
+    if(*count % 256 == 0)
+        list = (int *)realloc(list, (*count + 256) * sizeof(int));
+    list[(*count)++] = i;
+    return list;
+}
+
+/* Picks what is sent again and what the device's answers are compared
+ * with, see replay.h.
+ */
+static int selectUrbs(void)
+{
+    int     i, j;
+
+    for(i = 0; i < urbCount; i++){
+        if(urbs[i].completed && urbs[i].status == URB_OK &&
+           isRequest(&urbs[i], USBRQ_DIR_HOST_TO_DEVICE, USBRQ_SET_CONFIGURATION))
+            break;
+    }
+    if(i == urbCount){
+        fprintf(stderr, "%s: no device was configured in the capture\n", replayPath);
+        return 0;
+    }
+    anchor = urbs[i].completed;
+    device = urbs[i].device;
+    for(j = i + 1; j < urbCount; j++){  /* the port opened: DTR set */
+        if(urbs[j].completed && urbs[j].status == URB_OK && urbs[j].device == device &&
+           isRequest(&urbs[j], USBRQ_DIR_HOST_TO_DEVICE | USBRQ_TYPE_CLASS |
+                     USBRQ_RCPT_INTERFACE, 0x22) && (urbs[j].setup[2] & 1)){
+            anchor = urbs[j].completed;
+            break;
+        }
+    }
+    for(i = 0; i < urbCount; i++){
+        ReplayUrb   *u = &urbs[i];
+        int         in = u->endpoint & 0x80;
+
+        if(!u->completed || (u->status != URB_OK && u->status != URB_STALL) ||
+           (u->device != device && (u->device != 0 || u->submitted > anchor)))
+            continue;
+        if(u->type == URB_CONTROL){
+            int length = u->setup[6] | u->setup[7] << 8;
+            if(isRequest(u, USBRQ_DIR_HOST_TO_DEVICE, USBRQ_SET_ADDRESS) ||
+               isRequest(u, USBRQ_DIR_HOST_TO_DEVICE, USBRQ_SET_CONFIGURATION) ||
+               length > 256 || (!in && u->dataLength < length))
+                continue;
+            controls = addIndex(controls, &controlCount, i);
+        }else if(u->type == URB_BULK && !in){
+            if(u->dataLength > 0 && u->dataLength == u->length)
+                outs = addIndex(outs, &outCount, i);
+        }else if(u->type == URB_BULK && u->status == URB_OK && u->dataLength > 0){
+            if(inCount % 256 == 0)
+                ins = (ReplayIn *)realloc(ins, (inCount + 256) * sizeof(ReplayIn));
+            inStream = (uint8_t *)realloc(inStream, inLength + u->dataLength);
+            memcpy(inStream + inLength, u->data, u->dataLength);
+            inLength += u->dataLength;
+            ins[inCount].end = inLength;
+            ins[inCount++].t = u->completed > anchor ? u->completed - anchor : 0;
+        }
+    }
+    /* the enumeration goes last, where it does not shift the rest */
+    for(i = 0; i < controlCount && urbs[controls[0]].submitted <= anchor; i++){
+        int first = controls[0];
+        memmove(controls, controls + 1, (controlCount - 1) * sizeof(int));
+        controls[controlCount - 1] = first;
+    }
+    return 1;
+}
+
+int     replayOpen(const char *path)
+{
+    FILE    *f = fopen(path, "rb");
+    int     ok;
+
+    if(f == NULL){
+        perror(path);
+        return 0;
+    }
+    replayPath = path;
+    ok = readPcap(f) && selectUrbs();
+    fclose(f);
+    return ok;
+}
+
+int     replayActive(void)
+{
+    return replayPath != NULL;
+}
+
+simtime_t replayLength(void)
+{
+    return lastEvent > anchor ? lastEvent - anchor : 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* -------------------------------- Replay --------------------------------- */
+/* ------------------------------------------------------------------------- */
+
+/* When a recorded submission is due in the model's time, which starts when
+ * the port was first open. Requests of the recorded enumeration are sent
+ * at the end.
+ */
+static simtime_t due(const ReplayUrb *u)
+{
+    return hostStats.firstConfigured +
+           (u->submitted > anchor ? u->submitted : lastEvent) - anchor;
+}
+
+static void flag(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+static void flag(const char *format, ...)
+{
+    char    *p;
+    va_list args;
+
+    if(replay.flaggedCount >= MAX_FLAGGED)
+        return;
+    p = replay.flagged[replay.flaggedCount++];
+    hostFormatTime(p, simNow);
+    strcat(p, "  ");
+    va_start(args, format);
+    vsnprintf(p + strlen(p), sizeof(replay.flagged[0]) - strlen(p), format, args);
+    va_end(args);
+}
+
+static void checkLatency(const char *what, simtime_t recorded, simtime_t replayed)
+{
+    if(replayed <= recorded + replaySlack)
+        return;
+    replay.lateAnswers++;
+    flag("%s: %.3f ms, recorded %.3f ms", what, replayed / 1e6, recorded / 1e6);
+}
+
+/* Status classes: ok, stall or failed in some other way. */
+static int statusClass(int status)
+{
+    return status == URB_OK ? 0 : status == URB_STALL ? 1 : 2;
+}
+
+static void nextControl(void);
+
+static void controlDone(int status, const uint8_t *data, int len)
+{
+    static const int    urbStatus[] = {URB_OK, URB_STALL, URB_PROTOCOL, URB_KILLED};
+    const ReplayUrb     *u = &urbs[controls[replay.control]];
+    char                what[40];
+    int                 n;
+
+    sprintf(what, "control %02x %02x %02x%02x %02x%02x %d", u->setup[0], u->setup[1],
+            u->setup[3], u->setup[2], u->setup[5], u->setup[4],
+            u->setup[6] | u->setup[7] << 8);
+    replay.compared++;
+    if(statusClass(urbStatus[status]) != statusClass(u->status)){
+        replay.contentErrors++;
+        flag("%s: %s, recorded status %d", what, hostStatusName(status), u->status);
+    }else if((u->setup[0] & USBRQ_DIR_MASK) && status == HOST_OK){
+        n = u->dataLength < len ? u->dataLength : len;
+        if(len != u->length || memcmp(data, u->data, n) != 0){
+            replay.contentErrors++;
+            for(n = 0; n < len && n < u->dataLength && data[n] == u->data[n]; n++)
+                ;
+            flag("%s: %d bytes, recorded %d, first difference at byte %d", what, len,
+                 u->length, n);
+        }
+    }
+    if(u->submitted > anchor){  /* not timed during the enumeration */
+        histogramAdd(&replay.controlRecorded, u->completed - u->submitted);
+        histogramAdd(&replay.controlReplayed, simNow - replay.controlStart);
+        checkLatency(what, u->completed - u->submitted, simNow - replay.controlStart);
+    }
+    replay.control++;
+    nextControl();
+}
+
+static void submitControl(void *arg)
+{
+    const ReplayUrb *u = &urbs[controls[replay.control]];
+
+    if(!hostControl(u->setup[0], u->setup[1], u->setup[2] | u->setup[3] << 8,
+                    u->setup[4] | u->setup[5] << 8, u->setup[6] | u->setup[7] << 8,
+                    u->data, controlDone)){
+        simSchedule(simNow + SIM_MS, submitControl, NULL);  /* port closed */
+        return;
+    }
+    replay.controlStart = simNow;
+}
+
+static void nextControl(void)
+{
+    if(replay.control < controlCount)
+        simSchedule(due(&urbs[controls[replay.control]]), submitControl, NULL);
+}
+
+static void start(void);
+
+static int outPacket(uint8_t *data)
+{
+    const ReplayUrb *u;
+    int             len;
+
+    if(!hostStats.firstConfigured)
+        return 0;
+    if(!replay.started)
+        start();
+    if(replay.out >= outCount)
+        return 0;
+    u = &urbs[outs[replay.out]];
+    if(simNow < due(u) || replay.outSent == u->dataLength)
+        return 0;
+    if(replay.outSent == 0)
+        replay.outStart = due(u);
+    len = u->dataLength - replay.outSent < 8 ? u->dataLength - replay.outSent : 8;
+    memcpy(data, u->data + replay.outSent, len);
+    replay.outSent += len;
+    return len;
+}
+
+static void outDone(int len)
+{
+    const ReplayUrb *u;
+    char            what[40];
+
+    if(replay.out >= outCount)
+        return;
+    u = &urbs[outs[replay.out]];
+    replay.outAcked += len;
+    if(replay.outAcked < u->dataLength)
+        return;
+    sprintf(what, "bulk OUT %d bytes", u->dataLength);
+    histogramAdd(&replay.outRecorded, u->completed - u->submitted);
+    histogramAdd(&replay.outReplayed, simNow - replay.outStart);
+    checkLatency(what, u->completed - u->submitted, simNow - replay.outStart);
+    replay.out++;
+    replay.outSent = replay.outAcked = 0;
+}
+
+static void inData(const uint8_t *data, int len)
+{
+    simtime_t   t = simNow - hostStats.firstConfigured, late;
+
+    for(int i = 0; i < len; i++){
+        if(replay.inPosition >= inLength){
+            replay.inExtra++;
+            continue;
+        }
+        if(data[i] != inStream[replay.inPosition]){
+            replay.contentErrors++;
+            flag("bulk IN byte %llu: 0x%02x, recorded 0x%02x",
+                 (unsigned long long)replay.inPosition, data[i], inStream[replay.inPosition]);
+        }
+        replay.inPosition++;
+    }
+    for(; replay.in < inCount && ins[replay.in].end <= replay.inPosition; replay.in++){
+        const ReplayIn *r = &ins[replay.in];
+        late = t > r->t ? t - r->t : 0;
+        histogramAdd(&replay.inLate, late);
+        replay.compared++;
+        if(late > replaySlack){
+            replay.lateAnswers++;
+            flag("bulk IN bytes up to %llu: %.3f ms later than recorded",
+                 (unsigned long long)r->end, late / 1e6);
+        }
+    }
+}
+
+static void end(void *arg)
+{
+    replay.finished = replay.control >= controlCount && replay.out >= outCount &&
+                      replay.inPosition >= inLength;
+    replay.done(NULL);
+}
+
+/* The host asks for bulk OUT data in every frame once the port is open,
+ * which starts the replay. It adds no events of its own until the first
+ * recorded control transfer, so that the firmware runs as it did while
+ * the capture was taken by the simulator.
+ */
+static void start(void)
+{
+    replay.started = 1;
+    nextControl();
+    simSchedule(hostStats.firstConfigured + replayLength() + REPLAY_GRACE, end, NULL);
+}
+
+void    replayInit(void (*done)(void *arg))
+{
+    replay.done = done;
+    hostBulkIn = inData;
+    hostBulkOut = outPacket;
+    hostBulkOutDone = outDone;
+}
+
+int     replayOk(void)
+{
+    return replay.finished && replay.contentErrors == 0 && replay.lateAnswers == 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void    replayReport(void)
+{
+    printf("\nreplay of %s (device %u, %d URBs)\n", replayPath, device, urbCount);
+    printf("  control           %d of %d sent\n", replay.control, controlCount);
+    printf("  bulk OUT          %d of %d sent\n", replay.out, outCount);
+    printf("  bulk IN           %llu of %llu bytes, %llu more than recorded\n",
+           (unsigned long long)replay.inPosition, (unsigned long long)inLength,
+           (unsigned long long)replay.inExtra);
+    printf("  answers           %lu compared, %lu differ, %lu late (slack %.3f ms)%s\n",
+           replay.compared, replay.contentErrors, replay.lateAnswers, replaySlack / 1e6,
+           replay.finished ? "" : ", incomplete");
+    for(int i = 0; i < replay.flaggedCount; i++)
+        printf("  %s\n", replay.flagged[i]);
+    printf("\n");
+    histogramPrintHeader();
+    histogramPrint("  control recorded", &replay.controlRecorded);
+    histogramPrint("  control replayed", &replay.controlReplayed);
+    histogramPrint("  bulk OUT recorded", &replay.outRecorded);
+    histogramPrint("  bulk OUT replayed", &replay.outReplayed);
+    histogramPrint("  bulk IN late", &replay.inLate);
+}
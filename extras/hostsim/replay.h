@@ -0,0 +1,54 @@
+/* Name: replay.h
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+/*
+General Description:
+Replays a usbmon capture against the host model. The capture may come from
+a real host (tcpdump or Wireshark on usbmonN, saved as pcap) or from the
+simulator itself (--pcap of an earlier firmware). The host model enumerates
+the device on its own; the recording is aligned so that its successful
+SET_CONFIGURATION falls on the moment the model has the port open, and from
+there on the host side of the recording is sent again at its recorded
+times:
+
+- control transfers with their setup packet and OUT data, one at a time,
+  except SET_ADDRESS and SET_CONFIGURATION, which are the model's business.
+  Requests made during the recorded enumeration are sent after all the
+  rest, so that they do not shift its timing, and are not timed.
+- bulk OUT transfers, split into 8 byte packets.
+
+The device's answers are compared with the recording: status and data of
+each control transfer, and the bulk IN stream byte by byte. Each answer is
+timed in virtual time and flagged as a latency regression if it takes more
+than the slack longer than recorded: control transfers and bulk OUT
+transfers from submission to completion, bulk IN data from the alignment
+point to its arrival. Interrupt IN and isochronous transfers are ignored.
+*/
+
+#ifndef __replay_h_included__
+#define __replay_h_included__
+
+#include "sim.h"
+
+extern simtime_t    replaySlack;    /* tolerated extra latency (1 ms) */
+
+int     replayOpen(const char *path);
+/* Reads the capture. Prints an error and returns 0 if it is not a usbmon
+ * pcap or holds no configured device.
+ */
+int     replayActive(void);
+simtime_t replayLength(void);
+/* Time from the recorded alignment point to the last recorded event. */
+void    replayInit(void (*done)(void *arg));
+/* Installs the host callbacks. The replay starts when the port is open;
+ * done is called one second after the last recorded event. Call after
+ * hostInit().
+ */
+int     replayOk(void);
+/* Nonzero if no answer differed from the recording or came late. */
+void    replayReport(void);
+
+#endif /* __replay_h_included__ */
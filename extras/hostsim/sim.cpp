@@ -0,0 +1,205 @@
+/* Name: sim.cpp
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+#include <math.h>
+#include <queue>
+#include <vector>
+#include "sim.h"
+#include "host.h"
+#include "usbdrv.h"
+
+volatile uint8_t simIo[0x40];
+simtime_t       simNow;
+uint32_t        simBusEdges;
+SimOscillator   simOscillator = {0.015, 0, 3600};
+
+struct Event {
+    simtime_t   when;
+    uint64_t    seq;
+    simEventFn  fn;
+    void        *arg;
+
+    bool operator>(const Event &other) const
+    {
+        return when != other.when ? when > other.when : seq > other.seq;
+    }
+};
+
+static std::priority_queue<Event, std::vector<Event>, std::greater<Event> > events;
+static uint64_t     eventSeq;
+static double       cycles;         /* device cycles since power up */
+static double       cyclesPerNs;
+static int          clockOsccal = -1;
+static simtime_t    clockUpdate;    /* next drift update of cyclesPerNs */
+static simtime_t    isrTime;
+
+/* ------------------------------------------------------------------------- */
+/* --------------------------- Oscillator model ---------------------------- */
+/* ------------------------------------------------------------------------- */
+
+/* Version 5 RC oscillator of the ATtiny25/45/85: two overlapping ranges of
+ * 128 steps, each step about 0.8% of 8 MHz. The CPU runs from the PLL at
+ * twice the RC frequency. The factory value of OSCCAL gives 8 MHz within
+ * the calibration error.
+ */
+#define RC_LOW_MHZ      3.9
+#define RC_HIGH_MHZ     7.4
+#define RC_STEP_MHZ     0.0655
+#define RC_FACTORY_MHZ  8.0
+
+static double rcMHz(uint8_t osccal)
+{
+    return (osccal & 0x80 ? RC_HIGH_MHZ : RC_LOW_MHZ) + (osccal & 0x7f) * RC_STEP_MHZ;
+}
+
+static void updateClock(void)
+{
+    double  deviation = simOscillator.error;
+
+    if(simOscillator.drift != 0)
+        deviation += simOscillator.drift * sin(2 * M_PI * simNow / (simOscillator.period * SIM_S));
+    clockOsccal = OSCCAL;
+    cyclesPerNs = 2 * rcMHz(clockOsccal) * (1 + deviation) / 1000;
+    clockUpdate = simNow + SIM_S;
+}
+
+void    simInit(void)
+{
+    OSCCAL = (uint8_t)((RC_FACTORY_MHZ - RC_LOW_MHZ) / RC_STEP_MHZ + 0.5);
+    SREG = 0;
+    updateClock();
+}
+
+double  simDeviceHz(void)
+{
+    return cyclesPerNs * SIM_S;
+}
+
+/* ------------------------------------------------------------------------- */
+/* ----------------------------- Event engine ------------------------------ */
+/* ------------------------------------------------------------------------- */
+
+static inline void setNow(simtime_t t)
+{
+    cycles += (t - simNow) * cyclesPerNs;
+    simNow = t;
+    if(OSCCAL != clockOsccal || t >= clockUpdate)
+        updateClock();
+}
+
+static inline simtime_t nsForCycles(uint64_t n)
+{
+    return (simtime_t)(n / cyclesPerNs + 0.5);
+}
+
+static void runNext(void)
+{
+    Event   e = events.top();
+
+    events.pop();
+    setNow(e.when);
+    e.fn(e.arg);
+}
+
+void    simSchedule(simtime_t when, simEventFn fn, void *arg)
+{
+    Event   e = {when < simNow ? simNow : when, eventSeq++, fn, arg};
+
+    events.push(e);
+}
+
+void    simRun(uint64_t n)
+{
+    simtime_t end = simNow + nsForCycles(n);
+    simtime_t isrStart = isrTime;
+
+    while(!events.empty() && events.top().when <= end + (isrTime - isrStart))
+        runNext();
+    setNow(end + (isrTime - isrStart));
+}
+
+void    simSleep(void)
+{
+    uint64_t    toOverflow = 16384 - simCycles() % 16384;   /* timer 0, prescaler 64 */
+    simtime_t   wake = simNow + nsForCycles(toOverflow);
+
+    if(!events.empty() && events.top().when <= wake){
+        runNext();
+    }else{
+        setNow(wake);
+    }
+}
+
+int     simWaitBus(uint64_t n)
+{
+    uint32_t    edges = simBusEdges;
+    simtime_t   end = simNow + nsForCycles(n);
+
+    while(simBusEdges == edges){
+        if(events.empty() || events.top().when > end){
+            setNow(end);
+            return 0;
+        }
+        runNext();
+    }
+    return 1;
+}
+
+void    simIsrBusy(simtime_t ns)
+{
+    isrTime += ns;
+}
+
+simtime_t simIsrTime(void)
+{
+    return isrTime;
+}
+
+/* xorshift64* */
+static uint64_t     randomState = 0x9e3779b97f4a7c15ULL + 1;    /* seed 1 */
+
+void    simSeed(uint64_t seed)
+{
+    randomState = seed * 0x9e3779b97f4a7c15ULL + 1;  /* never 0 */
+}
+
+uint64_t simRandom(void)
+{
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return randomState * 0x2545f4914f6cdd1dULL;
+}
+
+double  simRandomUniform(void)
+{
+    return (simRandom() >> 11) * (1.0 / (1ULL << 53));
+}
+
+/* ------------------------------------------------------------------------- */
+/* ------------------------- Computed I/O registers ------------------------ */
+/* ------------------------------------------------------------------------- */
+
+uint64_t simCycles(void)
+{
+    return (uint64_t)cycles;
+}
+
+uint8_t simReadTcnt0(void)
+{
+    return (uint8_t)(simCycles() / 64);
+}
+
+/* Pins driven by the device read back the port value. The USB lines read
+ * what the host puts on the bus, the other inputs read their pull-up.
+ */
+uint8_t simReadPinB(void)
+{
+    uint8_t ddr = DDRB, port = PORTB;
+    uint8_t bus = (hostLineState() & USBMASK) | (port & ~USBMASK);
+
+    return (port & ddr) | (bus & ~ddr);
+}
@@ -0,0 +1,96 @@
+/* Name: sim.h
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+/*
+General Description:
+Discrete event engine of the host build. Virtual time is kept in nanoseconds
+of the USB host's clock; the device clock runs at the frequency which the
+oscillator model derives from OSCCAL. Nothing ever sleeps: the firmware
+consumes virtual time only where it waits (_delay_ms(), delay(), sleep_mode(),
+millis() and micros()), and waiting jumps straight to the next event. Events
+are scheduled by the host model (frames, transactions, port timers) and run
+in the order of their time stamps.
+
+The USB interrupt is modeled at packet level in usbisr.cpp. It can only run
+while the firmware waits, which is where it matters: all shared state the
+library protects with cli()/sei() is touched between waits.
+*/
+
+#ifndef __sim_h_included__
+#define __sim_h_included__
+
+#include <stdint.h>
+
+typedef uint64_t simtime_t;     /* virtual time in ns since power up */
+
+#define SIM_US  1000ULL
+#define SIM_MS  1000000ULL
+#define SIM_S   1000000000ULL
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ------------------------- device side interface ------------------------- */
+
+extern volatile uint8_t simIo[0x40];    /* I/O registers, see <avr/io.h> */
+extern simtime_t    simNow;             /* current virtual time */
+extern uint32_t     simBusEdges;        /* bus activity seen by the device */
+
+uint8_t     simReadPinB(void);
+uint8_t     simReadTcnt0(void);
+uint64_t    simCycles(void);
+/* Returns the number of device clock cycles since power up. */
+void        simRun(uint64_t cycles);
+/* Busy waits for the given number of device cycles. Interrupt handlers that
+ * run in between stretch the wait, as they do for a delay loop.
+ */
+void        simSleep(void);
+/* Idle sleep until the next interrupt: the next event or the timer 0
+ * overflow, whichever comes first.
+ */
+int         simWaitBus(uint64_t cycles);
+/* Waits with interrupts disabled until the bus changes (simBusEdges is
+ * incremented) but at most the given number of cycles. Returns 0 on timeout.
+ */
+void        simIsrBusy(simtime_t ns);
+/* Called by the interrupt model: the handler kept the CPU for ns. */
+
+#ifdef __cplusplus
+}
+
+/* --------------------------- engine interface ---------------------------- */
+
+typedef void (*simEventFn)(void *arg);
+
+void        simInit(void);
+/* Power up: sets the factory OSCCAL value and starts the device clock. Call
+ * after setting simOscillator.
+ */
+void        simSchedule(simtime_t when, simEventFn fn, void *arg);
+/* Runs fn(arg) at virtual time when (or now if when has passed). Events with
+ * equal time stamps run in the order they were scheduled.
+ */
+double      simDeviceHz(void);
+/* Current device clock frequency. */
+simtime_t   simIsrTime(void);
+/* Total time spent in the USB interrupt handler. */
+void        simSeed(uint64_t seed);
+uint64_t    simRandom(void);
+/* Pseudo random numbers for the fault models, the same for the same seed. */
+double      simRandomUniform(void);
+/* Uniformly distributed in [0, 1). */
+
+struct SimOscillator {
+    double  error;      /* factory calibration error, fraction of F_CPU */
+    double  drift;      /* amplitude of the slow drift (temperature) */
+    double  period;     /* period of the drift in seconds */
+};
+extern SimOscillator simOscillator;
+
+#endif /* __cplusplus */
+
+#endif /* __sim_h_included__ */
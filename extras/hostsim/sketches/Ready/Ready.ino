@@ -0,0 +1,24 @@
+/* Writes from the onReady() callback, which runs inside a poll: write()
+ * polls again before the port is open, so the library must already count
+ * the device as configured when it calls back. The loop only prints once
+ * the callback has run.
+ */
+#include <DigiCDC.h>
+
+static volatile bool ready;
+
+static void onReady(void) {
+  SerialUSB.println(F("READY"));
+  ready = true;
+}
+
+void setup() {
+  SerialUSB.onReady(onReady);
+  SerialUSB.begin();
+}
+
+void loop() {
+  if (ready)
+    SerialUSB.println(F("READY"));
+  SerialUSB.delay(100);
+}
@@ -0,0 +1,15 @@
+/* Takes one byte every 20 ms and echoes it, far slower than the host sends.
+ * Bulk OUT must stop and go without losing a byte: the reader makes
+ * progress, so a stop is not cut short by HW_CDC_RX_STOP_MS.
+ */
+#include <DigiCDC.h>
+
+void setup() {
+  SerialUSB.begin();
+}
+
+void loop() {
+  if (SerialUSB.available())
+    SerialUSB.write(SerialUSB.read());
+  SerialUSB.delay(20);
+}
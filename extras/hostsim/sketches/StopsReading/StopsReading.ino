@@ -0,0 +1,15 @@
+/* Takes every byte for the first 65.4 s, then never reads again. The bulk
+ * OUT stop that follows spans millis() passing 65536, and it must still
+ * time out after HW_CDC_RX_STOP_MS so that control requests get through.
+ */
+#include <DigiCDC.h>
+
+void setup() {
+  SerialUSB.begin();
+}
+
+void loop() {
+  while (millis() < 65400 && SerialUSB.available())
+    SerialUSB.read();
+  SerialUSB.refresh();
+}
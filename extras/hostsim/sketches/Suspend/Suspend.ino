@@ -0,0 +1,19 @@
+/* Writes a line whenever the host suspends the bus. The bytes are parked
+ * while the bus is suspended and must reach the host after it resumes, so
+ * with --suspend every suspend adds a whole line.
+ */
+#include <DigiCDC.h>
+
+static bool wasSuspended;
+
+void setup() {
+  SerialUSB.begin();
+}
+
+void loop() {
+  SerialUSB.refresh();
+  bool suspended = SerialUSB.state() & USB_STATE_SUSPENDED;
+  if (suspended && !wasSuspended)
+    SerialUSB.println(F("SUSPENDED"));
+  wasSuspended = suspended;
+}
@@ -0,0 +1,22 @@
+/* Writes a line and calls wakeup() whenever the host suspends the bus.
+ * wakeup() must be refused unless the host enabled remote wakeup, and it
+ * must then drive the resume for 1 to 15 ms; --wakeup checks both. The
+ * line must arrive after the resume either way.
+ */
+#include <DigiCDC.h>
+
+static bool wasSuspended;
+
+void setup() {
+  SerialUSB.begin();
+}
+
+void loop() {
+  SerialUSB.refresh();
+  bool suspended = SerialUSB.state() & USB_STATE_SUSPENDED;
+  if (suspended && !wasSuspended)
+    SerialUSB.println(F("WAKEUP"));
+  if (suspended)
+    SerialUSB.wakeup();
+  wasSuspended = suspended;
+}
@@ -0,0 +1,233 @@
+/* Name: trace.cpp
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "histogram.h"
+#include "trace.h"
+#include "usbdrv.h"
+
+#define PCAP_MAGIC_NS       0xa1b23c4d  /* time stamps in ns */
+#define LINKTYPE_USBMON     220         /* LINKTYPE_USB_LINUX_MMAPPED */
+#define LINKTYPE_USB_2_0    288
+#define USBMON_HEADER       64
+#define USBMON_BUS          1
+
+struct EndpointTrace {
+    unsigned long   tokens, packets, naks, stalls;
+    uint64_t        bytes;
+    simtime_t       last;       /* last data packet */
+    Histogram       gaps;       /* between data packets */
+};
+/* Data packets count when the ACK follows: bytes are payload delivered. */
+
+enum {SLOT_SETUP = 32};         /* slots 0..15 OUT, 16..31 IN */
+
+int                 traceActive;
+
+static FILE         *usbmonFile, *packetFile;
+static int          summary;
+static EndpointTrace endpoints[SLOT_SETUP + 1];
+static int          slot = -1;  /* of the last token */
+static int          dataLength = -1;    /* payload of the data packet before */
+static simtime_t    dataTime;
+
+/* ------------------------------------------------------------------------- */
+
+static uint8_t *put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v)
+{
+    return put16(put16(p, v), v >> 16);
+}
+
+static uint8_t *put64(uint8_t *p, uint64_t v)
+{
+    return put32(put32(p, v), v >> 32);
+}
+
+static FILE *openPcap(const char *path, uint32_t linkType)
+{
+    uint8_t header[24], *p = header;
+    FILE    *f = fopen(path, "wb");
+
+    if(f == NULL)
+        return NULL;
+    p = put32(p, PCAP_MAGIC_NS);
+    p = put16(p, 2);
+    p = put16(p, 4);
+    p = put32(p, 0);            /* time zone */
+    p = put32(p, 0);            /* accuracy */
+    p = put32(p, 65535);        /* snap length */
+    put32(p, linkType);
+    fwrite(header, 1, sizeof(header), f);
+    traceActive = 1;
+    return f;
+}
+
+static void writeRecord(FILE *f, simtime_t t, const uint8_t *data, int len)
+{
+    uint8_t header[16], *p = header;
+
+    p = put32(p, t / SIM_S);
+    p = put32(p, t % SIM_S);
+    p = put32(p, len);
+    put32(p, len);
+    fwrite(header, 1, sizeof(header), f);
+    fwrite(data, 1, len, f);
+}
+
+int     traceOpenUsbmon(const char *path)
+{
+    return (usbmonFile = openPcap(path, LINKTYPE_USBMON)) != NULL;
+}
+
+int     traceOpenPackets(const char *path)
+{
+    return (packetFile = openPcap(path, LINKTYPE_USB_2_0)) != NULL;
+}
+
+void    traceEnableSummary(void)
+{
+    summary = traceActive = 1;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void countPacket(simtime_t t, const uint8_t *packet, int len)
+{
+    EndpointTrace   *e;
+
+    switch(packet[0]){
+    case USBPID_SETUP:
+    case USBPID_OUT:
+    case USBPID_IN:
+        if(len < 3){
+            slot = -1;
+            return;
+        }
+        slot = ((packet[2] << 1) | (packet[1] >> 7)) & 0xf;
+        if(packet[0] == USBPID_IN){
+            slot += 16;
+        }else if(packet[0] == USBPID_SETUP){
+            slot = SLOT_SETUP;
+        }
+        endpoints[slot].tokens++;
+        dataLength = -1;
+        return;
+    }
+    if(slot < 0)
+        return;
+    e = &endpoints[slot];
+    switch(packet[0]){
+    case USBPID_DATA0:
+    case USBPID_DATA1:
+        dataLength = len >= 3 ? len - 3 : 0;
+        dataTime = t;
+        break;
+    case USBPID_ACK:
+        if(dataLength < 0)
+            break;
+        if(e->packets)
+            histogramAdd(&e->gaps, dataTime - e->last);
+        e->packets++;
+        e->bytes += dataLength;
+        e->last = dataTime;
+        dataLength = -1;
+        break;
+    case USBPID_NAK:
+        e->naks++;
+        break;
+    case USBPID_STALL:
+        e->stalls++;
+        break;
+    }
+}
+
+void    tracePacket(simtime_t t, const uint8_t *packet, int len)
+{
+    if(len <= 0)
+        return;
+    if(packetFile != NULL)
+        writeRecord(packetFile, t, packet, len);
+    if(summary)
+        countPacket(t, packet, len);
+}
+
+void    traceUrb(simtime_t t, char event, uint64_t id, int type, uint8_t endpoint,
+                 uint8_t address, const uint8_t *setup, int status, int length,
+                 const uint8_t *data, int dataLength)
+{
+    uint8_t record[USBMON_HEADER + 256], *p = record;
+
+    if(usbmonFile == NULL)
+        return;
+    if(dataLength > 256)
+        dataLength = 256;
+    memset(record, 0, USBMON_HEADER);
+    p = put64(p, id);
+    *p++ = event;
+    *p++ = type;
+    *p++ = endpoint;
+    *p++ = address;
+    p = put16(p, USBMON_BUS);
+    *p++ = setup != NULL ? 0 : '-';
+    *p++ = dataLength > 0 ? 0 : (endpoint & 0x80 ? '<' : '>');
+    p = put64(p, t / SIM_S);
+    p = put32(p, t % SIM_S / SIM_US);
+    p = put32(p, status);
+    p = put32(p, length);
+    p = put32(p, dataLength);
+    if(setup != NULL)
+        memcpy(p, setup, 8);
+    p += 8;
+    put32(p, type == URB_INTERRUPT ? 128 : 0);  /* interval, see host.cpp */
+    memcpy(record + USBMON_HEADER, data, dataLength);
+    writeRecord(usbmonFile, t, record, USBMON_HEADER + dataLength);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void printSummary(void)
+{
+    static const char   *direction[] = {"OUT", "IN"};
+    double              seconds = (double)simNow / SIM_S;
+    char                name[16];
+
+    printf("\nendpoint     tokens   packets      bytes      B/s      NAK  STALL"
+           "   gap (us)  p50       p99       max\n");
+    for(int i = 0; i <= SLOT_SETUP; i++){
+        const EndpointTrace *e = &endpoints[i];
+        if(e->tokens == 0)
+            continue;
+        if(i == SLOT_SETUP){
+            strcpy(name, "0 SETUP");
+        }else{
+            sprintf(name, "%d %s", i % 16, direction[i / 16]);
+        }
+        printf("  %-8s %8lu %9lu %10llu %8.1f %8lu %6lu %19.1f %9.1f %9.1f\n", name,
+               e->tokens, e->packets, (unsigned long long)e->bytes,
+               seconds > 0 ? e->bytes / seconds : 0, e->naks, e->stalls,
+               histogramPercentile(&e->gaps, 50) / 1e3, histogramPercentile(&e->gaps, 99) / 1e3,
+               e->gaps.max / 1e3);
+    }
+}
+
+void    traceClose(void)
+{
+    if(usbmonFile != NULL)
+        fclose(usbmonFile);
+    if(packetFile != NULL)
+        fclose(packetFile);
+    usbmonFile = packetFile = NULL;
+    if(summary)
+        printSummary();
+}
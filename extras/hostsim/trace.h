@@ -0,0 +1,60 @@
+/* Name: trace.h
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+/*
+General Description:
+Trace recorder for the host model. Two pcap formats with virtual time
+stamps (0 is power up) can be written, both open in Wireshark:
+
+- Linux usbmon (LINKTYPE_USB_LINUX_MMAPPED, 220): transfers as the Linux
+  host controller driver reports them, a submission and a completion per
+  URB. Bulk and interrupt URBs are one packet each, as cdc-acm submits
+  them for an 8 byte endpoint. This is the format of captures taken with
+  usbmon on a real host, see extras/hostsim/README.md.
+- USB 2.0 packets (LINKTYPE_USB_2_0, 288): every token, data packet and
+  handshake on the bus, including NAKs and retries, as the device's
+  usbRxBuf and usbTxBuf see them.
+
+The summary lists bandwidth and inter-packet gaps per endpoint, computed
+from the packets.
+*/
+
+#ifndef __trace_h_included__
+#define __trace_h_included__
+
+#include <stdint.h>
+#include "sim.h"
+
+/* usbmon transfer types and status values */
+enum {URB_ISO, URB_INTERRUPT, URB_CONTROL, URB_BULK};
+
+#define URB_OK          0
+#define URB_PENDING     (-115)      /* -EINPROGRESS, status of a submission */
+#define URB_KILLED      (-2)        /* -ENOENT, unlinked (timeout, reset) */
+#define URB_PROTOCOL    (-71)       /* -EPROTO, no or bad handshake */
+#define URB_STALL       (-32)       /* -EPIPE */
+
+extern int  traceActive;    /* any of the below enabled */
+
+int     traceOpenUsbmon(const char *path);
+int     traceOpenPackets(const char *path);
+/* Return 0 if the file cannot be created. */
+void    traceEnableSummary(void);
+
+void    tracePacket(simtime_t t, const uint8_t *packet, int len);
+/* A packet on the bus, starting with the PID. */
+void    traceUrb(simtime_t t, char event, uint64_t id, int type, uint8_t endpoint,
+                 uint8_t address, const uint8_t *setup, int status, int length,
+                 const uint8_t *data, int dataLength);
+/* A usbmon event: 'S' for the submission, 'C' for the completion. The
+ * endpoint has bit 7 set for IN. setup is given for control submissions.
+ * length is the requested (S) or actual (C) length, data what the URB
+ * carries at this point (OUT data when submitted, IN data when complete).
+ */
+void    traceClose(void);
+/* Flushes and closes the files and prints the summary if enabled. */
+
+#endif /* __trace_h_included__ */
@@ -0,0 +1,212 @@
+/* Name: usbisr.cpp
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+/*
+General Description:
+Packet level model of the assembler module (usbdrvasm.S, asmcommon.inc and
+the clock specific receiver) for the host build. It implements the same
+decisions on the same driver variables: address and token filtering, buffer
+swapping, NAK while usbPoll() has not processed the last packet, handshakes
+stored in the tx length bytes and the address change after a data packet.
+Bit level timing is covered by extras/vusbsim; here a packet arrives whole
+and the handler costs the CPU the bus time of the packet and its reply.
+
+Also implements the other assembler functions: usbCrc16(), usbCrc16Append()
+and usbMeasureFrameLength().
+*/
+
+#include <math.h>
+#include <string.h>
+#include "sim.h"
+#include "usbisr.h"
+extern "C" {
+#include "usbdrv.h"
+}
+#include "usbwire.h"
+
+/* driver state shared with the assembler module, defined in usbdrv.c */
+extern "C" {
+extern uchar    usbRxBuf[2 * USB_BUFSIZE];
+extern uchar    usbInputBufOffset;
+extern uchar    usbDeviceAddr;
+extern uchar    usbNewDeviceAddr;
+extern uchar    usbCurrentTok;
+extern volatile uchar usbTxLen;
+extern uchar    usbTxBuf[USB_BUFSIZE];
+}
+
+#define ISR_OVERHEAD_NS (20 * SIM_US / 16.5 + 0.5)    /* push/pop, ~20 cycles */
+#define CLOCK_TOLERANCE 0.011   /* usbdrvasm165.inc: 16.3125 to 16.6875 MHz */
+
+int     usbIsrEnabled(void)
+{
+    return (SREG & 0x80) && (USB_INTR_ENABLE & (1 << USB_INTR_ENABLE_BIT)) &&
+           (USB_INTR_CFG & USB_INTR_CFG_SET) == USB_INTR_CFG_SET;
+}
+
+/* Sends a data packet from a tx buffer: len is the value of usbTxLen, which
+ * counts the SYNC byte, so the packet proper is len - 1 bytes.
+ */
+static int sendBuffer(const uchar *buffer, uchar len, uint8_t *reply)
+{
+    memcpy(reply, buffer, len - 1);
+    usbDeviceAddr = usbNewDeviceAddr << 1;  /* set address only after data packets */
+    return len - 1;
+}
+
+static int handleIn(uchar endpoint, uint8_t *reply)
+{
+    volatile uchar *txLen = &usbTxLen;
+    uchar   *txBuf = usbTxBuf;
+    uchar   len;
+
+    if(usbRxLen >= 1){  /* unprocessed input packet */
+        reply[0] = USBPID_NAK;
+        return 1;
+    }
+#if USB_CFG_HAVE_INTRIN_ENDPOINT
+    if(endpoint != 0){
+#if USB_CFG_HAVE_INTRIN_ENDPOINT3
+        if(endpoint == USB_CFG_EP3_NUMBER){
+            txLen = &usbTxLen3;
+            txBuf = usbTxBuf3;
+        }else
+#endif
+        {
+            txLen = &usbTxLen1;
+            txBuf = usbTxBuf1;
+        }
+    }
+#endif
+    len = *txLen;
+    if(len & 0x10){     /* handshake token */
+        reply[0] = len;
+        return 1;
+    }
+    *txLen = USBPID_NAK;
+    return sendBuffer(txBuf, len, reply);
+}
+
+static int handlePacket(const uint8_t *packet, int len, uint8_t *reply)
+{
+    uchar   token = packet[0], endpoint;
+
+    if(len > USB_BUFSIZE){  /* overflow */
+        usbCurrentTok = 0;
+        return 0;
+    }
+    memcpy(usbRxBuf + usbInputBufOffset, packet, len);
+    if(token == USBPID_DATA0 || token == USBPID_DATA1){
+        if(usbCurrentTok == 0)
+            return 0;
+        if(usbRxLen != 0){
+            reply[0] = USBPID_NAK;
+            return 1;
+        }
+        if(len >= 4){   /* zero sized data packets are status phase only */
+            usbRxLen = len;
+            usbRxToken = usbCurrentTok;
+            usbInputBufOffset = USB_BUFSIZE - usbInputBufOffset;
+        }
+        reply[0] = USBPID_ACK;
+        return 1;
+    }
+    if(len < 3 || (uchar)(packet[1] << 1) != usbDeviceAddr){
+        usbCurrentTok = 0;
+        return 0;
+    }
+    endpoint = ((packet[2] << 1) | (packet[1] >> 7)) & 0xf;
+    if(token == USBPID_IN)
+        return handleIn(endpoint, reply);
+    if(token != USBPID_SETUP && token != USBPID_OUT){
+        usbCurrentTok = 0;
+        return 0;
+    }
+#if USB_CFG_IMPLEMENT_FN_WRITEOUT
+    if(endpoint != 0)
+        token = endpoint;
+#endif
+    usbCurrentTok = token;
+    return 0;
+}
+
+int     usbIsrPacket(const uint8_t *packet, int len, uint8_t *reply)
+{
+    int     replyLen;
+
+    simBusEdges++;
+    if(!usbIsrEnabled())
+        return -1;
+    if(fabs(simDeviceHz() / F_CPU - 1) > CLOCK_TOLERANCE){
+        simIsrBusy(usbWirePacketNs(len) + ISR_OVERHEAD_NS);
+        return 0;   /* garbled: the receiver lost the bit clock */
+    }
+    replyLen = handlePacket(packet, len, reply);
+    simIsrBusy(usbWirePacketNs(len) + ISR_OVERHEAD_NS +
+               (replyLen > 0 ? usbWirePacketNs(replyLen) : 0));
+    return replyLen;
+}
+
+int     usbIsrKeepAlive(void)
+{
+    simBusEdges++;
+    if(!usbIsrEnabled())
+        return 0;
+#if USB_COUNT_SOF
+    usbSofCount++;
+#endif
+#ifdef USB_SOF_HOOK
+    {   /* tuneOsccal from osctune.h */
+        uchar   t = TCNT0;
+        schar   d = (uchar)(t - lastTimer0Value - EXPECTED_TIMER0_INCREMENT);
+
+        lastTimer0Value = t;
+        if((schar)(d - (TOLERATED_DEVIATION + 1)) >= 0){
+            OSCCAL--;
+            osctuneCorrections++;
+        }else if((schar)(d + TOLERATED_DEVIATION) < 0){
+            OSCCAL++;
+            osctuneCorrections++;
+        }
+    }
+#endif
+    simIsrBusy(USB_LS_KEEPALIVE_NS + ISR_OVERHEAD_NS);
+    return 1;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* The driver passes buffer addresses as USB_ADDR_T, see hostcompat.h. */
+unsigned (usbCrc16)(USB_ADDR_T data, uchar len)
+{
+    return usbWireCrc16((uchar *)data, len);
+}
+
+unsigned (usbCrc16Append)(USB_ADDR_T data, uchar len)
+{
+    uchar   *p = (uchar *)data;
+    unsigned crc = usbWireCrc16(p, len);
+
+    p[len] = crc;
+    p[len + 1] = crc >> 8;
+    return crc;
+}
+
+/* Waits for the next SE0 (any bus activity pulls D- low) and counts the
+ * cycles until the following one in units of 7, the loop length of the
+ * assembler version. Returns 0 on timeout as the original does.
+ */
+unsigned usbMeasureFrameLength(void)
+{
+    uint64_t    start;
+
+    if(!simWaitBus(5 * 65536UL * 6))
+        return 0;
+    start = simCycles();
+    if(!simWaitBus(65535UL * 7))
+        return 0;
+    return (simCycles() - start) / 7;
+}
@@ -0,0 +1,24 @@
+/* Name: usbisr.h
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+#ifndef __usbisr_h_included__
+#define __usbisr_h_included__
+
+#include <stdint.h>
+
+int     usbIsrPacket(const uint8_t *packet, int len, uint8_t *reply);
+/* Hands one packet from the host to the device's interrupt handler. The
+ * reply (handshake or data packet) is stored in reply, which must hold 11
+ * bytes. Returns its length, 0 if the device stays silent or -1 if the
+ * interrupt is disabled and the packet was missed.
+ */
+int     usbIsrKeepAlive(void);
+/* Signals the low-speed keep-alive (the SOF of a low-speed device). Returns
+ * 0 if the interrupt is disabled.
+ */
+int     usbIsrEnabled(void);
+
+#endif /* __usbisr_h_included__ */
@@ -0,0 +1,100 @@
+/* Name: usbwire.h
+ * Project: DigisparkWebUSB host tools
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+/*
+General Description:
+Packet level helpers shared by the host and device models: CRCs, token and
+data packets and the time a packet takes on a low-speed bus. Packets are
+byte strings beginning with the PID, as in usbdrv's buffers and in
+extras/vusbsim/usbwire.py. SYNC and EOP are implied.
+*/
+
+#ifndef __usbwire_h_included__
+#define __usbwire_h_included__
+
+#include <stdint.h>
+#include <string.h>
+#include "sim.h"
+
+#define USB_LS_BIT_NS       667     /* 1.5 Mbit/s, rounded to a ns */
+#define USB_LS_EOP_BITS     3       /* SE0 for two bits, one bit of J */
+#define USB_LS_GAP_BITS     4       /* turn-around and inter-packet delay */
+#define USB_LS_KEEPALIVE_NS (2 * USB_LS_BIT_NS)
+
+static inline uint8_t usbWireCrc5(unsigned value)
+{
+    uint8_t crc = 0x1f;
+    int     i;
+
+    for(i = 0; i < 11; i++, value >>= 1){
+        if((crc ^ value) & 1){
+            crc = (crc >> 1) ^ 0x14;
+        }else{
+            crc >>= 1;
+        }
+    }
+    return crc ^ 0x1f;
+}
+
+static inline unsigned usbWireCrc16(const uint8_t *data, int len)
+{
+    unsigned crc = 0xffff;
+    int      i;
+
+    while(len-- > 0){
+        crc ^= *data++;
+        for(i = 0; i < 8; i++)
+            crc = crc & 1 ? (crc >> 1) ^ 0xa001 : crc >> 1;
+    }
+    return crc ^ 0xffff;
+}
+
+/* Builds a token packet in p[3]. */
+static inline int usbWireToken(uint8_t *p, uint8_t pid, uint8_t addr, uint8_t endpoint)
+{
+    unsigned field = (addr & 0x7f) | ((endpoint & 0xf) << 7);
+
+    field |= usbWireCrc5(field) << 11;
+    p[0] = pid;
+    p[1] = field;
+    p[2] = field >> 8;
+    return 3;
+}
+
+/* Builds a data packet with len bytes of payload in p[len + 3]. */
+static inline int usbWireData(uint8_t *p, uint8_t pid, const uint8_t *data, int len)
+{
+    unsigned crc = usbWireCrc16(data, len);
+
+    p[0] = pid;
+    memcpy(p + 1, data, len);
+    p[len + 1] = crc;
+    p[len + 2] = crc >> 8;
+    return len + 3;
+}
+
+/* Returns nonzero if the CRC16 of a data packet of len bytes is good. */
+static inline int usbWireDataOk(const uint8_t *p, int len)
+{
+    unsigned crc;
+
+    if(len < 3)
+        return 0;
+    crc = usbWireCrc16(p + 1, len - 3);
+    return p[len - 2] == (crc & 0xff) && p[len - 1] == crc >> 8;
+}
+
+/* Time on the bus for SYNC, the packet and EOP, with the average amount of
+ * bit stuffing for random data (one stuff bit in 64).
+ */
+static inline simtime_t usbWirePacketNs(int len)
+{
+    int bits = 8 * (len + 1);
+
+    return (simtime_t)(bits + bits / 64 + USB_LS_EOP_BITS) * USB_LS_BIT_NS;
+}
+
+#endif /* __usbwire_h_included__ */
@@ -0,0 +1,246 @@
+#!/usr/bin/env python3
+# Name: paintcheck.py
+# Project: DigisparkWebUSB host tools
+# Tabsize: 4
+# License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+
+"""Assembles and runs the stack painting code of HW_CDC_STACK_CHECK.
+
+paintStack() in DigiWebUSB.cpp is naked inline assembler in .init3. It runs
+before .data and .bss are set up, and a mistake in it breaks every reset.
+This takes the assembler text out of the source, substitutes the canary
+for %0 as the "M" constraint does, assembles and links it for each part
+with _end and __stack set to the given layouts, and prints the code the
+linker placed in .init3. Then it runs that code on an SRAM image of random
+bytes and checks that exactly the bytes from _end to __stack got the
+canary and that the code reached its end.
+
+Either toolchain works: avr-as and avr-ld (from avr-gcc), or llvm-mc and
+ld.lld (LLVM 14 or later, with the AVR target).
+
+Usage: paintcheck.py [--mcu NAME] [--end ADDR ...] [--as PROG --ld PROG]
+"""
+
+import argparse
+import os
+import random
+import re
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+LIBRARY = os.path.normpath(os.path.join(os.path.dirname(__file__), '..', '..'))
+AVR_DATA_OFFSET = 0x800000
+
+# RAM start and RAMEND (the default __stack), and the emulation ISA of ld
+MCUS = {
+    'attiny85': (0x60, 0x25f, 'avr25'),
+    'attiny167': (0x100, 0x2ff, 'avr35'),
+}
+
+# layouts checked by default, as offsets of _end from RAM start (negative:
+# from __stack + 2): about 200 and 160 bytes of static data, _end just below
+# a 256 byte boundary, no free byte at all and a single one
+DEFAULT_ENDS = (0xc3, 0xa0, 0x100 - 1, -1, -2)
+
+
+class CheckError(Exception):
+    pass
+
+
+def paint_source(path):
+    """Returns the canary and the assembler text of paintStack()."""
+    with open(path, encoding='latin-1') as f:
+        text = f.read()
+    canary = re.search(r'#define STACK_CANARY (\w+)', text)
+    body = re.search(r'static void paintStack\(void\) \{\s*__asm__ __volatile__\('
+                     r'(.*?)::"M"\(STACK_CANARY\)\);', text, re.S)
+    if not canary or not body:
+        raise CheckError('%s: no paintStack() found' % path)
+    lines = re.findall(r'"(.*?)\\n"', body.group(1))
+    canary = int(canary.group(1), 0)
+    return canary, '\n'.join(lines).replace('%0', str(canary)) + '\n'
+
+
+def toolchain(args):
+    """Returns the assembler and linker commands without the files."""
+    if args.as_ and args.ld:
+        as_, ld = args.as_, args.ld
+    elif shutil.which('avr-as') and shutil.which('avr-ld'):
+        as_, ld = 'avr-as', 'avr-ld'
+    else:
+        as_ = shutil.which('llvm-mc') or shutil.which('llvm-mc-14')
+        ld = shutil.which('ld.lld') or shutil.which('ld.lld-14')
+        if not as_ or not ld:
+            raise CheckError('no AVR assembler and linker found, see --as/--ld')
+    return as_, ld
+
+
+def build(as_, ld, mcu, source, end, stack, tmp):
+    """Assembles and links the code and returns the .init3 section."""
+    asm = os.path.join(tmp, 'paint.s')
+    obj = os.path.join(tmp, 'paint.o')
+    elf = os.path.join(tmp, 'paint.elf')
+    with open(asm, 'w') as f:
+        f.write('    .section .init3,"ax",@progbits\n'
+                '    .global paintStack\npaintStack:\n' + source +
+                '    break\n')  # .init4 follows, the run stops here
+    if 'llvm-mc' in os.path.basename(as_):
+        cmd = [as_, '-triple=avr', '-mcpu=' + mcu, '-filetype=obj']
+    else:
+        cmd = [as_, '-mmcu=' + mcu]
+    run(cmd + [asm, '-o', obj])
+    cmd = [ld, '-e', 'paintStack', '-Ttext=0',
+           '--defsym=_end=0x%x' % (AVR_DATA_OFFSET + end),
+           '--defsym=__stack=0x%x' % (AVR_DATA_OFFSET + stack)]
+    if 'lld' not in os.path.basename(ld):
+        cmd += ['-m', MCUS[mcu][2]]
+    run(cmd + [obj, '-o', elf])
+    with open(elf, 'rb') as f:
+        return section(f.read(), '.init3')
+
+
+def run(cmd):
+    p = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                       universal_newlines=True)
+    if p.returncode != 0:
+        raise CheckError('%s failed:\n%s' % (cmd[0], p.stdout))
+
+
+def section(data, wanted):
+    shoff, = struct.unpack_from('<I', data, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from('<HHH', data, 0x2e)
+    sections = [struct.unpack_from('<IIIIIIIIII', data, shoff + i * shentsize)
+                for i in range(shnum)]
+    names = sections[shstrndx][4]
+    for s in sections:
+        start = names + s[0]
+        if data[start:data.index(b'\0', start)].decode() == wanted:
+            return data[s[4]:s[4] + s[5]]
+    raise CheckError('no %s section in the linked code' % wanted)
+
+
+def disassemble(words):
+    """Decodes the instructions paintStack() may use; anything else fails
+    the check. Returns a list of (mnemonic, operands, text)."""
+    out = []
+    for pc, w in enumerate(words):
+        if w & 0xf000 == 0xe000:
+            d, k = 16 + (w >> 4 & 15), (w >> 4 & 0xf0) | (w & 15)
+            out.append(('ldi', (d, k), 'ldi r%d, 0x%02x' % (d, k)))
+        elif w & 0xf000 == 0x3000:
+            d, k = 16 + (w >> 4 & 15), (w >> 4 & 0xf0) | (w & 15)
+            out.append(('cpi', (d, k), 'cpi r%d, 0x%02x' % (d, k)))
+        elif w & 0xfc00 == 0x0400:
+            d, r = w >> 4 & 31, (w & 15) | (w >> 5 & 16)
+            out.append(('cpc', (d, r), 'cpc r%d, r%d' % (d, r)))
+        elif w & 0xfe0f == 0x9201:
+            r = w >> 4 & 31
+            out.append(('st', (r,), 'st Z+, r%d' % r))
+        elif w & 0xf000 == 0xc000:
+            k = (w & 0xfff) - (0x1000 if w & 0x800 else 0)
+            out.append(('rjmp', (pc + 1 + k,), 'rjmp 0x%02x' % (2 * (pc + 1 + k))))
+        elif w & 0xfc07 == 0xf000:
+            k = (w >> 3 & 0x7f) - (0x80 if w & 0x200 else 0)
+            out.append(('brlo', (pc + 1 + k,), 'brlo 0x%02x' % (2 * (pc + 1 + k))))
+        elif w == 0x9598:
+            out.append(('break', (), 'break'))
+        else:
+            raise CheckError('unexpected opcode 0x%04x at 0x%02x' % (w, 2 * pc))
+    return out
+
+
+def execute(code, mem):
+    """Runs the decoded code on the SRAM image until the break and returns
+    the cycles it took."""
+    r = [0] * 32
+    pc = cycles = carry = 0
+    while True:
+        if cycles > 100000:
+            raise CheckError('the loop does not end')
+        op, ops, _ = code[pc]
+        pc += 1
+        if op == 'ldi':
+            r[ops[0]] = ops[1]
+            cycles += 1
+        elif op == 'cpi':
+            carry = r[ops[0]] < ops[1]
+            cycles += 1
+        elif op == 'cpc':
+            carry = r[ops[0]] < r[ops[1]] + carry
+            cycles += 1
+        elif op == 'st':
+            z = r[30] | r[31] << 8
+            if z >= len(mem):
+                raise CheckError('store to 0x%04x, above RAM' % z)
+            mem[z] = r[ops[0]]
+            r[30], r[31] = (z + 1) & 0xff, (z + 1) >> 8 & 0xff
+            cycles += 2
+        elif op == 'rjmp':
+            pc = ops[0]
+            cycles += 2
+        elif op == 'brlo':
+            if carry:
+                pc = ops[0]
+                cycles += 1
+            cycles += 1
+        elif op == 'break':
+            return cycles
+
+
+def check(as_, ld, mcu, canary, source, end, verbose, tmp):
+    ramstart, stack, _ = MCUS[mcu]
+    init3 = build(as_, ld, mcu, source, end, stack, tmp)
+    code = disassemble(struct.unpack('<%dH' % (len(init3) // 2), init3))
+    if verbose:
+        for pc, (_, _, text) in enumerate(code):
+            print('    %04x  %s' % (2 * pc, text))
+    mem = bytearray(random.getrandbits(8) for _ in range(stack + 1))
+    mem[end:] = bytes(b if b != canary else b ^ 0xff for b in mem[end:])
+    before = bytes(mem)
+    cycles = execute(code, mem)
+    painted = [a for a in range(len(mem)) if mem[a] != before[a]]
+    want = list(range(end, stack + 1))
+    ok = painted == want and all(mem[a] == canary for a in want)
+    print('%-9s _end 0x%03x __stack 0x%03x: %3d bytes painted in %4d cycles'
+          '  static %3d  %s' % (mcu, end, stack, len(painted), cycles,
+                                end - ramstart, 'ok' if ok else 'FAIL'))
+    return ok
+
+
+def main(argv=None):
+    ap = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    ap.add_argument('--mcu', choices=sorted(MCUS), action='append',
+                    help='part to check (default: all)')
+    ap.add_argument('--end', type=lambda s: int(s, 0), action='append',
+                    help='SRAM address of _end (default: several layouts)')
+    ap.add_argument('--as', dest='as_', help='assembler (avr-as or llvm-mc)')
+    ap.add_argument('--ld', help='linker (avr-ld or ld.lld)')
+    ap.add_argument('--source', default=os.path.join(LIBRARY, 'DigiWebUSB.cpp'))
+    ap.add_argument('-v', '--verbose', action='store_true',
+                    help='print the disassembly of .init3')
+    args = ap.parse_args(argv)
+    random.seed(1)
+    ok = True
+    try:
+        canary, source = paint_source(args.source)
+        as_, ld = toolchain(args)
+        with tempfile.TemporaryDirectory() as tmp:
+            for mcu in args.mcu or sorted(MCUS):
+                ramstart, stack, _ = MCUS[mcu]
+                ends = args.end or [ramstart + e if e >= 0 else stack + 2 + e
+                                    for e in DEFAULT_ENDS]
+                for end in ends:
+                    ok &= check(as_, ld, mcu, canary, source, end,
+                                args.verbose, tmp)
+    except (OSError, CheckError) as e:
+        print(e, file=sys.stderr)
+        return 2
+    print('PASS' if ok else 'FAIL')
+    return 0 if ok else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,225 @@
+#!/usr/bin/env python3
+# Name: ramcheck.py
+# Project: DigisparkWebUSB host tools
+# Tabsize: 4
+# License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+
+"""RAM breakdown of a linked sketch and budget check.
+
+Reads the symbol table of the sketch's ELF file (no binutils needed) and
+lists every object in .data, .bss and .noinit with its size. Each one is
+attributed to a source file:
+  - symbols local to a translation unit, by the STT_FILE entry before them
+    in the symbol table (not available with -flto),
+  - otherwise by name: a file scope definition in one of the library's
+    sources.
+Objects of the library's sources are listed one by one, everything else
+(Arduino core, sketch, avr-libc) is summed per file.
+
+The stack gets what is left between the end of the static data and the top
+of RAM (__stack). Two budgets can be checked, each fails the run if it is
+exceeded:
+  --budget BYTES   static RAM of the library
+  --stack BYTES    least room for the stack; the USB interrupt alone needs
+                   about 20 bytes on top of the sketch's deepest call
+
+Measure the stack the sketch actually uses with HW_CDC_STACK_CHECK and
+stackFree() or WL_REQUEST_GET_RAM on the device.
+
+Usage: ramcheck.py [--budget BYTES] [--stack BYTES] [--ram BYTES] sketch.elf
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+LIBRARY = os.path.normpath(os.path.join(os.path.dirname(__file__), '..', '..'))
+SOURCE_SUFFIXES = ('.c', '.cpp', '.h')
+RAM_SECTIONS = ('.data', '.bss', '.noinit')
+AVR_DATA_OFFSET = 0x800000  # data addresses in AVR ELF files
+DEFAULT_RAM = 512           # ATtiny85, 167 and 861
+
+STT_OBJECT, STT_FILE = 1, 4
+STB_LOCAL = 0
+
+
+class ElfError(Exception):
+    pass
+
+
+def read_elf(path):
+    """Returns the RAM sections as {name: (address, size)} and the symbols
+    as a list of (name, value, size, type, binding, section name), in the
+    order of the symbol table.
+    """
+    with open(path, 'rb') as f:
+        data = f.read()
+    if data[:4] != b'\x7fELF':
+        raise ElfError('%s: not an ELF file' % path)
+    is64 = data[4] == 2
+    end = '<' if data[5] == 1 else '>'
+    if is64:
+        shoff, = struct.unpack_from(end + 'Q', data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from(end + 'HHH', data, 0x3a)
+        shdr, sym = end + 'IIQQQQIIQQ', end + 'IBBHQQ'
+    else:
+        shoff, = struct.unpack_from(end + 'I', data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from(end + 'HHH', data, 0x2e)
+        shdr, sym = end + 'IIIIIIIIII', end + 'IIIBBH'
+    sections = [struct.unpack_from(shdr, data, shoff + i * shentsize)
+                for i in range(shnum)]
+
+    def string(table, offset):
+        start = sections[table][4] + offset
+        return data[start:data.index(b'\0', start)].decode('latin-1')
+
+    names = [string(shstrndx, s[0]) for s in sections]
+    ram = {}
+    for name, s in zip(names, sections):
+        if name in RAM_SECTIONS:
+            ram[name] = (s[3], s[5])
+    symbols = []
+    for s in sections:
+        if s[1] != 2:   # SHT_SYMTAB
+            continue
+        for offset in range(s[4], s[4] + s[5], s[9]):
+            if is64:
+                name, info, _, shndx, value, size = struct.unpack_from(sym, data, offset)
+            else:
+                name, value, size, info, _, shndx = struct.unpack_from(sym, data, offset)
+            section = names[shndx] if 0 < shndx < len(names) else ''
+            symbols.append((string(s[6], name), value, size, info & 0xf, info >> 4,
+                            section))
+    if not symbols:
+        raise ElfError('%s: no symbol table (stripped?)' % path)
+    return ram, symbols
+
+
+def library_definitions():
+    """Returns {name: source file} of the variables the library's sources
+    define at file scope.
+    """
+    declarator = re.compile(r'\**\s*(\w+)\s*(?:\[[^\]]*\]\s*)*(?:=|;|,|\{)')
+    definitions = {}
+    for name in sorted(os.listdir(LIBRARY)):
+        if not name.endswith(SOURCE_SUFFIXES):
+            continue
+        with open(os.path.join(LIBRARY, name), encoding='latin-1') as f:
+            for line in f:
+                if not line[:1].isalpha() or '(' in line.split('=')[0] \
+                        or line.startswith(('extern', 'typedef', 'return',
+                                            'struct', 'class', 'enum')):
+                    continue
+                # the words before the first declarator are the type
+                for m in declarator.finditer(line.split('=')[0] + ';'):
+                    definitions.setdefault(m.group(1), name)
+    return definitions
+
+
+def demangle(name):
+    """Shortens the C++ names of file and function statics (_ZL6buffer,
+    _ZZN...E9lineState) to the variable's name.
+    """
+    m = re.match(r'_Z(?:L|Z.*E)(\d+)(\w+)$', name)
+    if m and len(m.group(2)) >= int(m.group(1)):
+        return m.group(2)[:int(m.group(1))]
+    return name
+
+
+def attribute(symbols, definitions):
+    """Returns a list of (source file, library?, name, size) of the objects
+    in RAM.
+    """
+    sources = set(definitions.values())
+    objects = []
+    unit = None
+    for name, _, size, kind, binding, section in symbols:
+        if kind == STT_FILE:
+            unit = os.path.basename(name)
+            continue
+        if kind != STT_OBJECT or section not in RAM_SECTIONS or size == 0:
+            continue
+        name = demangle(name)
+        plain = name.split('.')[0]  # function statics get a numeric suffix
+        local = binding == STB_LOCAL and unit is not None
+        if local and unit in sources:
+            source = unit
+        elif plain in definitions and (not local or definitions[plain].endswith('.h')):
+            source = definitions[plain]
+        else:
+            source = unit if local else '(global)'
+        objects.append((source, source in sources, name, size))
+    return objects
+
+
+def report(path, ram, symbols, args):
+    objects = attribute(symbols, library_definitions())
+    mask = 0xffff if any(v >= AVR_DATA_OFFSET for v, _ in ram.values()) else ~0
+    start = min(v & mask for v, _ in ram.values()) if ram else 0
+    top = None
+    for name, value, _, _, _, _ in symbols:
+        if name == '__stack':
+            top = (value & mask) + 1
+    if top is None or args.ram:
+        top = start + (args.ram or DEFAULT_RAM)
+    static = max((v & mask) + n for v, n in ram.values()) - start if ram else 0
+    stack = top - start - static
+
+    library = sorted((o for o in objects if o[1]), key=lambda o: (o[0], -o[3], o[2]))
+    others = {}
+    for source, ours, _, size in objects:
+        if not ours:
+            others[source] = others.get(source, 0) + size
+    used = sum(o[3] for o in library)
+
+    print('%s: %d bytes of RAM from 0x%x' % (path, top - start, start))
+    print('  %-8s %6s' % ('section', 'bytes'))
+    for name in RAM_SECTIONS:
+        if name in ram:
+            print('  %-8s %6d' % (name, ram[name][1]))
+    print()
+    print('  %-16s %-28s %6s' % ('library file', 'object', 'bytes'))
+    for source, _, name, size in library:
+        print('  %-16s %-28s %6d' % (source, name, size))
+    print('  %-16s %-28s %6d' % ('', 'library total', used))
+    print()
+    for source in sorted(others, key=lambda s: -others[s]):
+        print('  %-45s %6d' % (source, others[source]))
+    print('  %-45s %6d' % ('not attributed (padding, untyped symbols)',
+                           static - sum(o[3] for o in objects)))
+    print()
+    print('  static data %d, left for the stack %d' % (static, stack))
+
+    failed = []
+    if args.budget is not None and used > args.budget:
+        failed.append('library %d > budget %d' % (used, args.budget))
+    if args.stack is not None and stack < args.stack:
+        failed.append('stack %d < %d' % (stack, args.stack))
+    if args.budget is not None or args.stack is not None:
+        print('FAIL (%s)' % ', '.join(failed) if failed else 'PASS')
+    return not failed
+
+
+def main(argv=None):
+    ap = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    ap.add_argument('elf', help='linked sketch (the .elf next to the .hex)')
+    ap.add_argument('--budget', type=int,
+                    help='most static RAM the library may use, in bytes')
+    ap.add_argument('--stack', type=int,
+                    help='least RAM left for the stack, in bytes')
+    ap.add_argument('--ram', type=int,
+                    help='RAM size if the ELF has no __stack (default %d)'
+                    % DEFAULT_RAM)
+    args = ap.parse_args(argv)
+    try:
+        ram, symbols = read_elf(args.elf)
+    except (OSError, ElfError, struct.error) as e:
+        print(e, file=sys.stderr)
+        return 2
+    return 0 if report(args.elf, ram, symbols, args) else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
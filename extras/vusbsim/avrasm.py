@@ -0,0 +1,386 @@
+# Name: avrasm.py
+# Project: DigisparkWebUSB host tools
+# Tabsize: 4
+# License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+
+"""Minimal GNU as front end for the V-USB assembler module.
+
+usbdrvasm.S is run through the C preprocessor exactly as avr-gcc would do it
+(with the shim headers in include/ standing in for avr-libc) and the result is
+parsed into a list of instructions at their flash addresses. Only the subset
+of the assembler used by usbdrvasm.S and the usbdrvasm*.inc modules is
+supported: labels, argument-less .macro/.endm, .byte, .balign, .global,
+.type, .text and the instructions of the AVRe core.
+
+Every instruction remembers the source file and line it came from and the
+comment that followed it, so that the hand-written ";[n]" cycle annotations
+can be checked by other tools.
+"""
+
+import collections
+import os
+import re
+import subprocess
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+REPO = os.path.normpath(os.path.join(HERE, '..', '..'))
+SHIM = os.path.join(HERE, 'include')
+
+# clock variants supported by usbdrvasm.S, in kHz
+CLOCKS_KHZ = (12000, 12800, 15000, 16000, 16500, 18000, 20000)
+
+# data objects referenced by the assembler module and defined in usbdrv.c
+# or osccal.c; everything not listed here is one byte
+USB_BUFSIZE = 11
+DATA_SIZES = {
+    'usbRxBuf': 2 * USB_BUFSIZE,
+    'usbTxBuf': USB_BUFSIZE,
+    'usbTxStatus1': 1 + USB_BUFSIZE,
+    'usbTxStatus3': 1 + USB_BUFSIZE,
+}
+
+# the parts with the USB interrupt on a pin change of D- (usbconfig.h): I/O
+# addresses of port B, the pending flag and timer 0, the D-/D+ bits and the
+# RAM, as in include/avr/io.h
+Mcu = collections.namedtuple('Mcu', 'name define pinb ddrb portb pending '
+                             'pending_bit tcnt0 dminus dplus ramstart ramend')
+MCUS = {
+    'attiny85': Mcu('attiny85', '__AVR_ATtiny85__', 0x16, 0x17, 0x18,
+                    0x3a, 5, 0x32, 3, 4, 0x60, 0x25f),      # GIFR, PCIF
+    'attiny167': Mcu('attiny167', '__AVR_ATtiny167__', 0x03, 0x04, 0x05,
+                     0x1b, 1, 0x26, 3, 6, 0x100, 0x2ff),    # PCIFR, PCIF1
+}
+DEFAULT_MCU = 'attiny85'
+
+REG_ALIASES = {'xl': 26, 'xh': 27, 'yl': 28, 'yh': 29, 'zl': 30, 'zh': 31}
+
+# instructions occupying two flash words
+LONG_INSNS = ('lds', 'sts', 'jmp', 'call')
+
+
+class AsmError(Exception):
+    pass
+
+
+class Insn(object):
+    """One instruction at a flash word address."""
+
+    __slots__ = ('addr', 'mnem', 'args', 'ops', 'size', 'file', 'line',
+                 'comment', 'labels', 'text')
+
+    def __init__(self, mnem, args, file, line, comment, text):
+        self.addr = 0
+        self.mnem = mnem
+        self.args = args            # operand source strings
+        self.ops = None             # resolved operands, see Program.resolve()
+        self.size = 2 if mnem in LONG_INSNS else 1
+        self.file = file
+        self.line = line
+        self.comment = comment
+        self.labels = []
+        self.text = text
+
+    def where(self):
+        return '%s:%d' % (os.path.basename(self.file), self.line)
+
+    def __repr__(self):
+        return '%04x %s %s' % (self.addr * 2, self.mnem, ', '.join(self.args))
+
+
+class Program(object):
+    """Assembled image of usbdrvasm.S for one clock variant and part."""
+
+    def __init__(self, clock_khz, mcu=DEFAULT_MCU):
+        self.clock_khz = clock_khz
+        self.mcu = MCUS[mcu]
+        self.insns = {}             # word address -> Insn
+        self.order = []             # instructions in flash order
+        self.flash = bytearray(0x2000)
+        self.labels = {}            # label -> byte address in flash
+        self.data = {}              # extern data object -> SRAM address
+        self.data_end = self.mcu.ramstart
+        self.macros = {}
+
+    # ---- symbols
+
+    def symbol(self, name):
+        if name in self.labels:
+            return self.labels[name]
+        if name not in self.data:
+            self.data[name] = self.data_end
+            self.data_end += DATA_SIZES.get(name, 1)
+        return self.data[name]
+
+    def label_insn(self, name):
+        return self.insns[self.labels[name] // 2]
+
+    def isr_range(self):
+        """Word address range of the interrupt handler, which is everything
+        from the vector label to the end of the code."""
+        start = self.labels[self.vector] // 2
+        end = max(self.insns) + 1
+        return start, end
+
+    # ---- expressions
+
+    _tok = re.compile(r'\s*(0[xX][0-9a-fA-F]+[uUlL]*|\d+[uUlL]*'
+                      r'|[A-Za-z_.][A-Za-z0-9_.]*'
+                      r'|<<|>>|==|!=|<=|>=|&&|\|\||.)')
+
+    def eval(self, expr, pc=None):
+        out = []
+        relative = False
+        for tok in self._tok.findall(expr):
+            if not tok.strip():
+                continue
+            if tok[0].isdigit():
+                out.append(str(int(tok.rstrip('uUlL'), 0)))
+            elif tok == '.':
+                if pc is None:
+                    raise AsmError('"." outside of instruction: ' + expr)
+                # GNU as for AVR: ".+k" in a branch is relative to the next
+                # instruction
+                out.append(str(pc * 2 + 2))
+                relative = True
+            elif tok in ('lo8', 'hi8'):
+                out.append('_' + tok)
+            elif tok[0].isalpha() or tok[0] in '_.':
+                out.append(str(self.symbol(tok)))
+            elif tok == '/':
+                out.append('//')
+            elif tok == '!':
+                out.append(' not ')
+            elif tok == '&&':
+                out.append(' and ')
+            elif tok == '||':
+                out.append(' or ')
+            else:
+                out.append(tok)
+        try:
+            value = eval(''.join(out), {'__builtins__': {}},
+                         {'_lo8': lambda v: v & 0xff,
+                          '_hi8': lambda v: (v >> 8) & 0xff})
+        except Exception as e:
+            raise AsmError('cannot evaluate "%s": %s' % (expr, e))
+        return int(value), relative
+
+    # ---- operand resolution
+
+    def reg(self, arg):
+        a = arg.strip().lower()
+        if a in REG_ALIASES:
+            return REG_ALIASES[a]
+        m = re.match(r'^r(\d+)$', a)
+        if not m or int(m.group(1)) > 31:
+            raise AsmError('not a register: ' + arg)
+        return int(m.group(1))
+
+    def ptr(self, arg):
+        """Returns (pointer register, predecrement, postincrement, q)."""
+        a = arg.replace(' ', '').lower()
+        pre = a.startswith('-')
+        a = a.lstrip('-')
+        base = {'x': 26, 'y': 28, 'z': 30}.get(a[:1])
+        if base is None:
+            raise AsmError('not a pointer: ' + arg)
+        rest = a[1:]
+        if rest == '':
+            return base, pre, False, 0
+        if rest == '+':
+            return base, pre, True, 0
+        if rest.startswith('+'):
+            return base, False, False, self.eval(rest[1:])[0]
+        raise AsmError('bad pointer operand: ' + arg)
+
+    def target(self, insn, arg):
+        value, relative = self.eval(arg, insn.addr)
+        if value & 1:
+            raise AsmError('odd branch target at ' + insn.where())
+        return value // 2
+
+    def resolve(self, insn):
+        m = insn.mnem
+        a = insn.args
+        if m in ('rjmp', 'rcall', 'jmp', 'call'):
+            ops = (self.target(insn, a[0]),)
+        elif m in ('breq', 'brne', 'brcs', 'brcc', 'brlo', 'brsh', 'brmi',
+                   'brpl', 'brge', 'brlt', 'brts', 'brtc', 'brvs', 'brvc',
+                   'brhs', 'brhc', 'brie', 'brid'):
+            ops = (self.target(insn, a[0]),)
+        elif m in ('ldi', 'andi', 'ori', 'subi', 'sbci', 'cpi', 'cbr', 'sbr',
+                   'adiw', 'sbiw', 'sbrc', 'sbrs', 'bst', 'bld'):
+            ops = (self.reg(a[0]), self.eval(a[1])[0])
+        elif m == 'in':
+            ops = (self.reg(a[0]), self.eval(a[1])[0])
+        elif m == 'out':
+            ops = (self.eval(a[0])[0], self.reg(a[1]))
+        elif m in ('sbi', 'cbi', 'sbis', 'sbic'):
+            ops = (self.eval(a[0])[0], self.eval(a[1])[0])
+        elif m == 'lds':
+            ops = (self.reg(a[0]), self.eval(a[1])[0])
+        elif m == 'sts':
+            ops = (self.eval(a[0])[0], self.reg(a[1]))
+        elif m in ('ld', 'ldd'):
+            ops = (self.reg(a[0]),) + self.ptr(a[1])
+        elif m in ('st', 'std'):
+            ops = self.ptr(a[0]) + (self.reg(a[1]),)
+        elif m == 'lpm':
+            if not a:
+                ops = (0, False)
+            else:
+                ops = (self.reg(a[0]), a[1].replace(' ', '').lower() == 'z+')
+        elif m in ('push', 'pop', 'inc', 'dec', 'clr', 'ser', 'tst', 'lsl',
+                   'lsr', 'rol', 'ror', 'asr', 'com', 'neg', 'swap'):
+            ops = (self.reg(a[0]),)
+        elif m in ('mov', 'add', 'adc', 'sub', 'sbc', 'and', 'or', 'eor',
+                   'cp', 'cpc', 'cpse', 'movw'):
+            ops = (self.reg(a[0]), self.reg(a[1]))
+        elif m in ('nop', 'ret', 'reti', 'sec', 'clc', 'sei', 'cli', 'set',
+                   'clt', 'sez', 'clz'):
+            ops = ()
+        else:
+            raise AsmError('unsupported instruction "%s" at %s'
+                           % (m, insn.where()))
+        insn.ops = ops
+
+
+_linemarker = re.compile(r'^#\s*(\d+)\s+"([^"]*)"')
+_label = re.compile(r'^\s*([A-Za-z_.][A-Za-z0-9_.]*)\s*:(.*)$')
+
+
+def _split_args(text):
+    args, depth, cur = [], 0, ''
+    for ch in text:
+        if ch == ',' and depth == 0:
+            args.append(cur.strip())
+            cur = ''
+            continue
+        if ch == '(':
+            depth += 1
+        elif ch == ')':
+            depth -= 1
+        cur += ch
+    if cur.strip():
+        args.append(cur.strip())
+    return args
+
+
+def preprocess(clock_khz, repo=REPO, defines=(), mcu=DEFAULT_MCU):
+    """Runs usbdrvasm.S through cpp for the given clock and part and returns
+    the preprocessed text, with line markers."""
+    cmd = ['cpp', '-x', 'assembler-with-cpp', '-D__ASSEMBLER__',
+           '-D' + MCUS[mcu].define, '-DF_CPU=%dUL' % (clock_khz * 1000),
+           '-I', SHIM, '-I', repo]
+    cmd += ['-D' + d for d in defines]
+    cmd.append(os.path.join(repo, 'usbdrvasm.S'))
+    p = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                       universal_newlines=True)
+    if p.returncode != 0:
+        raise AsmError('cpp failed for %d kHz:\n%s' % (clock_khz, p.stderr))
+    return p.stdout
+
+
+def _lines(text):
+    """Yields (file, line, code, comment) for every source line."""
+    file, line = '?', 0
+    for raw in text.split('\n'):
+        m = _linemarker.match(raw)
+        if m:
+            line = int(m.group(1))
+            file = m.group(2)
+            continue
+        code, _, comment = raw.partition(';')
+        yield file, line, code.rstrip(), comment.strip()
+        line += 1
+
+
+def assemble(clock_khz, repo=REPO, defines=(), mcu=DEFAULT_MCU):
+    prog = Program(clock_khz, mcu)
+    text = preprocess(clock_khz, repo, defines, mcu)
+    lines = list(_lines(text))
+
+    # pass 1: collect macros
+    body = []
+    stream = []
+    current = None
+    for file, line, code, comment in lines:
+        words = code.split()
+        if words and words[0] == '.macro':
+            current = words[1]
+            prog.macros[current] = []
+            continue
+        if words and words[0] == '.endm':
+            current = None
+            continue
+        if current is not None:
+            prog.macros[current].append((file, line, code, comment))
+        else:
+            stream.append((file, line, code, comment))
+
+    # expand macro invocations (macros do not nest in this code)
+    for file, line, code, comment in stream:
+        words = code.split()
+        if len(words) == 1 and words[0] in prog.macros:
+            body.extend(prog.macros[words[0]])
+        else:
+            body.append((file, line, code, comment))
+
+    # pass 2: lay out code and data
+    pc = 0                          # byte address
+    pending = []
+    for file, line, code, comment in body:
+        while True:
+            m = _label.match(code)
+            if not m:
+                break
+            pending.append(m.group(1))
+            prog.labels[m.group(1)] = pc
+            code = m.group(2)
+        code = code.strip()
+        if not code:
+            continue
+        words = code.split(None, 1)
+        op = words[0].lower()
+        rest = words[1] if len(words) > 1 else ''
+        if op in ('.text', '.global', '.globl', '.type', '.section'):
+            if op in ('.global', '.globl') and rest.startswith('__vector_'):
+                prog.vector = rest.strip()
+            continue
+        if op == '.balign':
+            align = int(rest, 0)
+            pc = (pc + align - 1) // align * align
+            for name in pending:
+                prog.labels[name] = pc
+            continue
+        if op == '.byte':
+            for arg in _split_args(rest):
+                prog.flash[pc] = prog.eval(arg)[0] & 0xff
+                pc += 1
+            pending = []
+            continue
+        if op.startswith('.'):
+            raise AsmError('unsupported directive %s at %s:%d'
+                           % (op, file, line))
+        if pc & 1:
+            pc += 1
+        insn = Insn(op, _split_args(rest), file, line, comment, code)
+        insn.addr = pc // 2
+        insn.labels = pending
+        pending = []
+        prog.insns[insn.addr] = insn
+        prog.order.append(insn)
+        pc += insn.size * 2
+
+    # pass 3: resolve operands now that all labels are known
+    for insn in prog.order:
+        prog.resolve(insn)
+    return prog
+
+
+if __name__ == '__main__':
+    import sys
+    for khz in [int(a) for a in sys.argv[1:]] or CLOCKS_KHZ:
+        p = assemble(khz)
+        lo, hi = p.isr_range()
+        print('%5d kHz: %d instructions, ISR %d words, data %s'
+              % (khz, len(p.order), hi - lo, sorted(p.data)))
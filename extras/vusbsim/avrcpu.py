@@ -0,0 +1,580 @@
+# Name: avrcpu.py
+# Project: DigisparkWebUSB host tools
+# Tabsize: 4
+# License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+
+"""Instruction level model of the AVRe core found in the ATtiny85 and 167.
+
+Registers, I/O space and SRAM share one data address space as on the real
+part (the V-USB transmitter relies on that: it sends handshakes out of r0
+through the Y pointer). Cycle counts follow the ATtiny25/45/85 instruction
+set summary. I/O accesses to the port and the interrupt flag register are
+handed to a Board object so that the caller can model the USB lines.
+"""
+
+IO_BASE = 0x20
+
+# I/O addresses handled by the core itself
+SREG, SPL, SPH = 0x3f, 0x3d, 0x3e
+
+C, Z, N, V, S, H, T, I = [1 << b for b in range(8)]
+
+# word address pushed when entering the interrupt from the idle main loop
+MAIN_LOOP = 0xfff
+
+
+class CpuError(Exception):
+    pass
+
+
+class Board(object):
+    """Default peripherals: plain memory. Subclasses model the USB port."""
+
+    def io_read(self, cpu, io):
+        return cpu.mem[IO_BASE + io]
+
+    def io_write(self, cpu, io, value):
+        cpu.mem[IO_BASE + io] = value
+
+
+class Cpu(object):
+
+    def __init__(self, prog, board=None):
+        self.prog = prog
+        self.board = board or Board()
+        self.mem = bytearray(prog.mcu.ramend + 1)
+        self.pc = MAIN_LOOP
+        self.sreg = 0
+        self.sp = prog.mcu.ramend
+        self.cycle = 0
+        self.executed = {}          # word address -> execution count
+        self.trace = None           # optional callable(cpu, insn, cycles)
+        self.handlers = {}
+        for insn in prog.order:
+            fn = getattr(self, 'op_' + insn.mnem, None)
+            if fn is None:
+                raise CpuError('no model for "%s" at %s'
+                               % (insn.mnem, insn.where()))
+            self.handlers[insn.addr] = fn
+
+    # ---- data space
+
+    def read(self, addr):
+        if IO_BASE <= addr < IO_BASE + 0x40:
+            return self.in_io(addr - IO_BASE)
+        return self.mem[addr]
+
+    def write(self, addr, value):
+        value &= 0xff
+        if IO_BASE <= addr < IO_BASE + 0x40:
+            self.out_io(addr - IO_BASE, value)
+        else:
+            self.mem[addr] = value
+
+    def in_io(self, io):
+        if io == SREG:
+            return self.sreg
+        if io == SPL:
+            return self.sp & 0xff
+        if io == SPH:
+            return self.sp >> 8
+        if io == self.prog.mcu.tcnt0:
+            return (self.cycle >> 6) & 0xff     # prescaler 64
+        return self.board.io_read(self, io)
+
+    def out_io(self, io, value):
+        if io == SREG:
+            self.sreg = value
+        elif io == SPL:
+            self.sp = (self.sp & 0xff00) | value
+        elif io == SPH:
+            self.sp = (self.sp & 0xff) | (value << 8)
+        else:
+            self.board.io_write(self, io, value)
+
+    def push(self, value):
+        self.mem[self.sp] = value & 0xff
+        self.sp -= 1
+
+    def pop(self):
+        self.sp += 1
+        return self.mem[self.sp]
+
+    def word(self, r):
+        return self.mem[r] | (self.mem[r + 1] << 8)
+
+    def set_word(self, r, value):
+        self.mem[r] = value & 0xff
+        self.mem[r + 1] = (value >> 8) & 0xff
+
+    # ---- execution
+
+    def interrupt(self, vector):
+        """Enters the interrupt handler at the given label. The caller
+        accounts for the response time."""
+        self.push(self.pc & 0xff)
+        self.push(self.pc >> 8)
+        self.sreg &= ~I
+        self.pc = self.prog.labels[vector] // 2
+
+    def step(self):
+        """Executes one instruction and returns its cycle count."""
+        pc = self.pc
+        insn = self.prog.insns.get(pc)
+        if insn is None:
+            raise CpuError('execution left the code at 0x%04x' % (pc * 2))
+        self.executed[pc] = self.executed.get(pc, 0) + 1
+        self.pc = pc + insn.size
+        cycles = self.handlers[pc](insn.ops)
+        if self.trace:
+            self.trace(self, insn, cycles)
+        self.cycle += cycles
+        return cycles
+
+    def skip(self):
+        nxt = self.prog.insns.get(self.pc)
+        self.pc += nxt.size
+        return 1 + nxt.size
+
+    # ---- flag helpers
+
+    def _flags(self, mask, bits):
+        self.sreg = (self.sreg & ~mask) | bits
+
+    def _logic(self, r):
+        f = 0
+        if r == 0:
+            f |= Z
+        if r & 0x80:
+            f |= N | S
+        self._flags(Z | N | V | S, f)
+
+    def _add(self, a, b, carry):
+        r = a + b + carry
+        f = 0
+        if r & 0x100:
+            f |= C
+        r &= 0xff
+        if r == 0:
+            f |= Z
+        if r & 0x80:
+            f |= N
+        if (~(a ^ b) & (a ^ r)) & 0x80:
+            f |= V
+        if ((a & 0xf) + (b & 0xf) + carry) & 0x10:
+            f |= H
+        if bool(f & N) != bool(f & V):
+            f |= S
+        self._flags(C | Z | N | V | S | H, f)
+        return r
+
+    def _sub(self, a, b, carry, keep_z):
+        r = (a - b - carry) & 0xff
+        f = 0
+        if a < b + carry:
+            f |= C
+        if r == 0:
+            if not keep_z or self.sreg & Z:
+                f |= Z
+        if r & 0x80:
+            f |= N
+        if ((a ^ b) & (a ^ r)) & 0x80:
+            f |= V
+        if (a & 0xf) < (b & 0xf) + carry:
+            f |= H
+        if bool(f & N) != bool(f & V):
+            f |= S
+        self._flags(C | Z | N | V | S | H, f)
+        return r
+
+    def _shift_flags(self, r, c):
+        f = C if c else 0
+        if r == 0:
+            f |= Z
+        if r & 0x80:
+            f |= N
+        if bool(f & N) != bool(c):
+            f |= V
+        if bool(f & N) != bool(f & V):
+            f |= S
+        self._flags(C | Z | N | V | S, f)
+
+    def _branch(self, cond, target):
+        if cond:
+            self.pc = target
+            return 2
+        return 1
+
+    # ---- instructions
+
+    def op_nop(self, ops):
+        return 1
+
+    def op_rjmp(self, ops):
+        self.pc = ops[0]
+        return 2
+
+    def op_jmp(self, ops):
+        self.pc = ops[0]
+        return 3
+
+    def op_rcall(self, ops):
+        self.push(self.pc & 0xff)
+        self.push(self.pc >> 8)
+        self.pc = ops[0]
+        return 3
+
+    def op_call(self, ops):
+        self.push(self.pc & 0xff)
+        self.push(self.pc >> 8)
+        self.pc = ops[0]
+        return 4
+
+    def op_ret(self, ops):
+        hi = self.pop()
+        self.pc = (hi << 8) | self.pop()
+        return 4
+
+    def op_reti(self, ops):
+        self.sreg |= I
+        return self.op_ret(ops)
+
+    def op_breq(self, ops):
+        return self._branch(self.sreg & Z, ops[0])
+
+    def op_brne(self, ops):
+        return self._branch(not self.sreg & Z, ops[0])
+
+    def op_brcs(self, ops):
+        return self._branch(self.sreg & C, ops[0])
+
+    op_brlo = op_brcs
+
+    def op_brcc(self, ops):
+        return self._branch(not self.sreg & C, ops[0])
+
+    op_brsh = op_brcc
+
+    def op_brmi(self, ops):
+        return self._branch(self.sreg & N, ops[0])
+
+    def op_brpl(self, ops):
+        return self._branch(not self.sreg & N, ops[0])
+
+    def op_brlt(self, ops):
+        return self._branch(self.sreg & S, ops[0])
+
+    def op_brge(self, ops):
+        return self._branch(not self.sreg & S, ops[0])
+
+    def op_brts(self, ops):
+        return self._branch(self.sreg & T, ops[0])
+
+    def op_brtc(self, ops):
+        return self._branch(not self.sreg & T, ops[0])
+
+    def op_sbrc(self, ops):
+        if self.mem[ops[0]] & (1 << ops[1]):
+            return 1
+        return self.skip()
+
+    def op_sbrs(self, ops):
+        if self.mem[ops[0]] & (1 << ops[1]):
+            return self.skip()
+        return 1
+
+    def op_sbic(self, ops):
+        if self.in_io(ops[0]) & (1 << ops[1]):
+            return 1
+        return self.skip()
+
+    def op_sbis(self, ops):
+        if self.in_io(ops[0]) & (1 << ops[1]):
+            return self.skip()
+        return 1
+
+    def op_cpse(self, ops):
+        if self.mem[ops[0]] == self.mem[ops[1]]:
+            return self.skip()
+        return 1
+
+    def op_in(self, ops):
+        self.mem[ops[0]] = self.in_io(ops[1])
+        return 1
+
+    def op_out(self, ops):
+        self.out_io(ops[0], self.mem[ops[1]])
+        return 1
+
+    def op_sbi(self, ops):
+        self.cycle += 1             # the write happens in the second cycle
+        self.out_io(ops[0], self.in_io(ops[0]) | (1 << ops[1]))
+        self.cycle -= 1
+        return 2
+
+    def op_cbi(self, ops):
+        self.cycle += 1
+        self.out_io(ops[0], self.in_io(ops[0]) & ~(1 << ops[1]) & 0xff)
+        self.cycle -= 1
+        return 2
+
+    def op_lds(self, ops):
+        self.mem[ops[0]] = self.read(ops[1])
+        return 2
+
+    def op_sts(self, ops):
+        self.write(ops[0], self.mem[ops[1]])
+        return 2
+
+    def _ptr(self, base, pre, post, q):
+        addr = self.word(base)
+        if pre:
+            addr = (addr - 1) & 0xffff
+            self.set_word(base, addr)
+        elif post:
+            self.set_word(base, addr + 1)
+        return addr + q
+
+    def op_ld(self, ops):
+        d, base, pre, post, q = ops
+        self.mem[d] = self.read(self._ptr(base, pre, post, q))
+        return 2
+
+    op_ldd = op_ld
+
+    def op_st(self, ops):
+        base, pre, post, q, r = ops
+        self.write(self._ptr(base, pre, post, q), self.mem[r])
+        return 2
+
+    op_std = op_st
+
+    def op_lpm(self, ops):
+        z = self.word(30)
+        self.mem[ops[0]] = self.prog.flash[z % len(self.prog.flash)]
+        if ops[1]:
+            self.set_word(30, z + 1)
+        return 3
+
+    def op_push(self, ops):
+        self.push(self.mem[ops[0]])
+        return 2
+
+    def op_pop(self, ops):
+        self.mem[ops[0]] = self.pop()
+        return 2
+
+    def op_ldi(self, ops):
+        self.mem[ops[0]] = ops[1] & 0xff
+        return 1
+
+    def op_ser(self, ops):
+        self.mem[ops[0]] = 0xff
+        return 1
+
+    def op_mov(self, ops):
+        self.mem[ops[0]] = self.mem[ops[1]]
+        return 1
+
+    def op_movw(self, ops):
+        self.set_word(ops[0], self.word(ops[1]))
+        return 1
+
+    def op_clr(self, ops):
+        self.mem[ops[0]] = 0
+        self._logic(0)
+        return 1
+
+    def op_tst(self, ops):
+        self._logic(self.mem[ops[0]])
+        return 1
+
+    def _logic_op(self, d, r):
+        self.mem[d] = r & 0xff
+        self._logic(r & 0xff)
+        return 1
+
+    def op_and(self, ops):
+        return self._logic_op(ops[0], self.mem[ops[0]] & self.mem[ops[1]])
+
+    def op_andi(self, ops):
+        return self._logic_op(ops[0], self.mem[ops[0]] & ops[1])
+
+    def op_cbr(self, ops):
+        return self._logic_op(ops[0], self.mem[ops[0]] & ~ops[1])
+
+    def op_or(self, ops):
+        return self._logic_op(ops[0], self.mem[ops[0]] | self.mem[ops[1]])
+
+    def op_ori(self, ops):
+        return self._logic_op(ops[0], self.mem[ops[0]] | ops[1])
+
+    op_sbr = op_ori
+
+    def op_eor(self, ops):
+        return self._logic_op(ops[0], self.mem[ops[0]] ^ self.mem[ops[1]])
+
+    def op_com(self, ops):
+        r = ~self.mem[ops[0]] & 0xff
+        self.mem[ops[0]] = r
+        self._logic(r)
+        self.sreg |= C
+        return 1
+
+    def op_neg(self, ops):
+        self.mem[ops[0]] = self._sub(0, self.mem[ops[0]], 0, False)
+        return 1
+
+    def op_add(self, ops):
+        self.mem[ops[0]] = self._add(self.mem[ops[0]], self.mem[ops[1]], 0)
+        return 1
+
+    def op_adc(self, ops):
+        self.mem[ops[0]] = self._add(self.mem[ops[0]], self.mem[ops[1]],
+                                     self.sreg & C)
+        return 1
+
+    def op_lsl(self, ops):
+        return self.op_add((ops[0], ops[0]))
+
+    def op_rol(self, ops):
+        return self.op_adc((ops[0], ops[0]))
+
+    def op_sub(self, ops):
+        self.mem[ops[0]] = self._sub(self.mem[ops[0]], self.mem[ops[1]], 0,
+                                     False)
+        return 1
+
+    def op_subi(self, ops):
+        self.mem[ops[0]] = self._sub(self.mem[ops[0]], ops[1] & 0xff, 0,
+                                     False)
+        return 1
+
+    def op_sbc(self, ops):
+        self.mem[ops[0]] = self._sub(self.mem[ops[0]], self.mem[ops[1]],
+                                     self.sreg & C, True)
+        return 1
+
+    def op_sbci(self, ops):
+        self.mem[ops[0]] = self._sub(self.mem[ops[0]], ops[1] & 0xff,
+                                     self.sreg & C, True)
+        return 1
+
+    def op_cp(self, ops):
+        self._sub(self.mem[ops[0]], self.mem[ops[1]], 0, False)
+        return 1
+
+    def op_cpc(self, ops):
+        self._sub(self.mem[ops[0]], self.mem[ops[1]], self.sreg & C, True)
+        return 1
+
+    def op_cpi(self, ops):
+        self._sub(self.mem[ops[0]], ops[1] & 0xff, 0, False)
+        return 1
+
+    def op_inc(self, ops):
+        r = (self.mem[ops[0]] + 1) & 0xff
+        self.mem[ops[0]] = r
+        f = (Z if r == 0 else 0) | (N if r & 0x80 else 0) \
+            | (V if r == 0x80 else 0)
+        if bool(f & N) != bool(f & V):
+            f |= S
+        self._flags(Z | N | V | S, f)
+        return 1
+
+    def op_dec(self, ops):
+        r = (self.mem[ops[0]] - 1) & 0xff
+        self.mem[ops[0]] = r
+        f = (Z if r == 0 else 0) | (N if r & 0x80 else 0) \
+            | (V if r == 0x7f else 0)
+        if bool(f & N) != bool(f & V):
+            f |= S
+        self._flags(Z | N | V | S, f)
+        return 1
+
+    def op_lsr(self, ops):
+        a = self.mem[ops[0]]
+        r = a >> 1
+        self.mem[ops[0]] = r
+        self._shift_flags(r, a & 1)
+        return 1
+
+    def op_ror(self, ops):
+        a = self.mem[ops[0]]
+        r = (a >> 1) | (0x80 if self.sreg & C else 0)
+        self.mem[ops[0]] = r
+        self._shift_flags(r, a & 1)
+        return 1
+
+    def op_asr(self, ops):
+        a = self.mem[ops[0]]
+        r = (a >> 1) | (a & 0x80)
+        self.mem[ops[0]] = r
+        self._shift_flags(r, a & 1)
+        return 1
+
+    def op_swap(self, ops):
+        a = self.mem[ops[0]]
+        self.mem[ops[0]] = ((a << 4) | (a >> 4)) & 0xff
+        return 1
+
+    def op_adiw(self, ops):
+        a = self.word(ops[0])
+        r = a + ops[1]
+        self.set_word(ops[0], r)
+        self._word_flags(a, r & 0xffff, r > 0xffff,
+                         not a & 0x8000 and r & 0x8000)
+        return 2
+
+    def op_sbiw(self, ops):
+        a = self.word(ops[0])
+        r = (a - ops[1]) & 0xffff
+        self.set_word(ops[0], r)
+        self._word_flags(a, r, a < ops[1], a & 0x8000 and not r & 0x8000)
+        return 2
+
+    def _word_flags(self, a, r, carry, overflow):
+        f = (C if carry else 0) | (Z if r == 0 else 0) \
+            | (N if r & 0x8000 else 0) | (V if overflow else 0)
+        if bool(f & N) != bool(f & V):
+            f |= S
+        self._flags(C | Z | N | V | S, f)
+
+    def op_bst(self, ops):
+        if self.mem[ops[0]] & (1 << ops[1]):
+            self.sreg |= T
+        else:
+            self.sreg &= ~T
+        return 1
+
+    def op_bld(self, ops):
+        m = 1 << ops[1]
+        if self.sreg & T:
+            self.mem[ops[0]] |= m
+        else:
+            self.mem[ops[0]] &= ~m & 0xff
+        return 1
+
+    def op_sec(self, ops):
+        self.sreg |= C
+        return 1
+
+    def op_clc(self, ops):
+        self.sreg &= ~C
+        return 1
+
+    def op_set(self, ops):
+        self.sreg |= T
+        return 1
+
+    def op_clt(self, ops):
+        self.sreg &= ~T
+        return 1
+
+    def op_sei(self, ops):
+        self.sreg |= I
+        return 1
+
+    def op_cli(self, ops):
+        self.sreg &= ~I
+        return 1
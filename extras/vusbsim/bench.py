@@ -0,0 +1,377 @@
+#!/usr/bin/env python3
+# Name: bench.py
+# Project: DigisparkWebUSB host tools
+# Tabsize: 4
+# License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+
+"""CPU headroom and throughput of the clock variants under bus load.
+
+A host traffic pattern is played against a model of the device for a number
+of 1 ms frames. Each frame starts with the keep-alive, followed by the bulk
+IN and OUT transactions of the pattern on endpoint 1. The device side
+follows DigiWebUSBDevice: the sketch calls usbPollWrapper() every poll
+interval (refresh() and delay() do so about once per millisecond), which
+runs usbPoll(), moves received bytes into the rx ring through
+usbFunctionWriteOut(), and loads the next IN packet with usbSetInterrupt(),
+sending a zero sized packet after each data packet.
+
+Cycles come from two sources:
+  - the interrupt handler is measured: every kind of transaction is run
+    once through isrsim.py on the assembled usbdrvasm.S of the variant,
+    from taking the interrupt to reti, including the time the handler
+    waits for the following packets of the transaction. usbCrc16Append()
+    is measured the same way.
+  - the C code of usbPoll() and the DigiWebUSBDevice wrappers is not
+    simulated. Its cost is taken from the table C_COSTS below, estimates
+    for avr-gcc -Os that have not been measured on a device and can be
+    replaced with measured values (--cost). The columns that depend on
+    them are marked "~" in the report. These costs are in cycles and do not
+    depend on the clock.
+
+For each variant the report gives the fraction of the CPU spent in the USB
+interrupt, in usbPoll() and in the wrappers, what is left for the sketch,
+and the payload bytes per second moved in each direction. Busy waiting in
+refresh() and write() is not counted as load; --write-ms models the pacing
+of DigiWebUSBDevice::write().
+
+Usage: bench.py [--clock KHZ ...] [--pattern idle|in|out|both]
+                [--per-frame N] [--size N] [--poll-us US] [--frames N]
+                [--write-ms MS] [--cost NAME=CYCLES ...]
+"""
+
+import argparse
+import sys
+
+import avrasm
+import avrcpu
+import isrsim
+import usbwire
+
+FRAME = 1e-3
+FRAME_BUDGET = 0.9          # part of a frame the host schedules transfers in
+TXN_GAP = 4                 # bit times between transactions of the host
+RX_RING = 32                # HW_CDC_RX_BUF_SIZE
+TX_RING = 32                # HW_CDC_TX_BUF_SIZE
+PACKET = 8                  # HW_CDC_BULK_IN_SIZE, HW_CDC_BULK_OUT_SIZE
+
+# cycles of the C side, not simulated
+C_COSTS = {
+    'poll': 45,             # usbPoll() with nothing to do, call and reset check
+    'poll-rx': 60,          # usbPoll() handing a packet to usbFunctionWriteOut()
+    'writeout-byte': 50,    # RingBuffer_IsFull() and _Insert() per byte
+    'wrapper': 120,         # usbPollWrapper() around usbPoll(), with
+                            # updateDeviceState() and millis()
+    'wrapper-byte': 45,     # RingBuffer_Remove() into tmp[] per byte
+    'set-interrupt': 50,    # usbSetInterrupt() without copy and CRC
+    'set-interrupt-byte': 7,
+}
+
+
+# ---- measurements on the assembled handler
+
+def transaction(prog, kind, n=0):
+    """Runs one transaction through the handler. Returns (handler cycles,
+    bus time in seconds). kind is 'sof', 'in' (n payload bytes ready, None
+    for NAK) or 'out' (n payload bytes, None when the device NAKs)."""
+    run = isrsim.Run(prog)
+    run.seed_payload = 0
+    start = run.t0
+    data = bytes(range(0x41, 0x41 + (n or 0)))
+    if kind == 'sof':
+        run.host(usbwire.keep_alive())
+        run.frames = 1
+        run.run()
+        expected = []
+    elif kind == 'in':
+        expected = [usbwire.handshake(usbwire.PID_NAK)]
+        reply = None
+        if n is not None:
+            packet = usbwire.data_packet(usbwire.PID_DATA1, data)
+            base = run.addr('usbTxStatus1') + 1
+            run.cpu.mem[base:base + len(packet)] = packet
+            run.var('usbTxStatus1', n + 4)
+            expected = [packet]
+            reply = lambda r: usbwire.to_bits(
+                usbwire.handshake(usbwire.PID_ACK))
+        run.host(usbwire.to_bits(usbwire.token(usbwire.PID_IN, 0, 1)))
+        run.run(reply=reply)
+    else:
+        expected = [usbwire.handshake(usbwire.PID_ACK)]
+        if n is None:
+            run.var('usbRxLen', 0xff)       # usbDisableAllRequests()
+            expected = [usbwire.handshake(usbwire.PID_NAK)]
+        run.var('usbInputBufOffset', avrasm.USB_BUFSIZE)
+        run.host(usbwire.to_bits(usbwire.token(usbwire.PID_OUT, 0, 1)))
+        run.host(usbwire.to_bits(usbwire.data_packet(usbwire.PID_DATA1,
+                                                     data)))
+        run.run()
+    stats = isrsim.Stats(prog)
+    if not stats.add(run, kind, expected, None):
+        raise RuntimeError('%s %s: %s' % (kind, n, '; '.join(
+            stats.failures[0][2])))
+    end = run.board.last_host_event()
+    if run.board.packets:
+        end = max(end, run.board.packets[-1][-1][0] / run.f)
+    return run.isr_cycles, end - start
+
+
+def crc_cycles(prog, n):
+    """Cycles of usbCrc16Append() over n bytes, including the rcall."""
+    cpu = avrcpu.Cpu(prog)
+    buf = prog.data['usbTxStatus1'] + 1
+    cpu.mem[24], cpu.mem[25], cpu.mem[22] = buf & 0xff, buf >> 8, n
+    cpu.push(cpu.pc & 0xff)
+    cpu.push(cpu.pc >> 8)
+    cpu.pc = prog.labels['usbCrc16Append'] // 2
+    while cpu.pc != avrcpu.MAIN_LOOP:
+        cpu.step()
+    return cpu.cycle + 3
+
+
+class Costs(object):
+    """Cycles and bus times of everything the model does for one variant."""
+
+    def __init__(self, prog, size, c_costs):
+        self.c = c_costs
+        self.txn = {
+            'sof': transaction(prog, 'sof'),
+            'in-nak': transaction(prog, 'in', None),
+            'in-zlp': transaction(prog, 'in', 0),
+            'out-nak': transaction(prog, 'out', None),
+        }
+        for n in range(1, PACKET + 1):
+            self.txn['in-%d' % n] = transaction(prog, 'in', n)
+        self.txn['out'] = transaction(prog, 'out', size)
+        self.crc = dict((n, crc_cycles(prog, n)) for n in range(PACKET + 1))
+
+    def set_interrupt(self, n):
+        return (self.c['set-interrupt'] + self.c['set-interrupt-byte'] *
+                max(n, 1) + self.crc[n])
+
+
+# ---- the model
+
+class Device(object):
+    """Driver and DigiWebUSBDevice state between the events of the model."""
+
+    def __init__(self):
+        self.rx_len = 0         # usbRxLen: 0 free, > 0 packet, < 0 disabled
+        self.tx1 = None         # payload loaded into usbTxStatus1
+        self.send_empty = False
+        self.index = 0          # bytes in tmp[]
+        self.rx_ring = 0
+        self.tx_ring = 0
+
+
+class Bench(object):
+
+    def __init__(self, costs, pattern, per_frame, size, poll_us, write_ms):
+        self.costs = costs
+        self.pattern = pattern
+        self.per_frame = per_frame
+        self.size = size
+        self.poll = poll_us * 1e-6
+        self.write = write_ms * 1e-3
+        self.dev = Device()
+        self.cycles = dict(isr=0, poll=0, wrapper=0)
+        self.bytes_in = 0       # device to host
+        self.bytes_out = 0      # host to device
+        self.nak_in = 0
+        self.nak_out = 0
+        self.produced = 0       # bytes the sketch wrote
+        self.clipped = False    # pattern does not fit into a frame
+
+    def host_in(self):
+        dev = self.dev
+        if dev.tx1 is None:
+            self.nak_in += 1
+            return self.costs.txn['in-nak']
+        n, dev.tx1 = dev.tx1, None
+        self.bytes_in += n
+        return self.costs.txn['in-%d' % n if n else 'in-zlp']
+
+    def host_out(self):
+        dev = self.dev
+        if dev.rx_len != 0:
+            self.nak_out += 1
+            return self.costs.txn['out-nak']
+        dev.rx_len = self.size
+        self.bytes_out += self.size
+        return self.costs.txn['out']
+
+    def poll_wrapper(self, t):
+        dev, c = self.dev, self.costs.c
+        # the sketch reads everything received and writes as much as the
+        # tx ring and the pacing allow
+        dev.rx_ring = 0
+        if self.pattern in ('in', 'both'):
+            if self.write:
+                target = int(t / self.write)
+            else:
+                target = self.produced + TX_RING
+            add = min(target - self.produced, TX_RING - dev.tx_ring)
+            dev.tx_ring += add
+            self.produced += add
+        # usbPoll()
+        self.cycles['poll'] += c['poll']
+        if dev.rx_len > 0:
+            n = dev.rx_len
+            self.cycles['poll'] += c['poll-rx'] + c['writeout-byte'] * n
+            dev.rx_ring = min(RX_RING, dev.rx_ring + n)
+            # usbFunctionWriteOut() disables requests at a full packet
+            dev.rx_len = -1 if dev.rx_ring >= PACKET else 0
+        # the rest of usbPollWrapper()
+        self.cycles['wrapper'] += c['wrapper']
+        take = min(dev.tx_ring, PACKET - dev.index)
+        dev.tx_ring -= take
+        dev.index += take
+        self.cycles['wrapper'] += c['wrapper-byte'] * take
+        if dev.tx1 is None:
+            if dev.send_empty:
+                dev.tx1 = 0
+                dev.send_empty = False
+                self.cycles['wrapper'] += self.costs.set_interrupt(0)
+            elif dev.index:
+                dev.tx1 = dev.index
+                self.cycles['wrapper'] += self.costs.set_interrupt(dev.index)
+                dev.rx_len = 0          # usbEnableAllRequests()
+                dev.send_empty = True
+                dev.index = 0
+
+    def events(self, frames):
+        """Returns the sorted (time, function) list: keep-alive and the
+        transactions of the pattern at the start of each frame, polls half
+        an interval off the frame start."""
+        txns = []
+        if self.pattern in ('in', 'both'):
+            txns.append(self.host_in)
+        if self.pattern in ('out', 'both'):
+            txns.append(self.host_out)
+        txns = txns * self.per_frame
+        # the host schedules the transactions back to back, each in a slot
+        # long enough for the longest one
+        gap = TXN_GAP * usbwire.BIT_TIME
+        slot = max(bus for _, bus in self.costs.txn.values()) + gap
+        fit = int((FRAME_BUDGET * FRAME - self.costs.txn['sof'][1] - gap)
+                  / slot)
+        self.clipped = len(txns) > fit
+        out = []
+        for f in range(frames):
+            t = f * FRAME
+            out.append((t, self.keep_alive))
+            t += self.costs.txn['sof'][1] + gap
+            for fn in txns[:fit]:
+                out.append((t, fn))
+                t += slot
+        t = 0.5 * self.poll
+        while t < frames * FRAME:
+            out.append((t, self.poll_wrapper))
+            t += self.poll
+        out.sort(key=lambda e: e[0])
+        return out
+
+    def keep_alive(self):
+        return self.costs.txn['sof']
+
+    def run(self, frames):
+        """Runs the model; returns the simulated time in seconds."""
+        self.produced = 0
+        for t, fn in self.events(frames):
+            if fn == self.poll_wrapper:
+                fn(t)
+            else:
+                self.cycles['isr'] += fn()[0]
+        return frames * FRAME
+
+    def report_row(self, seconds, khz):
+        total = seconds * khz * 1000.0
+        isr = self.cycles['isr'] / total
+        poll = self.cycles['poll'] / total
+        wrapper = self.cycles['wrapper'] / total
+        return (isr, poll, wrapper, 1.0 - isr - poll - wrapper,
+                self.bytes_in / seconds, self.bytes_out / seconds,
+                self.nak_in / seconds, self.nak_out / seconds)
+
+
+def parse_costs(items):
+    costs = dict(C_COSTS)
+    for item in items or ():
+        name, _, value = item.partition('=')
+        if name not in costs or not value.isdigit():
+            raise SystemExit('bad --cost %s, names: %s'
+                             % (item, ', '.join(sorted(costs))))
+        costs[name] = int(value)
+    return costs
+
+
+def main(argv=None):
+    ap = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    ap.add_argument('--clock', type=int, action='append',
+                    help='clock variant in kHz (default: all)')
+    ap.add_argument('--pattern', default='both',
+                    choices=('idle', 'in', 'out', 'both'),
+                    help='bulk transfers the host runs (default: both)')
+    ap.add_argument('--per-frame', type=int, default=1,
+                    help='transactions per direction and frame (default: 1)')
+    ap.add_argument('--size', type=int, default=PACKET,
+                    help='payload of the host OUT packets (default: %d)'
+                    % PACKET)
+    ap.add_argument('--poll-us', type=float, default=1000.0,
+                    help='usbPollWrapper() interval (default: 1000)')
+    ap.add_argument('--frames', type=int, default=1000,
+                    help='frames to simulate (default: 1000)')
+    ap.add_argument('--write-ms', type=float, default=0.0,
+                    help='sketch writes one byte per interval, 5 is what '
+                    'write() does (default: as fast as the tx ring allows)')
+    ap.add_argument('--cost', action='append', metavar='NAME=CYCLES',
+                    help='replace an estimate of C_COSTS')
+    ap.add_argument('--verbose', '-v', action='store_true',
+                    help='list the measured handler cycles')
+    args = ap.parse_args(argv)
+    if not 0 <= args.size <= PACKET:
+        ap.error('--size must be 0..%d' % PACKET)
+    c_costs = parse_costs(args.cost)
+    # usbPoll, the wrapper and what is left for the sketch rest on the C
+    # side, so they are estimates until every C cost is given
+    given = set(item.partition('=')[0] for item in args.cost or ())
+    estimated = [name for name in sorted(C_COSTS) if name not in given]
+    mark = '~' if estimated else ''
+
+    print('pattern %s, %d per frame, OUT %d bytes, poll every %.0f us%s'
+          % (args.pattern, args.per_frame, args.size, args.poll_us,
+             ', write every %.1f ms' % args.write_ms if args.write_ms
+             else ''))
+    print('%8s %7s %8s %8s %7s %9s %9s %8s %8s'
+          % ('clock', 'ISR', mark + 'usbPoll', mark + 'wrapper',
+             mark + 'sketch', 'IN B/s', 'OUT B/s', 'NAK in', 'NAK out'))
+    for khz in args.clock or avrasm.CLOCKS_KHZ:
+        prog = avrasm.assemble(khz)
+        costs = Costs(prog, args.size, c_costs)
+        bench = Bench(costs, args.pattern, args.per_frame, args.size,
+                      args.poll_us, args.write_ms)
+        seconds = bench.run(args.frames)
+        row = bench.report_row(seconds, khz)
+        notes = []
+        if bench.clipped:
+            notes.append('clipped to the frame')
+        if row[3] < 0:
+            # the polls could not keep their interval
+            notes.append('overload')
+        print('%4.1f MHz %6.2f%% %7.2f%% %7.2f%% %6.2f%% %9.0f %9.0f %8.0f '
+              '%8.0f%s' % ((khz / 1000.0, row[0] * 100, row[1] * 100,
+                            row[2] * 100, max(row[3], 0.0) * 100) + row[4:] +
+                           (' (%s)' % ', '.join(notes) if notes else '',)))
+        if args.verbose:
+            for name, (cycles, bus) in sorted(costs.txn.items()):
+                print('         %-8s %5d handler cycles, %6.1f us on the bus'
+                      % (name, cycles, bus * 1e6))
+            print('         %-8s %5d cycles for 8 bytes'
+                  % ('crc', costs.crc[PACKET]))
+    if estimated:
+        print('~ estimated: C_COSTS %s not measured, see --cost'
+              % ', '.join(estimated))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
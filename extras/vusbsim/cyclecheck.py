@@ -0,0 +1,487 @@
+#!/usr/bin/env python3
+# Name: cyclecheck.py
+# Project: DigisparkWebUSB host tools
+# Tabsize: 4
+# License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+
+"""Static cycle budget check of the V-USB assembler module.
+
+The handler is assembled for each clock variant as in isrsim.py, but instead
+of running it, every path through the control flow graph is walked and the
+cycles are added up. Two things are checked:
+
+Annotations. Most instructions in the usbdrvasm*.inc modules carry a ";[n]"
+comment giving the cycle at which the instruction starts, or ends, counted
+from some reference point. ";[n-m]" gives a range, ";[n] [m]" the cycles of
+successive turns of a loop. For every pair of annotated instructions
+connected by a path without another annotation on it, the difference of the
+annotations must equal the cycles of the path. A transition is
+  - ok        if it matches,
+  - a join    if it does not match but another path into the same
+              instruction does (the code merges paths of different length,
+              the annotation follows one of them),
+  - a reset   if the numbering goes backwards (a new reference point such
+              as the SOP of the transmitter, or the next turn of a loop) or
+              starts anew: at se0, in a macro from another file and after
+              waiting for the bus in waitForJ,
+  - a mismatch otherwise.
+
+Budgets derived from the bit time (CLOCK / 1.5 MHz cycles):
+  - interrupt latency: the handler must poll in waitForK before the K that
+    starts the last two bits of SYNC, 6 bit times after the edge that
+    triggered the interrupt. This gives the largest latency from that edge
+    to the first instruction of the handler and, after subtracting the
+    synchronizer, the interrupt response and the longest instruction, the
+    time user code may run with interrupts disabled. Both are compared with
+    the "max allowable interrupt latency" claim in the module header.
+  - sync retry: from a K found in waitForK back to waitForK must not take
+    more than two bit times, or the double K at the end of SYNC may be
+    missed. Over the limit is a warning only, whether the K is caught
+    depends on the bit phase.
+  - response: from the end of the host's EOP to the SOP of the handshake or
+    data packet must be 2 to 7.5 bit times (USB 2.0 section 7.1.18.1).
+  - next packet: after SETUP and OUT the handler must be back in waitForK
+    before the SYNC of the data packet, which may start 2 bit times after
+    the EOP, is over.
+  - transmitter: every bit written to the port must last the bit time to
+    within a quarter bit.
+  - EOP: the two SE0 bits the transmitter ends with must last 1.25 to 1.50
+    us. Out of range is a warning, as in isrsim.py.
+  - sof: the window after the last sample of a waitForK timeout until the
+    pending flag is cleared, in which the start of a packet is lost, and
+    the part of it spent in USB_SOF_HOOK, for reference.
+  - receiver: the cycles between port samples after foundK, for reference.
+
+A latency below the header claim is a warning as well. The exit status is
+nonzero if a budget fails or an annotation mismatches.
+
+Loops are walked once; paths that need more turns are not bounded by this
+check (isrsim.py covers them dynamically).
+
+Usage: cyclecheck.py [--clock KHZ ...] [--mcu MCU ...] [--verbose]
+"""
+
+import argparse
+import os
+import re
+import sys
+
+import avrasm
+from isrsim import PCINT_DELAY, IRQ_RESPONSE, EOP_MIN, EOP_MAX
+
+# the instruction that is executing when the interrupt arrives may need up
+# to 3 more cycles (ret and reti take 4)
+INSN_COMPLETION = 3
+# SYNC is KJKJKJKK: the K starting the last two bits follows the first edge
+# after 6 bit times
+SYNC_LAST_K = 6
+# the receiver's SE0 annotations count from the center of the second SE0
+# bit, which is half a bit before the end of EOP
+SE0_REFERENCE = 0.5
+RESPONSE_MIN, RESPONSE_MAX = 2.0, 7.5
+DATA_GAP = 2.0
+PATH_LIMIT = 200            # instructions per path
+
+BRANCHES = ('breq', 'brne', 'brcs', 'brcc', 'brlo', 'brsh', 'brmi', 'brpl',
+            'brge', 'brlt', 'brts', 'brtc', 'brvs', 'brvc', 'brhs', 'brhc',
+            'brie', 'brid')
+SKIPS = ('sbis', 'sbic', 'sbrs', 'sbrc', 'cpse')
+TWO_CYCLES = ('ld', 'ldd', 'st', 'std', 'push', 'pop', 'sbi', 'cbi', 'adiw',
+              'sbiw', 'lds', 'sts', 'rjmp')
+_annotation = re.compile(r'^\s*(?:\d+\s+)?((?:\[\s*-?\d+(?:\s*-\s*-?\d+)?\s*\]\s*)+)')
+_range = re.compile(r'\[\s*(-?\d+)(?:\s*-\s*(-?\d+))?\s*\]')
+_claim = re.compile(r'max allowable interrupt latency:\s*(\d+) cycles\s*->'
+                    r'\s*max\s*(\d+) cycles interrupt disable')
+
+
+def cycles(insn):
+    """Cycles of an instruction that does not branch or skip."""
+    m = insn.mnem
+    if m in TWO_CYCLES:
+        return 2
+    if m in ('lpm', 'rcall', 'jmp'):
+        return 3
+    if m in ('ret', 'reti', 'call'):
+        return 4
+    return 1
+
+
+def successors(prog, insn):
+    """Returns [(word address, cycles of insn on that edge)]. Returns and
+    calls end a path."""
+    m = insn.mnem
+    nxt = insn.addr + insn.size
+    if m in ('ret', 'reti', 'rcall', 'call'):
+        return []
+    if m in ('rjmp', 'jmp'):
+        return [(insn.ops[0], cycles(insn))]
+    if m in BRANCHES:
+        return [(nxt, 1), (insn.ops[0], 2)]
+    if m in SKIPS:
+        skipped = prog.insns[nxt]
+        return [(nxt, 1), (nxt + skipped.size, 1 + skipped.size)]
+    return [(nxt, cycles(insn))]
+
+
+def counted_loop(prog, insn):
+    """For the delay loops "ldi r, n / l: dec r / brne l" returns the cycles
+    of the brne that leaves the loop including the n - 1 further turns,
+    otherwise None."""
+    if insn.mnem != 'brne' or insn.ops[0] >= insn.addr:
+        return None
+    body = prog.insns.get(insn.ops[0])
+    if body is None or body.mnem != 'dec' or \
+       body.addr + body.size != insn.addr:
+        return None
+    init = [i for i in prog.order if i.addr + i.size == body.addr]
+    if not init or init[0].mnem != 'ldi' or init[0].ops[0] != body.ops[0]:
+        return None
+    turns = init[0].ops[1] or 256
+    return (turns - 1) * (cycles(body) + 2) + 1
+
+
+def annotation(insn):
+    """Returns [(first, last)] cycles of a ";[n]" or ";[n-m]" comment. In
+    loops the cycle of each turn may follow, as in ";[09] [25] [41]"."""
+    m = _annotation.match(insn.comment or '')
+    if not m:
+        return None
+    return [(int(a), int(b) if b else int(a))
+            for a, b in _range.findall(m.group(1))]
+
+
+def walk(prog, start, stop, avoid=None, first=True):
+    """Yields (stop insn, cycles, path) for every simple path from the
+    instruction at word address start to an instruction for which stop(insn)
+    is true. The start instruction itself is only tested if first is set.
+    Paths through an instruction for which avoid(insn) is true are dropped."""
+    stack = [(start, 0, ())]
+    while stack:
+        addr, total, path = stack.pop()
+        insn = prog.insns.get(addr)
+        if insn is None or addr in path or len(path) > PATH_LIMIT:
+            continue
+        if (path or first) and stop(insn):
+            yield insn, total, path
+            continue
+        if avoid and avoid(insn):
+            continue
+        loop = counted_loop(prog, insn)
+        if loop is not None:
+            edges = [(addr + insn.size, loop)]
+        else:
+            edges = successors(prog, insn)
+        for to, c in edges:
+            stack.append((to, total + c, path + (addr,)))
+
+
+def span(prog, start, stop, avoid=None):
+    """Returns (min, max) cycles over the paths of walk() or None."""
+    found = [c for _, c, _ in walk(prog, start, stop, avoid)]
+    return (min(found), max(found)) if found else None
+
+
+def label(prog, name):
+    return prog.labels[name] // 2
+
+
+def is_label(prog, name):
+    addr = label(prog, name)
+    return lambda insn: insn.addr == addr
+
+
+def port_tests(mcu):
+    """Returns (writes port, releases bus, reads pins) tests for the USB
+    port of mcu."""
+    def writes_port(insn):
+        return insn.mnem == 'out' and insn.ops[0] == mcu.portb
+
+    def releases_bus(insn):
+        return (insn is not None and insn.mnem == 'out' and
+                insn.ops[0] == mcu.ddrb)
+
+    def reads_pins(insn):
+        return ((insn.mnem == 'in' and insn.ops[1] == mcu.pinb) or
+                (insn.mnem in ('sbis', 'sbic') and insn.ops[0] == mcu.pinb))
+    return writes_port, releases_bus, reads_pins
+
+
+# ---- annotations
+
+def driver_file(insn):
+    name = os.path.basename(insn.file)
+    return name.startswith('usbdrvasm') or name == 'asmcommon.inc'
+
+
+def start_cycle(insn, ends):
+    """Annotation of insn as [(first, last)] start cycles; ends tells that
+    the code counts to the end of the instruction instead."""
+    a = annotation(insn)
+    if ends:
+        return [(f - cycles(insn), l - cycles(insn)) for f, l in a]
+    return a
+
+
+def matches(src, total, to):
+    """Tells whether the annotations of src and to differ by total cycles,
+    with both giving the start or both the end of the instruction. Most
+    modules count to the start, some to the end, usbdrvasm12.inc does both
+    and usbdrvasm15.inc changes within a loop."""
+    for ends in (False, True):
+        b = start_cycle(to, ends)
+        for first, last in start_cycle(src, ends):
+            if any(lo <= first + total <= hi or lo <= last + total <= hi
+                   for lo, hi in b):
+                return True
+    return False
+
+
+def check_annotations(prog):
+    """Returns [(kind, from insn, to insn, cycles)]."""
+    lo, hi = prog.isr_range()
+    wait_j, se0 = label(prog, 'waitForJ'), label(prog, 'se0')
+    incoming = {}
+    for addr in range(lo, hi):
+        insn = prog.insns.get(addr)
+        if insn is None or annotation(insn) is None:
+            continue
+        for to, total, path in walk(prog, addr, annotation, first=False):
+            incoming.setdefault(to.addr, set()).add(
+                (addr, total, wait_j in path))
+    results = []
+    for to_addr, sources in sorted(incoming.items()):
+        to = prog.insns[to_addr]
+        b = annotation(to)
+        matched = []
+        for addr, total, waits in sorted(sources):
+            src = prog.insns[addr]
+            ok = matches(src, total, to)
+            # macros from other files, such as the SOF hook, count from
+            # their own start, se0 from the center of the SE0 bit and
+            # waitForK from the edge the handler syncs to
+            reset = b[0][0] < max(f for f, _ in annotation(src)) or waits or (
+                src.file != to.file and
+                (to_addr == se0 or
+                 not (driver_file(src) and driver_file(to))))
+            matched.append((src, total, ok, reset))
+        any_ok = any(ok for _, _, ok, _ in matched)
+        for src, total, ok, reset in matched:
+            if ok:
+                kind = 'ok'
+            elif reset:
+                kind = 'reset'
+            elif any_ok:
+                kind = 'join'
+            else:
+                kind = 'mismatch'
+            results.append((kind, src, to, total))
+    return results
+
+
+# ---- budgets
+
+def header_claim(prog):
+    """Returns (latency, interrupt disable) from the module header."""
+    for insn in prog.order:
+        if os.path.basename(insn.file).startswith('usbdrvasm1') or \
+           os.path.basename(insn.file).startswith('usbdrvasm2'):
+            path = insn.file
+            break
+    else:
+        return None
+    if not os.path.isabs(path):
+        path = os.path.join(avrasm.REPO, path)
+    try:
+        with open(path) as f:
+            m = _claim.search(f.read())
+    except IOError:
+        return None
+    return (int(m.group(1)), int(m.group(2))) if m else None
+
+
+def ok_or_fail(ok):
+    return 'ok' if ok else 'fail'
+
+
+def budgets(prog):
+    """Returns a list of (name, status, text); status is 'ok', 'warning'
+    or 'fail'."""
+    cpb = prog.clock_khz / 1500.0
+    writes_port, releases_bus, reads_pins = port_tests(prog.mcu)
+    out = []
+    wait_k = label(prog, 'waitForK')
+
+    # interrupt latency: vector to the first sample in waitForK, with
+    # waitForJ seeing J at once
+    entry = span(prog, label(prog, prog.vector), is_label(prog, 'waitForK'))
+    latency = int(SYNC_LAST_K * cpb - entry[1])
+    disable = latency - PCINT_DELAY - IRQ_RESPONSE - INSN_COMPLETION
+    claim = header_claim(prog)
+    text = ('%d cycles from the SYNC edge to the handler, %d cycles with '
+            'interrupts disabled' % (latency, disable))
+    status = 'ok' if disable >= 0 else 'fail'
+    if claim:
+        text += ' (header: %d, %d)' % claim
+        if latency < claim[0]:
+            status = 'warning'
+    out.append(('interrupt latency', status, text))
+
+    # sync retry: a sample in waitForK that saw K, through foundK and back
+    found_k = label(prog, 'foundK')
+    retry = span(prog, found_k, is_label(prog, 'waitForK'),
+                 is_label(prog, 'haveTwoBitsK'))
+    if retry:
+        # sbis (1) and rjmp foundK (2) after the sample. Over the limit is
+        # a warning: whether the double K is still caught depends on the bit
+        # phase, which isrsim.py sweeps
+        worst = retry[1] + 3
+        out.append(('sync retry', 'ok' if worst <= 2 * cpb else 'warning',
+                    '%d cycles, limit %.1f (2 bits)' % (worst, 2 * cpb)))
+
+    # response: se0 to the first port write of the transmitter
+    se0 = label(prog, 'se0')
+    ref = annotation(prog.insns[se0])
+    ref = ref[0][0] if ref else 0
+    new_packet = is_label(prog, 'waitForJ')
+    resp = span(prog, se0, writes_port, new_packet)
+    if resp:
+        lo = (ref + resp[0]) / cpb - SE0_REFERENCE
+        hi = (ref + resp[1]) / cpb - SE0_REFERENCE
+        out.append(('response',
+                    ok_or_fail(RESPONSE_MIN <= lo and hi <= RESPONSE_MAX),
+                    '%.2f..%.2f bit times after EOP (%d..%d cycles from se0), '
+                    'limit %.1f..%.1f' % (lo, hi, resp[0], resp[1],
+                                          RESPONSE_MIN, RESPONSE_MAX)))
+
+    # next packet: se0 back to waitForK without transmitting
+    ready = span(prog, se0, lambda i: i.addr == wait_k, writes_port)
+    if ready:
+        limit = (SE0_REFERENCE + DATA_GAP + SYNC_LAST_K) * cpb - ref
+        out.append(('next packet', ok_or_fail(ready[1] <= limit),
+                    '%d cycles from se0 to waitForK, limit %.1f'
+                    % (ready[1], limit)))
+
+    # transmitter: distance between port writes. The EOP ends with the
+    # write of J right before the bus is released.
+    lo_isr, hi_isr = prog.isr_range()
+    gaps = []
+    for addr in range(lo_isr, hi_isr):
+        insn = prog.insns.get(addr)
+        if insn is None or not writes_port(insn):
+            continue
+        for to, total, _ in walk(prog, addr, writes_port, new_packet,
+                                 first=False):
+            gaps.append((total, insn, to))
+    end_of_eop = set(i.addr for i in prog.order if writes_port(i) and
+                     releases_bus(prog.insns.get(i.addr + i.size)))
+    bits = [g for g in gaps
+            if g[1].addr not in end_of_eop and g[2].addr not in end_of_eop]
+    eop = [g[0] for g in gaps if g[2].addr in end_of_eop]
+    bad = [g for g in bits if abs(g[0] - cpb) > cpb / 4]
+    if bits:
+        text = '%d..%d cycles per bit, nominal %.2f' % (
+            min(g[0] for g in bits), max(g[0] for g in bits), cpb)
+        for total, a, b in bad:
+            text += '\n        %d cycles: %s -> %s' % (total, a.where(),
+                                                       b.where())
+        out.append(('transmitter', ok_or_fail(not bad), text))
+    if eop:
+        f = prog.clock_khz * 1e3
+        lo, hi = EOP_MIN * f, EOP_MAX * f
+        # a warning only, as in isrsim.py: V-USB trades a cycle of EOP for
+        # the address update and hosts accept it
+        ok = lo <= min(eop) and max(eop) <= hi
+        out.append(('EOP', 'ok' if ok else 'warning',
+                    '%d..%d cycles (%.0f..%.0f ns), limit %.1f..%.1f'
+                    % (min(eop), max(eop), min(eop) / f * 1e9,
+                       max(eop) / f * 1e9, lo, hi)))
+
+    # SOF: a timeout in waitForK takes the J for the end of a keep-alive,
+    # counts the frame, runs USB_SOF_HOOK and clears the pending flag. The
+    # first edge of a SYNC that arrives between the last sample and the
+    # clear is lost with the flag; the hook lengthens that window.
+    if 'sofClearPending' in prog.labels:
+        clear = label(prog, 'sofClearPending')
+        windows = []
+        for _, total, path in walk(prog, wait_k, lambda i: i.addr == clear,
+                                   is_label(prog, 'foundK')):
+            at, last, hook = 0, 0, 0
+            for a, b in zip(path, path[1:] + (clear,)):
+                insn = prog.insns[a]
+                if reads_pins(insn):
+                    last = at + 1
+                step = [c for to, c in successors(prog, insn) if to == b][0]
+                if not driver_file(insn):
+                    hook += step
+                at += step
+            # ldi and the store of the flag follow sofClearPending
+            windows.append((total + 2 - last, hook))
+        if windows:
+            width, hook = max(windows)
+            out.append(('sof', 'ok', '%d cycles (%.1f bit times) from the last '
+                        'sample in waitForK to the flag cleared, hook %d'
+                        % (width, width / cpb, hook)))
+
+    # receiver: distance between reads of the port after foundK
+    reads = []
+    for addr in range(found_k, hi_isr):
+        insn = prog.insns.get(addr)
+        if insn is None or not reads_pins(insn):
+            continue
+        for to, total, _ in walk(prog, addr, reads_pins, new_packet,
+                                 first=False):
+            if to.addr >= found_k:
+                reads.append(total)
+    if reads:
+        out.append(('receiver', 'ok',
+                    '%d..%d cycles between port samples, nominal %.2f'
+                    % (min(reads), max(reads), cpb)))
+    return out
+
+
+def report(prog, verbose):
+    khz = prog.clock_khz
+    results = check_annotations(prog)
+    counts = {}
+    for kind, _, _, _ in results:
+        counts[kind] = counts.get(kind, 0) + 1
+    checks = budgets(prog)
+    failed = [name for name, status, _ in checks if status == 'fail']
+    if counts.get('mismatch'):
+        failed.append('annotations')
+    print('%-9s %6.1f MHz  %s' % (prog.mcu.name, khz / 1000.0,
+                                  'FAIL (%s)' % ', '.join(failed)
+                                  if failed else 'PASS'))
+    for name, status, text in checks:
+        print('    %-18s %s%s' % (name + ':', text, {
+            'ok': '', 'warning': '  <-- WARNING', 'fail': '  <-- FAIL'}[status]))
+    print('    annotations: %d ok, %d joins, %d resets, %d mismatches%s'
+          % (counts.get('ok', 0), counts.get('join', 0),
+             counts.get('reset', 0), counts.get('mismatch', 0),
+             '  <-- FAIL' if counts.get('mismatch') else ''))
+    for kind, a, b, total in results:
+        if kind == 'mismatch' or (verbose and kind == 'join'):
+            print('        %-8s %-22s %-8s -> %-22s %-8s path %d cycles'
+                  % (kind, a.where(), '[%d]' % annotation(a)[0][0], b.where(),
+                     '[%d]' % annotation(b)[0][0], total))
+    return not failed
+
+
+def main(argv=None):
+    ap = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    ap.add_argument('--clock', type=int, action='append',
+                    help='clock variant in kHz (default: all)')
+    ap.add_argument('--mcu', action='append', choices=sorted(avrasm.MCUS),
+                    help='part to assemble for (default: all)')
+    ap.add_argument('--verbose', '-v', action='store_true',
+                    help='also list joins')
+    args = ap.parse_args(argv)
+    ok = True
+    for mcu in args.mcu or sorted(avrasm.MCUS):
+        for khz in args.clock or avrasm.CLOCKS_KHZ:
+            ok = report(avrasm.assemble(khz, mcu=mcu), args.verbose) and ok
+    return 0 if ok else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,61 @@
+/* Minimal ATtiny85 and ATtiny167 register definitions for preprocessing the
+ * V-USB assembler modules on the host. Only what usbdrvasm.S and usbconfig.h
+ * reference is defined. The values are I/O addresses as seen with
+ * __SFR_OFFSET == 0, or data addresses above the I/O space.
+ */
+#ifndef __VUSBSIM_AVR_IO_H__
+#define __VUSBSIM_AVR_IO_H__
+
+#if defined(__AVR_ATtiny167__)
+
+#define PINB    0x03
+#define DDRB    0x04
+#define PORTB   0x05
+#define PCIFR   0x1B
+#define TCNT0   0x26
+#define SPL     0x3D
+#define SPH     0x3E
+#define SREG    0x3F
+#define OSCCAL  0x66
+#define PCICR   0x68
+#define PCMSK1  0x6C
+
+#define PCIF1   1
+#define PCIE1   1
+
+#define RAMSTART    0x100
+#define RAMEND      0x2FF
+#define FLASHEND    0x3FFF
+#define E2END       0x1FF
+
+#define PCINT1_vect _VECTOR(4)
+
+#else
+
+#define PCMSK   0x15
+#define PINB    0x16
+#define DDRB    0x17
+#define PORTB   0x18
+#define OSCCAL  0x31
+#define TCNT0   0x32
+#define GIFR    0x3A
+#define GIMSK   0x3B
+#define SPL     0x3D
+#define SPH     0x3E
+#define SREG    0x3F
+
+#define PCIF    5
+#define PCIE    5
+#define INTF0   6
+#define INT0    6
+
+#define RAMSTART    0x60
+#define RAMEND      0x25F
+#define FLASHEND    0x1FFF
+#define E2END       0x1FF
+
+#define SIG_PIN_CHANGE  _VECTOR(2)
+
+#endif
+
+#endif /* __VUSBSIM_AVR_IO_H__ */
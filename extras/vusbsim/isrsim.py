@@ -0,0 +1,754 @@
+#!/usr/bin/env python3
+# Name: isrsim.py
+# Project: DigisparkWebUSB host tools
+# Tabsize: 4
+# License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+
+"""Cycle accurate simulation of the V-USB interrupt handler.
+
+The real usbdrvasm.S is preprocessed and assembled for each clock variant
+and executed on an AVRe instruction model. The host side of the bus is
+synthesized from low-speed packets (SYNC, NRZI, bit stuffing, EOP) and fed
+to the D+/D- input pins; what the device drives back is decoded the same
+way. Every scenario is repeated over a sweep of host phase, interrupt
+latency, device clock deviation and host inter-packet gap, and must produce
+the expected handshake or data packet and the expected driver state.
+
+For each variant the report gives:
+  - the smallest distance of the best sample in each bit cell to the cell
+    edges (receiver sampling margin, in bit times),
+  - the cycles between the samples of consecutive bits (worst-case cycles
+    per bit of the receiver; nominal is CLOCK/1.5 MHz),
+  - the largest deviation of a transmitted edge from its ideal position and
+    the EOP width of the transmitter,
+  - the device response time after the host EOP,
+  - the largest interrupt latency (from the first SYNC edge to the first
+    instruction of the handler) for which all scenarios still pass,
+  - instruction coverage of the handler over all runs.
+
+Usage: isrsim.py [--clock KHZ ...] [--quick] [--verbose]
+"""
+
+import argparse
+import bisect
+import math
+import random
+import sys
+
+import avrasm
+import avrcpu
+import usbwire
+from usbwire import J, K, SE0, BIT_TIME
+
+# the default part; see avrasm.MCUS for the others
+TINY85 = avrasm.MCUS[avrasm.DEFAULT_MCU]
+
+# cycles from a pin change to the pin change interrupt flag (synchronizer
+# and edge detector) and from the flag to the first instruction of the
+# handler (4 cycles interrupt response plus the rjmp in the vector table)
+PCINT_DELAY = 3
+IRQ_RESPONSE = 6
+# low-speed source limits from the USB 2.0 spec, table 7-10
+RATE_TOLERANCE = 0.015
+EOP_MIN, EOP_MAX = 1.25e-6, 1.50e-6
+
+SOF_COUNT = 0x41
+IDLE_START = 20e-6          # bus idle before the first packet
+MAX_CYCLES = 40000
+
+
+class UsbBoard(avrcpu.Board):
+    """Port B of an ATtiny85 or 167 wired to a low-speed bus."""
+
+    def __init__(self, f_cpu, mcu=TINY85):
+        self.f = float(f_cpu)
+        self.mcu = mcu
+        self.usbmask = (1 << mcu.dminus) | (1 << mcu.dplus)
+        self.host_t = [-1.0]        # host line state changes
+        self.host_s = [J]
+        self.host_busy = []         # (start, end) while the host drives
+        self.dev_t = [-1.0]         # device line state changes, None when
+        self.dev_s = [None]         # the device does not drive the bus
+        self.port = 0
+        self.ddr = 0
+        self.flag = False
+        self.flag_t = 0.0           # D- seen by the pin change logic up to here
+        self.samples = []           # (time, cycle, word address)
+        self.drive = []             # current transmission: [(cycle, state)]
+        self.packets = []           # list of the above, one per transmission
+        self.collisions = 0
+        self.in_isr = False
+        self.on_release = None
+
+    # host side
+
+    def send(self, states, t0):
+        """Queues a host packet starting at time t0; returns its end."""
+        t = t0
+        for s in states:
+            if s != self.host_s[-1]:
+                self.host_t.append(t)
+                self.host_s.append(s)
+            t += BIT_TIME
+        self.host_busy.append((t0, t))
+        return t
+
+    def host_driving(self, t):
+        for a, b in self.host_busy:
+            if a <= t < b:
+                return True
+        return False
+
+    def last_host_event(self):
+        return self.host_busy[-1][1] if self.host_busy else 0.0
+
+    # bus
+
+    def line(self, t):
+        s = self.dev_s[bisect.bisect_right(self.dev_t, t) - 1]
+        if s is None:
+            s = self.host_s[bisect.bisect_right(self.host_t, t) - 1]
+        return s
+
+    def next_dminus_edge(self, t):
+        """First change of D- after t, or None when the bus stays idle."""
+        i = bisect.bisect_right(self.host_t, t)
+        while i < len(self.host_t):
+            if self.host_s[i][1] != self.host_s[i - 1][1]:
+                return self.host_t[i]
+            i += 1
+        return None
+
+    # device side
+
+    def pins(self, state):
+        return (state[0] << self.mcu.dplus) | (state[1] << self.mcu.dminus)
+
+    def driving(self):
+        return self.ddr & self.usbmask == self.usbmask
+
+    def io_read(self, cpu, io):
+        mcu = self.mcu
+        if io == mcu.pinb:
+            # the synchronizer latches the pins half a cycle before the
+            # instruction reads them
+            t = (cpu.cycle - 0.5) / self.f
+            if self.in_isr:
+                self.samples.append((t, cpu.cycle, cpu.pc))
+            return ((self.pins(self.line(t)) & self.usbmask) |
+                    (self.port & ~self.usbmask))
+        if io == mcu.portb:
+            return self.port
+        if io == mcu.ddrb:
+            return self.ddr
+        if io == mcu.pending:
+            # GIFR or PCIFR: the flag is the only bit that can be set here
+            self.sync(cpu)
+            return (1 << mcu.pending_bit) if self.flag else 0
+        return avrcpu.Board.io_read(self, cpu, io)
+
+    def io_write(self, cpu, io, value):
+        mcu = self.mcu
+        if io == mcu.portb or io == mcu.ddrb:
+            was = self.driving()
+            if io == mcu.portb:
+                self.port = value
+            else:
+                self.ddr = value
+            cycle = cpu.cycle + 1   # outputs change at the end of the cycle
+            t = cycle / self.f
+            state = None
+            if self.driving():
+                state = ((self.port >> mcu.dplus) & 1,
+                         (self.port >> mcu.dminus) & 1)
+                if not was:
+                    self.drive = [(cycle, state)]
+                    if self.host_driving(t):
+                        self.collisions += 1
+                elif state != self.drive[-1][1]:
+                    self.drive.append((cycle, state))
+            elif was:
+                self.drive.append((cycle, None))
+                self.packets.append(self.drive)
+                self.drive = []
+                if self.on_release:
+                    self.on_release(t)
+            if state != self.dev_s[-1]:
+                self.dev_t.append(t)
+                self.dev_s.append(state)
+        elif io == mcu.pending:
+            self.sync(cpu)
+            if value & (1 << mcu.pending_bit):
+                self.flag = False
+        else:
+            avrcpu.Board.io_write(self, cpu, io, value)
+
+    def sync(self, cpu):
+        """Sets the pin change flag for changes of D- up to PCINT_DELAY
+        cycles ago."""
+        t = (cpu.cycle - PCINT_DELAY) / self.f
+        if t <= self.flag_t:
+            return
+        dm = self.line(self.flag_t)[1]
+        for times, states in ((self.host_t, self.host_s),
+                              (self.dev_t, self.dev_s)):
+            i = bisect.bisect_right(times, self.flag_t)
+            while i < len(times) and times[i] <= t and not self.flag:
+                if self.line(times[i])[1] != dm:
+                    self.flag = True
+                i += 1
+        self.flag_t = t
+
+
+class Run(object):
+    """One scenario at one point of the sweep."""
+
+    def __init__(self, prog, dev=0.0, phase=0.0, latency=0, gap=2, seed=1):
+        self.prog = prog
+        self.f = prog.clock_khz * 1000.0 * (1.0 + dev)
+        self.latency = latency
+        self.gap = gap
+        self.board = UsbBoard(self.f, prog.mcu)
+        self.cpu = avrcpu.Cpu(prog, self.board)
+        self.t0 = IDLE_START + phase / self.f
+        self.host_packets = []      # (start, line states)
+        self.entries = []           # (edge cycle, first handler cycle)
+        self.isr_cycles = 0         # from taking the interrupt to reti
+        self.errors = []
+        rng = random.Random(seed)
+        for r in range(32):
+            self.cpu.mem[r] = rng.randrange(256)
+        self.cpu.sreg = avrcpu.I
+        self.var('usbTxLen', usbwire.PID_NAK)
+        self.var('usbTxStatus1', usbwire.PID_NAK)
+        self.var('usbTxStatus3', usbwire.PID_NAK)
+        self.var('usbSofCount', SOF_COUNT)
+        self.frames = 0             # keep-alives sent; None: do not check
+        self.measure_rx = True
+
+    def addr(self, name):
+        return self.prog.data[name]
+
+    def var(self, name, value=None):
+        if value is None:
+            return self.cpu.mem[self.addr(name)]
+        self.cpu.mem[self.addr(name)] = value & 0xff
+
+    def host(self, states, t=None):
+        if t is None:
+            t = self.t0
+        self.host_packets.append((t, states))
+        self.t0 = self.board.send(states, t) + self.gap * BIT_TIME
+        return self.t0
+
+    def run(self, reply=None):
+        """Runs until the handler returned and the bus is quiet. The optional
+        reply callback returns a host packet that is sent the inter-packet
+        gap after the device released the bus, as the host does with the
+        ACK for an IN data packet."""
+        cpu, board = self.cpu, self.board
+
+        def released(t):
+            board.on_release = None
+            states = reply(self)
+            if states:
+                self.host(states, t + self.gap * BIT_TIME)
+
+        board.on_release = released if reply else None
+        while cpu.cycle < MAX_CYCLES:
+            if cpu.pc != avrcpu.MAIN_LOOP:
+                cpu.step()
+                board.sync(cpu)
+                if cpu.pc == avrcpu.MAIN_LOOP:
+                    board.in_isr = False
+                    self.isr_cycles += cpu.cycle - entered
+                continue
+            if board.flag and cpu.sreg & avrcpu.I:
+                # a flag set during the handler: one instruction of the
+                # main loop runs before the interrupt is taken again
+                edge = None
+                take = cpu.cycle + 1
+            else:
+                t = board.next_dminus_edge(board.flag_t)
+                if t is None:
+                    return
+                edge = int(math.ceil(t * self.f))
+                take = edge + PCINT_DELAY
+            cpu.cycle = entered = take + self.latency
+            board.sync(cpu)
+            board.flag = False      # cleared when the vector is taken
+            cpu.cycle += IRQ_RESPONSE
+            cpu.interrupt(self.prog.vector)
+            board.in_isr = True
+            if edge is not None:
+                self.entries.append((edge, cpu.cycle))
+        self.errors.append('handler did not return within %d cycles'
+                           % MAX_CYCLES)
+
+    # ---- analysis
+
+    def device_packets(self):
+        """Decodes what the device transmitted the way a host receiver
+        does: the bit clock is recovered from every transition, so only the
+        distance between neighbouring edges matters. Returns a list of
+        (packet, error, info) where info has the start time, the largest
+        deviation of an edge interval from a whole number of bits (in bit
+        times), the average bit rate error and the EOP width."""
+        cpb = self.prog.clock_khz / 1500.0
+        out = []
+        for drive in self.board.packets:
+            info = {}
+            edges = [(c, s) for c, s in drive if s is not None]
+            first = [i for i, (c, s) in enumerate(edges) if s == K]
+            if not first:
+                out.append((None, 'no SYNC', info))
+                continue
+            edges = edges[first[0]:]
+            c0 = edges[0][0]
+            info['start'] = c0 / self.f
+            states = []
+            jitter = 0.0
+            for (c, s), (c1, s1) in zip(edges, edges[1:] + [(drive[-1][0],
+                                                             None)]):
+                bits = (c1 - c) / cpb
+                n = max(1, int(round(bits)))
+                if s != SE0 and s1 is not None:
+                    jitter = max(jitter, abs(bits - n))
+                if s == SE0:
+                    info['eop'] = (c1 - c) / self.f
+                    if s1 is not None:
+                        nbits = len(states)
+                        info['rate'] = nbits * cpb / (c - c0) - 1.0
+                states.extend([s] * n)
+            info['jitter'] = jitter
+            packet, n, err = usbwire.decode(states)
+            if err is None:
+                err = usbwire.check(packet)
+            out.append((packet, err, info))
+        return out
+
+    def rx_margins(self):
+        """Returns (min margin in bits, (min, max) cycles between the
+        samples of neighbouring bits, number of bit cells without a sample)
+        over the host packets. The best placed sample of each cell counts;
+        stuff bits need not be sampled."""
+        samples = self.board.samples
+        times = [s[0] for s in samples]
+        worst = None
+        gaps = []
+        missed = 0
+        for t0, states in self.host_packets if self.measure_rx else ():
+            skip = usbwire.stuffed(states)
+            prev = None
+            # the handler syncs on the SYNC pattern; PID and data follow,
+            # the last three cells are EOP
+            for cell in range(8, len(states) - 3):
+                a = t0 + cell * BIT_TIME
+                b = a + BIT_TIME
+                i = bisect.bisect_left(times, a)
+                best = None
+                while i < len(samples) and samples[i][0] < b:
+                    m = min(samples[i][0] - a, b - samples[i][0]) / BIT_TIME
+                    if best is None or m > best[0]:
+                        best = (m, samples[i][1])
+                    i += 1
+                if cell in skip:
+                    prev = None
+                    continue
+                if best is None:
+                    missed += 1
+                    prev = None
+                    continue
+                if worst is None or best[0] < worst:
+                    worst = best[0]
+                if prev is not None:
+                    gaps.append(best[1] - prev)
+                prev = best[1]
+        span = (min(gaps), max(gaps)) if gaps else None
+        return worst, span, missed
+
+
+# ---- scenarios
+#
+# Each scenario prepares the driver variables, queues host packets and
+# checks the outcome. They return the list of device packets expected.
+
+def payload(run, n):
+    rng = random.Random(run.seed_payload)
+    kind = run.seed_payload % 4
+    if kind == 0:
+        return bytes(rng.randrange(256) for _ in range(n))
+    if kind == 1:
+        return bytes([0xff] * n)         # maximum bit stuffing
+    if kind == 2:
+        return bytes([0x00] * n)
+    return bytes((0x7f << (i % 8)) & 0xff | (0x7f >> (8 - i % 8))
+                 for i in range(n))     # stuffing at every bit position
+
+
+def expect_vars(run, **values):
+    for name, want in values.items():
+        got = run.var(name)
+        if got != want & 0xff:
+            run.errors.append('%s = 0x%02x, expected 0x%02x'
+                              % (name, got, want & 0xff))
+
+
+def expect_rx(run, offset, packet):
+    base = run.addr('usbRxBuf') + offset
+    got = bytes(run.cpu.mem[base:base + len(packet)])
+    if got != packet:
+        run.errors.append('usbRxBuf = %s, expected %s'
+                          % (got.hex(), packet.hex()))
+
+
+def sc_setup(run):
+    data = payload(run, 8)
+    packet = usbwire.data_packet(usbwire.PID_DATA0, data)
+    run.host(usbwire.to_bits(usbwire.token(usbwire.PID_SETUP, 0, 0)))
+    run.host(usbwire.to_bits(packet))
+    run.run()
+    expect_vars(run, usbRxLen=11, usbRxToken=usbwire.PID_SETUP,
+                usbInputBufOffset=avrasm.USB_BUFSIZE)
+    expect_rx(run, 0, packet)
+    return [usbwire.handshake(usbwire.PID_ACK)]
+
+
+def sc_out(run, endp=0, n=None):
+    if n is None:
+        n = run.seed_payload % 9
+    data = payload(run, n)
+    packet = usbwire.data_packet(usbwire.PID_DATA1, data)
+    run.var('usbInputBufOffset', avrasm.USB_BUFSIZE)
+    run.host(usbwire.to_bits(usbwire.token(usbwire.PID_OUT, 0, endp)))
+    run.host(usbwire.to_bits(packet))
+    run.run()
+    if n == 0:
+        # zero sized data packets are acknowledged but not stored
+        expect_vars(run, usbRxLen=0, usbInputBufOffset=avrasm.USB_BUFSIZE)
+    else:
+        expect_vars(run, usbRxLen=n + 3,
+                    usbRxToken=endp if endp else usbwire.PID_OUT,
+                    usbInputBufOffset=0)
+        expect_rx(run, avrasm.USB_BUFSIZE, packet)
+    return [usbwire.handshake(usbwire.PID_ACK)]
+
+
+def sc_out1(run):
+    return sc_out(run, 1, 8)
+
+
+def sc_out_busy(run):
+    run.var('usbRxLen', 11)
+    run.host(usbwire.to_bits(usbwire.token(usbwire.PID_OUT, 0, 0)))
+    run.host(usbwire.to_bits(usbwire.data_packet(usbwire.PID_DATA1,
+                                                 payload(run, 4))))
+    run.run()
+    expect_vars(run, usbRxLen=11, usbInputBufOffset=0)
+    return [usbwire.handshake(usbwire.PID_NAK)]
+
+
+def sc_overflow(run):
+    # the handler gives up on the packet, the rest of it is noise
+    run.measure_rx = False
+    run.frames = None
+    run.host(usbwire.to_bits(usbwire.token(usbwire.PID_OUT, 0, 0)))
+    run.host(usbwire.to_bits(usbwire.data_packet(usbwire.PID_DATA1,
+                                                 payload(run, 12))))
+    run.run()
+    expect_vars(run, usbRxLen=0, usbInputBufOffset=0)
+    return []
+
+
+def sc_in_nak(run):
+    run.host(usbwire.to_bits(usbwire.token(usbwire.PID_IN, 0, 0)))
+    run.run()
+    expect_vars(run, usbTxLen=usbwire.PID_NAK)
+    return [usbwire.handshake(usbwire.PID_NAK)]
+
+
+def _sc_in(run, endp, lenvar, bufvar):
+    data = payload(run, run.seed_payload % 9)
+    packet = usbwire.data_packet(usbwire.PID_DATA1, data)
+    base = run.addr(bufvar) + (bufvar != 'usbTxBuf')
+    run.cpu.mem[base:base + len(packet)] = packet
+    run.var(lenvar, len(data) + 4)
+    run.host(usbwire.to_bits(usbwire.token(usbwire.PID_IN, 0, endp)))
+    run.run(reply=lambda r: usbwire.to_bits(
+        usbwire.handshake(usbwire.PID_ACK)))
+    expect_vars(run, **{lenvar: usbwire.PID_NAK})
+    return [packet]
+
+
+def sc_in0(run):
+    return _sc_in(run, 0, 'usbTxLen', 'usbTxBuf')
+
+
+def sc_in1(run):
+    return _sc_in(run, 1, 'usbTxStatus1', 'usbTxStatus1')
+
+
+def sc_in3(run):
+    return _sc_in(run, 3, 'usbTxStatus3', 'usbTxStatus3')
+
+
+def sc_keepalive(run):
+    run.host(usbwire.keep_alive())
+    run.frames = 1
+    run.run()
+    return []
+
+
+def sc_other_addr(run):
+    run.host(usbwire.to_bits(usbwire.token(usbwire.PID_SETUP, 7, 0)))
+    run.host(usbwire.to_bits(usbwire.data_packet(usbwire.PID_DATA0,
+                                                 payload(run, 8))))
+    run.run()
+    expect_vars(run, usbRxLen=0, usbInputBufOffset=0)
+    return []
+
+
+def sc_set_address(run):
+    # status stage IN of SET_ADDRESS: the new address takes effect after
+    # the zero sized data packet went out
+    run.var('usbNewDeviceAddr', 0x2a)
+    packet = usbwire.data_packet(usbwire.PID_DATA1, b'')
+    base = run.addr('usbTxBuf')
+    run.cpu.mem[base:base + len(packet)] = packet
+    run.var('usbTxLen', 4)
+    run.host(usbwire.to_bits(usbwire.token(usbwire.PID_IN, 0, 0)))
+    run.run()
+    expect_vars(run, usbDeviceAddr=0x2a << 1, usbTxLen=usbwire.PID_NAK)
+    return [packet]
+
+
+SCENARIOS = [
+    ('setup', sc_setup, None),
+    ('out0', sc_out, None),
+    ('out1', sc_out1, None),
+    ('out-busy', sc_out_busy, None),
+    ('overflow', sc_overflow, None),
+    ('in-nak', sc_in_nak, None),
+    ('in0', sc_in0, None),
+    ('in1', sc_in1, None),
+    ('in3', sc_in3, 'handleIn3'),
+    ('keep-alive', sc_keepalive, 'usbSofCount'),
+    ('other-addr', sc_other_addr, None),
+    ('set-address', sc_set_address, None),
+]
+
+
+def scenarios(prog):
+    for name, fn, needs in SCENARIOS:
+        if needs and needs not in prog.labels and needs not in prog.data:
+            continue
+        yield name, fn
+
+
+# ---- sweeps
+
+class Stats(object):
+
+    def __init__(self, prog):
+        self.prog = prog
+        self.runs = 0
+        self.failures = []
+        self.margin = None
+        self.rx_span = None
+        self.missed = 0
+        self.jitter = 0.0
+        self.eop = None
+        self.rate = None
+        self.response = None
+        self.covered = set()
+
+    def _minmax(self, cur, lo, hi):
+        if cur is None:
+            return (lo, hi)
+        return (min(cur[0], lo), max(cur[1], hi))
+
+    def add(self, run, name, expected, point):
+        self.runs += 1
+        self.covered.update(run.cpu.executed)
+        got = run.device_packets()
+        errors = list(run.errors)
+        if 'usbSofCount' in self.prog.data and run.frames is not None:
+            frames = (run.var('usbSofCount') - SOF_COUNT) & 0xff
+            if frames != run.frames:
+                errors.append('usbSofCount advanced by %d, expected %d'
+                              % (frames, run.frames))
+        if run.board.collisions:
+            errors.append('device drove the bus while the host was sending')
+        if len(got) != len(expected):
+            errors.append('device sent %s, expected %s'
+                          % ([usbwire.describe(p) for p, e, i in got],
+                             [usbwire.describe(p) for p in expected]))
+        for (packet, err, info), want in zip(got, expected):
+            if err:
+                errors.append('device packet: ' + err)
+            elif packet != want:
+                errors.append('device sent %s, expected %s'
+                              % (packet.hex(), want.hex()))
+            self.jitter = max(self.jitter, info.get('jitter', 0.0))
+            if 'rate' in info:
+                self.rate = self._minmax(self.rate, info['rate'], info['rate'])
+            if 'eop' in info:
+                self.eop = self._minmax(self.eop, info['eop'], info['eop'])
+        if got and run.host_packets:
+            # response time from the end of the host's SE0
+            t0, states = [p for p in run.host_packets
+                          if p[0] < got[0][2]['start']][-1]
+            end = t0 + (len(states) - 1) * BIT_TIME
+            r = (got[0][2]['start'] - end) / BIT_TIME
+            self.response = self._minmax(self.response, r, r)
+        margin, span, missed = run.rx_margins()
+        if margin is not None and (self.margin is None or margin < self.margin):
+            self.margin = margin
+        if span:
+            self.rx_span = self._minmax(self.rx_span, span[0], span[1])
+        self.missed += missed
+        if errors:
+            self.failures.append((name, point, errors))
+        return not errors
+
+
+def run_one(prog, name, fn, dev, phase, latency, gap, seed):
+    run = Run(prog, dev, phase, latency, gap, seed)
+    run.seed_payload = seed
+    expected = fn(run)
+    return run, expected
+
+
+def sweep(prog, stats, devs, phases, latencies, gaps, seeds):
+    for name, fn in scenarios(prog):
+        for dev in devs:
+            for phase in phases:
+                for latency in latencies:
+                    for gap in gaps:
+                        for seed in seeds:
+                            point = dict(dev=dev, phase=phase,
+                                         latency=latency, gap=gap, seed=seed)
+                            run, expected = run_one(prog, name, fn, dev,
+                                                    phase, latency, gap, seed)
+                            stats.add(run, name, expected, point)
+
+
+def passes(prog, latency, phases, seeds):
+    for name, fn in scenarios(prog):
+        for phase in phases:
+            for seed in seeds:
+                run, expected = run_one(prog, name, fn, 0.0, phase, latency,
+                                        2, seed)
+                st = Stats(prog)
+                if not st.add(run, name, expected, None):
+                    return False
+    return True
+
+
+def max_latency(prog, phases, seeds, limit=120):
+    """Largest extra interrupt latency (in cycles) for which all scenarios
+    pass, found by bisection."""
+    lo, hi = 0, limit
+    if not passes(prog, 0, phases, seeds):
+        return None
+    while lo < hi:
+        mid = (lo + hi + 1) // 2
+        if passes(prog, mid, phases, seeds):
+            lo = mid
+        else:
+            hi = mid - 1
+    return lo
+
+
+def clock_tolerance(khz):
+    # the RC oscillator variants are specified for +/- 1%, the crystal
+    # variants for the USB limit of +/- 0.25%; sweep a little inside
+    return 0.01 if khz in (12800, 16500) else 0.001
+
+
+def report(prog, stats, latency, verbose):
+    khz = prog.clock_khz
+    cpb = khz / 1500.0
+    lo, hi = prog.isr_range()
+    isr = [a for a in range(lo, hi) if a in prog.insns]
+    covered = [a for a in isr if a in stats.covered]
+    print('%-9s %6.1f MHz  %s' % (prog.mcu.name, khz / 1000.0,
+                                  'PASS' if not stats.failures else
+                                  'FAIL (%d of %d runs)'
+                                  % (len(stats.failures), stats.runs)))
+    print('    runs %d, nominal %.3f cycles per bit' % (stats.runs, cpb))
+    if stats.margin is not None:
+        print('    rx: sampling margin %.3f bit, %d..%d cycles between bit '
+              'samples, %d bit cells missed'
+              % (stats.margin, stats.rx_span[0], stats.rx_span[1],
+                 stats.missed))
+    if stats.eop:
+        print('    tx: edge deviation %.2f cycles (%.0f ns), bit rate '
+              '%+.2f..%+.2f%%, EOP %.0f..%.0f ns'
+              % (stats.jitter * cpb, stats.jitter * cpb * 1e9 / (khz * 1e3),
+                 stats.rate[0] * 100, stats.rate[1] * 100,
+                 stats.eop[0] * 1e9, stats.eop[1] * 1e9))
+        if max(-stats.rate[0], stats.rate[1]) > RATE_TOLERANCE:
+            print('    tx: WARNING: bit rate outside the low-speed tolerance '
+                  'of +/-%.1f%%' % (RATE_TOLERANCE * 100))
+        if stats.eop[0] < EOP_MIN or stats.eop[1] > EOP_MAX:
+            print('    tx: WARNING: EOP outside %.0f..%.0f ns'
+                  % (EOP_MIN * 1e9, EOP_MAX * 1e9))
+    if stats.response:
+        print('    response after host EOP: %.2f..%.2f bit times'
+              % stats.response)
+    if latency is not None:
+        print('    max interrupt latency: %d cycles from the SYNC edge'
+              % (latency + PCINT_DELAY + IRQ_RESPONSE))
+    print('    coverage: %d of %d handler instructions'
+          % (len(covered), len(isr)))
+    if verbose:
+        for a in isr:
+            if a not in stats.covered:
+                insn = prog.insns[a]
+                print('        not executed: %-22s %s'
+                      % (insn.where(), insn.text))
+    shown = stats.failures if verbose else stats.failures[:5]
+    for name, point, errors in shown:
+        print('    %s %s: %s' % (name, point, '; '.join(errors)))
+    if len(shown) < len(stats.failures):
+        print('    ... %d more failures' % (len(stats.failures) - len(shown)))
+
+
+def main(argv=None):
+    ap = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    ap.add_argument('--clock', type=int, action='append',
+                    help='clock variant in kHz (default: all)')
+    ap.add_argument('--quick', action='store_true',
+                    help='fewer sweep points')
+    ap.add_argument('--no-latency', action='store_true',
+                    help='skip the interrupt latency search')
+    ap.add_argument('--mcu', action='append', choices=sorted(avrasm.MCUS),
+                    help='part to assemble for (default: all)')
+    ap.add_argument('--verbose', '-v', action='store_true')
+    args = ap.parse_args(argv)
+
+    ok = True
+    variants = [(mcu, khz) for mcu in args.mcu or sorted(avrasm.MCUS)
+                for khz in args.clock or avrasm.CLOCKS_KHZ]
+    for mcu, khz in variants:
+        prog = avrasm.assemble(khz, mcu=mcu)
+        tol = clock_tolerance(khz)
+        if args.quick:
+            devs, phases, latencies = (-tol, tol), (0.0, 0.5), (0, 3)
+            gaps, seeds = (2,), (0, 1, 2, 3)
+        else:
+            devs, phases = (-tol, 0.0, tol), (0.0, 0.25, 0.5, 0.75)
+            latencies, gaps, seeds = (0, 1, 2, 3), (2, 7), (0, 1, 2, 3, 5)
+        stats = Stats(prog)
+        sweep(prog, stats, devs, phases, latencies, gaps, seeds)
+        latency = None
+        if not args.no_latency:
+            latency = max_latency(prog, (0.0, 0.5), (0, 1))
+        report(prog, stats, latency, args.verbose)
+        ok = ok and not stats.failures
+    return 0 if ok else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
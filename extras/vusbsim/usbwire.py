@@ -0,0 +1,183 @@
+# Name: usbwire.py
+# Project: DigisparkWebUSB host tools
+# Tabsize: 4
+# License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+
+"""Low-speed USB line coding: packets, CRCs, NRZI and bit stuffing.
+
+Line states are (D+, D-) tuples. On a low-speed bus J is D- high, K is D+
+high and SE0 pulls both lines low.
+"""
+
+BIT_RATE = 1500000.0
+BIT_TIME = 1.0 / BIT_RATE
+
+J = (0, 1)
+K = (1, 0)
+SE0 = (0, 0)
+
+PID_OUT = 0xe1
+PID_IN = 0x69
+PID_SOF = 0xa5
+PID_SETUP = 0x2d
+PID_DATA0 = 0xc3
+PID_DATA1 = 0x4b
+PID_ACK = 0xd2
+PID_NAK = 0x5a
+PID_STALL = 0x1e
+
+PID_NAMES = {PID_OUT: 'OUT', PID_IN: 'IN', PID_SOF: 'SOF',
+             PID_SETUP: 'SETUP', PID_DATA0: 'DATA0', PID_DATA1: 'DATA1',
+             PID_ACK: 'ACK', PID_NAK: 'NAK', PID_STALL: 'STALL'}
+
+
+def crc5(value, nbits=11):
+    crc = 0x1f
+    for i in range(nbits):
+        bit = (value >> i) & 1
+        if (crc ^ bit) & 1:
+            crc = (crc >> 1) ^ 0x14
+        else:
+            crc >>= 1
+    return crc ^ 0x1f
+
+
+def crc16(data):
+    crc = 0xffff
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            if crc & 1:
+                crc = (crc >> 1) ^ 0xa001
+            else:
+                crc >>= 1
+    return crc ^ 0xffff
+
+
+def token(pid, addr, endp):
+    field = (addr & 0x7f) | ((endp & 0xf) << 7)
+    field |= crc5(field) << 11
+    return bytes([pid, field & 0xff, field >> 8])
+
+
+def data_packet(pid, payload):
+    crc = crc16(payload)
+    return bytes([pid]) + bytes(payload) + bytes([crc & 0xff, crc >> 8])
+
+
+def handshake(pid):
+    return bytes([pid])
+
+
+def to_bits(packet):
+    """Returns the line states, one per bit time, for SYNC, the packet and
+    EOP. Bit stuffing starts with the SYNC pattern as in the spec."""
+    states = []
+    level = J
+    ones = 0
+    for byte in bytes([0x80]) + bytes(packet):
+        for i in range(8):
+            if (byte >> i) & 1:
+                ones += 1
+            else:
+                level = K if level == J else J
+                ones = 0
+            states.append(level)
+            if ones == 6:
+                level = K if level == J else J
+                states.append(level)
+                ones = 0
+    return states + [SE0, SE0, J]
+
+
+def stuffed(states):
+    """Returns the indices of the stuff bits in a line state sequence that
+    starts with SYNC."""
+    out = set()
+    level = J
+    ones = 0
+    for i, s in enumerate(states):
+        if s == SE0:
+            break
+        if ones == 6:
+            out.add(i)
+            ones = 0
+        elif s == level:
+            ones += 1
+        else:
+            ones = 0
+        level = s
+    return out
+
+
+def keep_alive():
+    """Low-speed keep-alive sent by the hub once per frame instead of SOF."""
+    return [SE0, SE0, J]
+
+
+def decode(states):
+    """Decodes one packet from a list of per-bit line states beginning with
+    the first bit of SYNC. Returns (packet bytes, number of bits up to and
+    including the end of EOP, error string or None)."""
+    bits = []
+    level = J
+    ones = 0
+    n = 0
+    while n < len(states):
+        s = states[n]
+        if s == SE0:
+            se0 = 0
+            while n < len(states) and states[n] == SE0:
+                se0 += 1
+                n += 1
+            break
+        if ones == 6:
+            if s == level:
+                return None, n, 'bit stuffing violation'
+            level = s
+            ones = 0
+            n += 1
+            continue
+        if s == level:
+            bits.append(1)
+            ones += 1
+        else:
+            bits.append(0)
+            ones = 0
+        level = s
+        n += 1
+    else:
+        return None, n, 'no EOP'
+    if len(bits) % 8:
+        return None, n, 'packet of %d bits is not byte aligned' % len(bits)
+    data = bytes(sum(bits[i + j] << j for j in range(8))
+                 for i in range(0, len(bits), 8))
+    if not data or data[0] != 0x80:
+        return None, n, 'bad SYNC'
+    return data[1:], n, None
+
+
+def check(packet):
+    """Checks PID and CRC of a decoded packet; returns None or an error."""
+    if not packet:
+        return 'empty packet'
+    pid = packet[0]
+    if (pid >> 4) != (~pid & 0xf):
+        return 'PID check field mismatch (0x%02x)' % pid
+    if pid in (PID_DATA0, PID_DATA1):
+        if len(packet) < 3:
+            return 'short data packet'
+        if crc16(packet[1:-2]) != packet[-2] | (packet[-1] << 8):
+            return 'CRC16 mismatch'
+    elif len(packet) != 1:
+        return 'handshake with %d trailing bytes' % (len(packet) - 1)
+    return None
+
+
+def describe(packet):
+    if not packet:
+        return '-'
+    name = PID_NAMES.get(packet[0], '0x%02x' % packet[0])
+    if len(packet) > 3:
+        return '%s %s' % (name, packet[1:-2].hex())
+    return name
@@ -8,9 +8,64 @@
  * This Revision: $Id: oddebug.c 692 2008-11-07 15:07:40Z cs $
  */
 
+#include "usbconfig.h"  /* DEBUG_LEVEL */
 #include "oddebug.h"
 
-#if DEBUG_LEVEL > 0
+#if DEBUG_LEVEL > 0 && ODDBG_RING
+
+static uchar    ring[ODDBG_RING_SIZE];
+static uchar    ringHead;   /* where the next byte goes */
+static uchar    ringCount;  /* bytes in the ring */
+uchar           odDebugDropped;
+static uchar    lastEmptyPrefix;    /* prefix of the last record if it had no data */
+static uchar    lastWasEmpty;
+
+static void ringPut(uchar c)
+{
+    ring[ringHead] = c;
+    if(++ringHead >= ODDBG_RING_SIZE)
+        ringHead = 0;
+}
+
+void    odDebug(uchar prefix, uchar *data, uchar len)
+{
+    /* usbPoll() logs the bus reset on every call while it lasts: keep one */
+    if(len == 0 && lastWasEmpty && prefix == lastEmptyPrefix)
+        return;
+    if(len > ODDBG_RING_SIZE - 2 - ringCount){
+        if(odDebugDropped != 0xff)
+            odDebugDropped++;
+        return;
+    }
+    lastWasEmpty = len == 0;
+    lastEmptyPrefix = prefix;
+    ringCount += len + 2;
+    ringPut(prefix);
+    ringPut(len);
+    while(len--)
+        ringPut(*data++);
+}
+
+uchar   odDebugDrain(uchar *buffer, uchar len)
+{
+uchar   tail = ringHead >= ringCount ? ringHead - ringCount : ringHead + ODDBG_RING_SIZE - ringCount;
+uchar   n = 0, size;
+
+    while(ringCount > 0){
+        size = ring[tail + 1 < ODDBG_RING_SIZE ? tail + 1 : 0] + 2;
+        if(size > len - n)
+            break;
+        ringCount -= size;
+        while(size--){
+            buffer[n++] = ring[tail];
+            if(++tail >= ODDBG_RING_SIZE)
+                tail = 0;
+        }
+    }
+    return n;
+}
+
+#elif DEBUG_LEVEL > 0
 
 #warning "Never compile production devices with debugging enabled"
 
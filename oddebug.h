@@ -21,6 +21,15 @@ calls are no-ops. If it is 1, DBG1 logs will appear, but not DBG2. If it is
 
 A debug log consists of a label ('prefix') to indicate which debug log created
 the output and a memory block to dump in hex ('data' and 'len').
+
+Devices without a UART, like the ATtiny85, keep the logs in a RAM ring of
+ODDBG_RING_SIZE bytes instead (ODDBG_RING, set it to 1 to do this on a
+device with a UART too). Logging then costs a copy of the data, with no
+waiting. Each record is stored as the prefix, the length and the data; a
+record that does not fit is dropped and counted. The application moves the
+records out with odDebugDrain(), DigiWebUSB does so for the vendor request
+WL_REQUEST_GET_DEBUG_LOG. Logs and drain must run in the same context (the
+main loop for the driver's logs).
 */
 
 
@@ -35,9 +44,22 @@ the output and a memory block to dump in hex ('data' and 'len').
 #   define  uchar   unsigned char
 #endif
 
-#if DEBUG_LEVEL > 0 && !(defined TXEN || defined TXEN0) /* no UART in device */
-#   warning "Debugging disabled because device has no UART"
-#   undef   DEBUG_LEVEL
+#ifndef ODDBG_RING
+#   if defined TXEN || defined TXEN0
+#       define  ODDBG_RING  0
+#   else
+#       define  ODDBG_RING  1   /* no UART in device */
+#   endif
+#endif
+
+#ifndef ODDBG_RING_SIZE
+#   if RAMEND - RAMSTART + 1 >= 1024
+#       define  ODDBG_RING_SIZE 128 /* bytes, up to 255 */
+#   elif RAMEND - RAMSTART + 1 >= 512
+#       define  ODDBG_RING_SIZE 64
+#   else
+#       define  ODDBG_RING_SIZE 32  /* ATtiny45/461 */
+#   endif
 #endif
 
 #ifndef DEBUG_LEVEL
@@ -61,7 +83,24 @@ the output and a memory block to dump in hex ('data' and 'len').
 /* ------------------------------------------------------------------------- */
 
 #if DEBUG_LEVEL > 0
+#ifdef __cplusplus
+extern "C"{
+#endif
 extern void odDebug(uchar prefix, uchar *data, uchar len);
+#if ODDBG_RING
+extern uchar    odDebugDropped;
+/* Number of records dropped because the ring was full, up to 255. */
+extern uchar    odDebugDrain(uchar *buffer, uchar len);
+/* Moves whole records, oldest first, into buffer as long as they fit into
+ * len bytes and returns the number of bytes stored.
+ */
+#endif
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
+
+#if DEBUG_LEVEL > 0 && !ODDBG_RING
 
 /* Try to find our control registers; ATMEL likes to rename these */
 
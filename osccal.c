@@ -8,6 +8,9 @@
  */
 
 #include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include "usbdrv.h"
 
 #ifndef uchar
 #define uchar   unsigned char
@@ -17,47 +20,178 @@
 /* ------------------------ Oscillator Calibration ------------------------- */
 /* ------------------------------------------------------------------------- */
 
-/* Calibrate the RC oscillator. Our timing reference is the Start Of Frame
- * signal (a single SE0 bit) repeating every millisecond immediately after
- * a USB RESET. We first do a binary search for the OSCCAL value and then
- * optimize this value with a neighboorhod search.
+#define OSCCAL_TARGET   ((unsigned)(1499 * (double)F_CPU / 10.5e6 + 0.5))
+
+#ifdef USB_SOF_HOOK
+uchar   lastTimer0Value;        /* used by tuneOsccal in osctune.h */
+uchar   osctuneCorrections;     /* number of OSCCAL steps applied by tuneOsccal */
+#endif
+
+/* Returns the absolute deviation of the current frequency from F_CPU in units
+ * of usbMeasureFrameLength(). *tooLow is set if the clock is too slow.
  */
-void    calibrateOscillator(void)
+static unsigned measureDeviation(uchar *tooLow)
+{
+int     x = usbMeasureFrameLength() - OSCCAL_TARGET;
+
+    *tooLow = x < 0;
+    return x < 0 ? -x : x;
+}
+
+/* Binary search for the OSCCAL value in base ... base + 2 * step - 1 which
+ * gives the highest frequency below the target.
+ */
+static uchar binarySearch(uchar base, uchar step)
 {
-uchar       step = 128;
-uchar       trialValue = 0, optimumValue;
-int         x, optimumDev, targetValue = (unsigned)(1499 * (double)F_CPU / 10.5e6 + 0.5);
+uchar   trialValue = base;
 
-    /* do a binary search: */
     do{
         OSCCAL = trialValue + step;
-        x = usbMeasureFrameLength();    /* proportional to current real frequency */
-        if(x < targetValue)             /* frequency still too low */
+        if(usbMeasureFrameLength() < OSCCAL_TARGET)    /* frequency still too low */
             trialValue += step;
         step >>= 1;
     }while(step > 0);
-    /* We have a precision of +/- 1 for optimum OSCCAL here */
-    /* now do a neighborhood search for optimum value */
-    optimumValue = trialValue;
-    optimumDev = x; /* this is certainly far away from optimum */
-    for(OSCCAL = trialValue - 1; OSCCAL <= trialValue + 1; OSCCAL++){
-        x = usbMeasureFrameLength() - targetValue;
-        if(x < 0)
-            x = -x;
-        if(x < optimumDev){
-            optimumDev = x;
-            optimumValue = OSCCAL;
+    return trialValue;
+}
+
+/* Neighborhood search around value. We don't leave the OSCCAL range of value
+ * because the ranges of split range oscillators are not continuous, and we
+ * don't wrap around at 0 or 255 on parts with a single range.
+ */
+static uchar neighborhoodSearch(uchar value, unsigned *deviation)
+{
+uchar       optimumValue = value, trialValue = value - 1, i, tooLow;
+unsigned    x;
+
+    *deviation = 0xffff;
+    for(i = 0; i < 3; i++, trialValue++){
+        if(((trialValue ^ value) & OSCCAL_RANGE_MASK) ||
+           (i == 0 && value == 0) || (i == 2 && value == 0xff))
+            continue;
+        OSCCAL = trialValue;
+        x = measureDeviation(&tooLow);
+        if(x < *deviation){
+            *deviation = x;
+            optimumValue = trialValue;
+        }
+    }
+    return optimumValue;
+}
+
+/* Binary search in the OSCCAL_WINDOW steps on either side of value, within
+ * the OSCCAL range of value. Returns 0 if the result is at an end of the
+ * window: the best value is then probably outside and the full search is
+ * needed.
+ */
+static uchar windowSearch(uchar value)
+{
+uchar   first = value & OSCCAL_RANGE_MASK;
+uchar   last = OSCCAL_RANGE_MASK ? value | ~OSCCAL_RANGE_MASK : 0xff;
+uchar   base, result;
+
+    if(value < first + OSCCAL_WINDOW){
+        base = first;
+    }else if(value > last - OSCCAL_WINDOW + 1){
+        base = last - 2 * OSCCAL_WINDOW + 1;
+    }else{
+        base = value - OSCCAL_WINDOW;
+    }
+    result = binarySearch(base, OSCCAL_WINDOW);
+    if(result == base || result == base + 2 * OSCCAL_WINDOW - 1)
+        return 0;
+    return result;
+}
+
+/* Set by calibrateOscillator() for calibrateOscillatorPoll(). */
+#define PENDING_SEARCH  1   /* the narrow search failed */
+#define PENDING_STORE   2   /* OSCCAL differs from the cached value */
+static uchar    pending;
+
+/* Calibrate the RC oscillator. Our timing reference is the Start Of Frame
+ * signal (a single SE0 bit) repeating every millisecond immediately after
+ * a USB RESET. The host talks to the device 10 ms after the reset, so only
+ * the quick steps run here: if the value cached in EEPROM is still within
+ * OSCCAL_TOLERANCE, one more measurement of the neighbor in the direction of
+ * the error is all we do. Otherwise we search OSCCAL_WINDOW steps around it,
+ * or around the current value if there is none. The full search and the
+ * EEPROM write are left to calibrateOscillatorPoll().
+ */
+void    calibrateOscillator(void)
+{
+#ifdef OSCCAL_EEPROM_ADDR
+uchar       cached = eeprom_read_byte((uchar *)OSCCAL_EEPROM_ADDR);
+#else
+uchar       cached = 0xff;
+#endif
+uchar       optimumValue, trialValue, tooLow;
+unsigned    optimumDev;
+
+    optimumValue = OSCCAL;
+    if(cached != 0xff){     /* erased EEPROM: never calibrated */
+        OSCCAL = optimumValue = cached;
+        optimumDev = measureDeviation(&tooLow);
+        if(optimumDev <= OSCCAL_TOLERANCE){
+            trialValue = tooLow ? cached + 1 : cached - 1;
+            if(!((trialValue ^ cached) & OSCCAL_RANGE_MASK) && (tooLow || cached != 0)){
+                OSCCAL = trialValue;
+                if(measureDeviation(&tooLow) < optimumDev)
+                    optimumValue = trialValue;
+            }
+            goto done;
         }
     }
+    trialValue = windowSearch(optimumValue);
+    if(trialValue != 0){
+        optimumValue = trialValue;
+    }else{
+        pending |= PENDING_SEARCH;
+    }
+done:
     OSCCAL = optimumValue;
+    if(optimumValue != cached)
+        pending |= PENDING_STORE;
+}
+
+/* The rest of the calibration, for the main loop with interrupts enabled.
+ * The full search, a binary search in each OSCCAL range followed by a
+ * neighborhood search, takes about 20 frames with interrupts disabled. It
+ * only runs if the narrow search failed, when the clock is too far off for
+ * the host to talk to the device anyway; the host's next reset then finds
+ * it calibrated.
+ */
+void    calibrateOscillatorPoll(void)
+{
+    if(pending & PENDING_SEARCH){
+#if OSCCAL_RANGE_MASK
+        uchar       optimumValue, trialValue;
+        unsigned    optimumDev, x;
+
+        cli();
+        optimumValue = neighborhoodSearch(binarySearch(0, 64), &optimumDev);
+        trialValue = neighborhoodSearch(binarySearch(128, 64), &x);
+        if(x < optimumDev)
+            optimumValue = trialValue;
+        OSCCAL = optimumValue;
+#else
+        unsigned    optimumDev;
+
+        cli();
+        /* We have a precision of +/- 1 for optimum OSCCAL here */
+        OSCCAL = neighborhoodSearch(binarySearch(0, 128), &optimumDev);
+#endif
+        sei();
+    }
+#ifdef OSCCAL_EEPROM_ADDR
+    if(pending)
+        eeprom_update_byte((uchar *)OSCCAL_EEPROM_ADDR, OSCCAL);
+#endif
+    pending = 0;
 }
 /*
 Note: This calibration algorithm may try OSCCAL values of up to 192 even if
-the optimum value is far below 192. It may therefore exceed the allowed clock
-frequency of the CPU in low voltage designs!
+the optimum value is far below 192 (up to 255 on split range oscillators).
+It may therefore exceed the allowed clock frequency of the CPU in low voltage
+designs!
 You may replace this search algorithm with any other algorithm you like if
 you have additional constraints such as a maximum CPU clock.
-For version 5.x RC oscillators (those with a split range of 2x128 steps, e.g.
-ATTiny25, ATTiny45, ATTiny85), it may be useful to search for the optimum in
-both regions.
 */
@@ -23,21 +23,41 @@ calibrateOscillator() from the reset hook in usbconfig.h:
 
 #ifndef __ASSEMBLER__
 #include <avr/interrupt.h>  // for sei()
+#ifdef __cplusplus
+extern "C" {
+#endif
 extern void calibrateOscillator(void);
+extern void calibrateOscillatorPoll(void);
+#ifdef __cplusplus
+}
+#endif
 #endif
 #define USB_RESET_HOOK(resetStarts)  if(!resetStarts){cli(); calibrateOscillator(); sei();}
+/* calibrateOscillatorPoll() must then be called from the main loop, e.g.
+ * after each usbPoll(). It is cheap when there is nothing to do.
+ */
 
 /*
 This routine is an alternative to the continuous synchronization described
 in osctune.h.
 
 Algorithm used:
-calibrateOscillator() first does a binary search in the OSCCAL register for
-the best matching oscillator frequency. Then it does a next neighbor search
-to find the value with the lowest clock rate deviation. It is guaranteed to
-find the best match among neighboring values, but for version 5 oscillators
-(which have a discontinuous relationship between OSCCAL and frequency) a
-better match might be available in another OSCCAL region.
+The host sends its first request 10 ms after the end of the reset, so
+calibrateOscillator() only does what fits into that time. It first tries
+the value found at the last calibration if it is kept in EEPROM (see
+OSCCAL_EEPROM_ADDR). If the frequency is still within OSCCAL_TOLERANCE, it
+only checks the neighbor value in the direction of the error and is done
+after two frame measurements. Otherwise it does a binary search in the
+OSCCAL_WINDOW steps on either side of that value, or of the current one
+(the factory value after power up), which takes four more. If that search
+ends at an edge of its window, calibrateOscillatorPoll() does the full
+search: a binary search in the OSCCAL register for the best matching
+oscillator frequency, then a next neighbor search to find the value with
+the lowest clock rate deviation. For version 5 oscillators (which have a
+discontinuous relationship between OSCCAL and frequency, see
+OSCCAL_RANGE_MASK) both OSCCAL ranges are searched and the better match is
+used. calibrateOscillatorPoll() also writes the result back to EEPROM if it
+has changed.
 
 Limitations:
 This calibration algorithm may try OSCCAL values of up to 192 even if the
@@ -53,12 +73,48 @@ deviation! All other frequency modules require at least 0.2% precision.
 #ifndef __OSCCAL_H_INCLUDED__
 #define __OSCCAL_H_INCLUDED__
 
+/* #define OSCCAL_EEPROM_ADDR  E2END */
+/* Define this to the EEPROM address of a byte for the calibration value, in
+ * usbconfig.h or on the compiler command line. The value then survives power
+ * cycles, so the first enumeration after power up usually needs only the
+ * two frame measurements. The byte then belongs to the calibration and the
+ * sketch must not use it; with E2END, the last byte, that is the last one
+ * the Arduino EEPROM library offers. 0xff (erased EEPROM) means that no
+ * value has been stored yet. Undefined, the calibration starts from the
+ * current OSCCAL and leaves the EEPROM alone.
+ */
+#ifndef OSCCAL_TOLERANCE
+#define OSCCAL_TOLERANCE    (OSCCAL_TARGET / 128)
+#endif
+/* Deviation from the target frame length (about 0.8%) up to which the cached
+ * value is accepted without a search. The 12.8 MHz and 16.5 MHz modules
+ * tolerate 1%.
+ */
+#ifndef OSCCAL_WINDOW
+#define OSCCAL_WINDOW       8
+#endif
+/* Steps searched on either side of the starting value after a reset, a power
+ * of two. 8 steps are about 6% on the ATtiny85, more than the factory
+ * calibration error at room temperature.
+ */
+#if defined (__AVR_ATtiny25__) || defined (__AVR_ATtiny45__) || defined (__AVR_ATtiny85__) || \
+    defined (__AVR_ATtiny261__) || defined (__AVR_ATtiny461__) || defined (__AVR_ATtiny861__)
+#define OSCCAL_RANGE_MASK   0x80    /* version 5 oscillator: 2x128 steps */
+#else
+#define OSCCAL_RANGE_MASK   0
+#endif
+
 //void    calibrateOscillator(void);
 /* This function calibrates the RC oscillator so that the CPU runs at F_CPU.
  * It MUST be called immediately after the end of a USB RESET condition!
  * Disable all interrupts during the call!
- * It is recommended that you store the resulting value in EEPROM so that a
- * good guess value is available after the next reset.
+ * Define OSCCAL_EEPROM_ADDR so that a good guess value is available after
+ * the next power up.
+ */
+//void    calibrateOscillatorPoll(void);
+/* Finishes the calibration after calibrateOscillator(): the full search if
+ * the quick one failed, which disables interrupts for about 20 ms, and the
+ * EEPROM write. Call it with interrupts enabled.
  */
 
 
@@ -27,8 +27,18 @@ received. Do not store the value on every received message because the EEPROM
 has a limited endurance.
 
 Notes:
-(*) You must declare the global character variable "lastTimer0Value" in your
-main code.
+(*) The global character variables "lastTimer0Value" and "osctuneCorrections"
+are defined in osccal.c. The latter counts the OSCCAL adjustments made since
+startup (modulo 256) and can be used to monitor the clock drift.
+
+(*) tuneOsccal takes up to 24 cycles, 26 where OSCCAL is outside the I/O
+space (ATtiny87/167); the cycle comments below are for the I/O space. It runs
+after the handler has taken the J at the end of a keep-alive for a frame and
+before it clears the pending flag, so a packet that starts in between is lost
+and must be retried by the host. The packet path, whose interrupt latency
+extras/vusbsim/cyclecheck.py checks against the bit time, does not run the
+hook. cyclecheck.py reports the window as "sof": 34 cycles (3.1 bit times at
+16.5 MHz) on the ATtiny85, 24 of them in the hook.
 
 (*) Timer 0 must be free running (not written by your code) and the prescaling
 must be consistent with the TIMER0_PRESCALING define.
@@ -51,7 +61,10 @@ Thanks to Henrik Haftmann for the idea to this routine!
 #define EXPECTED_TIMER0_INCREMENT   ((F_CPU / (1000 * TIMER0_PRESCALING)) & 0xff)
 #define TOLERATED_DEVIATION         (TOLERATED_DEVIATION_PPT * F_CPU / (1000000 * TIMER0_PRESCALING))
 
-#ifdef __ASSEMBLER__
+#ifndef __ASSEMBLER__
+extern unsigned char    lastTimer0Value;
+extern unsigned char    osctuneCorrections;
+#else
 macro tuneOsccal
     push    YH                              ;[0]
     in      YL, TCNT0                       ;[2]
@@ -60,29 +73,33 @@ macro tuneOsccal
     sub     YL, YH                          ;[7] time passed since last frame
     subi    YL, EXPECTED_TIMER0_INCREMENT   ;[8]
 #if OSCCAL > 0x3f   /* outside I/O addressable range */
-    lds     YH, OSCCAL                      ;[6]
+    lds     YH, OSCCAL                      ;[9] one cycle more than in
 #else
-    in      YH, OSCCAL                      ;[6] assembler modle uses __SFR_OFFSET == 0
+    in      YH, OSCCAL                      ;[9] assembler modle uses __SFR_OFFSET == 0
 #endif
     cpi     YL, TOLERATED_DEVIATION + 1     ;[10]
     brmi    notTooHigh                      ;[11]
     subi    YH, 1                           ;[12] clock rate was too high
 ;   brcs    tuningOverflow                  ; optionally check for overflow
-    rjmp    osctuneDone                     ;[13]
+    rjmp    osctuneCorrected                ;[13]
 notTooHigh:
     cpi     YL, -TOLERATED_DEVIATION        ;[13]
     brpl    osctuneDone                     ;[14] not too low
     inc     YH                              ;[15] clock rate was too low
 ;   breq    tuningOverflow                  ; optionally check for overflow
+osctuneCorrected:
+    lds     YL, osctuneCorrections          ;[15-16]
+    inc     YL                              ;[17-18]
+    sts     osctuneCorrections, YL          ;[18-19]
 osctuneDone:
 #if OSCCAL > 0x3f   /* outside I/O addressable range */
-    sts     OSCCAL, YH                      ;[12-13] store tuned value
+    sts     OSCCAL, YH                      ;[16-21] store tuned value
 #else
-    out     OSCCAL, YH                      ;[12-13] store tuned value
+    out     OSCCAL, YH                      ;[16-21] store tuned value
 #endif
 tuningOverflow:
-    pop     YH                              ;[17]
-    endm                                    ;[19] max number of cycles
+    pop     YH                              ;[17-22]
+    endm                                    ;[24] max number of cycles, 26 with lds/sts
 #endif
 
 #define USB_SOF_HOOK        tuneOsccal
@@ -79,6 +79,80 @@
 // uint16 led_bitmask
 #define WL_REQUEST_SELECT_LEDS (12)
 
+// Reads the oscillator calibration state. Control-IN.
+//
+// uint8 current OSCCAL value
+// uint8 OSCCAL value cached in EEPROM by the calibration at USB reset, 0xff
+//       if none is stored or OSCCAL_EEPROM_ADDR is not defined
+// uint8 number of OSCCAL steps applied by SOF tracking (modulo 256)
+#define WL_REQUEST_GET_OSCCAL (48)
+
+// Times the library's hot paths on the device with timer 1 and returns
+// the results of the previous run; the new run starts right after the
+// request, so send it twice. Control-IN, only if the firmware is built
+// with HW_CDC_BENCHMARK.
+//
+// uint8 number of runs completed (modulo 256, never 0 again after the
+//       first), 0 if there are no results yet
+// uint8 number of kernels that follow
+// uint16 F_CPU in kHz
+// uint16 cycles of each kernel, the fastest of HW_CDC_BENCHMARK_RUNS,
+//        0xffff if none fit in the timer:
+//        0 one packet (8 bytes) inserted into and removed from a ring buffer
+//        1 usbCrc16() of 8 bytes
+//        2 BOS descriptor assembled
+//        3 MS OS 2.0 descriptor set assembled (0 without HW_CDC_WINUSB)
+//        4 one usbPollWrapper() call
+#define WL_REQUEST_BENCHMARK (49)
+
+// Reads the driver's counters. Control-IN, only if the firmware is built
+// with HW_CDC_STATS. Send 1 in wValue to clear them after reading.
+//
+// DigiWebUSBStats, see DigiWebUSB.h, 16 bit values little endian
+#define WL_REQUEST_GET_STATS (50)
+
+// Drains the event trace ring. Control-IN, only if the firmware is built
+// with HW_CDC_TRACE. Events are removed as they are returned.
+//
+// uint8 number of events that follow
+// uint8 events lost because the ring was full since the last drain (up
+//       to 255)
+// then for each event, oldest first, as many as fit in wLength and 64:
+//   uint8 WL_TRACE_* below
+//   uint8 time: SOF count on the parts that count SOFs (ATtiny45/85,
+//         87/167), else timer 0 at F_CPU/64
+//   uint8 arg0, arg1 as given below
+#define WL_REQUEST_GET_TRACE (51)
+
+#define WL_TRACE_STATE (1)      // device state changed: new, old USB_STATE_*
+#define WL_TRACE_SETUP (2)      // class or vendor request: bmRequestType, bRequest
+#define WL_TRACE_DESCRIPTOR (3) // GET_DESCRIPTOR: type, index
+#define WL_TRACE_READ (4)       // control-IN data: bytes returned, bytes left
+#define WL_TRACE_WRITE (5)      // control-OUT data: bytes received, 0
+#define WL_TRACE_OUT (6)        // bulk OUT packet: length, bytes in rxBuf
+#define WL_TRACE_IN (7)         // bulk IN packet queued: length, bytes in txBuf
+#define WL_TRACE_FLOW (8)       // bulk OUT stopped (1), resumed (0) or resumed after
+                                // HW_CDC_RX_STOP_MS without a read (2): bytes in rxBuf
+
+// Drains the driver's debug log (DBG1/DBG2, see oddebug.h). Control-IN,
+// only if usbconfig.h sets DEBUG_LEVEL and the logs go into the RAM ring.
+// Records are removed as they are returned.
+//
+// uint8 number of records dropped because the ring was full (up to 255)
+// then whole records, oldest first, as many as fit in wLength and 64:
+//   uint8 prefix (0xff: bus reset, 0x1x: received, 0x2x: sent)
+//   uint8 length
+//   data
+#define WL_REQUEST_GET_DEBUG_LOG (52)
+
+// Reads the RAM use. Control-IN, only if the firmware is built with
+// HW_CDC_STACK_CHECK.
+//
+// uint16 bytes the stack has never reached since reset, see stackFree()
+// uint16 bytes between the static data and the stack pointer now
+// uint16 bytes of static data (.data, .bss and .noinit)
+#define WL_REQUEST_GET_RAM (53)
+
 // Sets the device's serial number. Control-OUT.
 //
 #define WL_REQUEST_SET_SERIAL_NUMBER (64)
@@ -6,6 +6,9 @@
 #include <avr/interrupt.h>
 #include <stdint.h>
 #include <util/atomic.h>
+#ifndef RINGBUFFER_RESTORESTATE
+#define RINGBUFFER_RESTORESTATE ATOMIC_RESTORESTATE
+#endif
 /*----------------------------------------------------------------------------------------------------------------*/
 typedef struct
 {
@@ -30,7 +33,7 @@ static inline void RingBuffer_InitBuffer(RingBuffer_t* Buffer,uint8_t* const Dat
 static inline uint16_t RingBuffer_GetCount(RingBuffer_t* const Buffer)
 {
     uint16_t Count;
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    ATOMIC_BLOCK(RINGBUFFER_RESTORESTATE)
     {
         Count = Buffer->Count;
     }
@@ -59,7 +62,7 @@ static inline void RingBuffer_Insert(RingBuffer_t* Buffer, const uint8_t Data)
     if (++Buffer->In == Buffer->End)
       Buffer->In = Buffer->Start;
 
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    ATOMIC_BLOCK(RINGBUFFER_RESTORESTATE)
     {
         Buffer->Count++;
     }
@@ -72,7 +75,7 @@ static inline uint8_t RingBuffer_Remove(RingBuffer_t* Buffer)
     if (++Buffer->Out == Buffer->End)
       Buffer->Out = Buffer->Start;
 
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    ATOMIC_BLOCK(RINGBUFFER_RESTORESTATE)
     {
         Buffer->Count--;
     }
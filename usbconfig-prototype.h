@@ -280,6 +280,12 @@ section at the end of this file).
  * HID class is 3, no subclass and protocol required (but may be useful!)
  * CDC class is 2, use subclass 2 and protocol 1 for ACM
  */
+#define USB_CFG_HAVE_BOS_DESCRIPTOR 0
+/* Define this to 1 if the device answers GET_DESCRIPTOR for the BOS
+ * descriptor (type 15) in usbFunctionDescriptor(). The driver's device
+ * descriptor then reports USB version 2.1 instead of 2.0, which is what
+ * makes the host ask for it.
+ */
 /* #define USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH    42 */
 /* Define this to the length of the HID report descriptor, if you implement
  * an HID device. Otherwise don't define it or define it to 0.
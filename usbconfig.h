@@ -43,6 +43,8 @@ section at the end of this file).
  * interrupt, the USB interrupt will also be triggered at Start-Of-Frame
  * markers every millisecond.]
  */
+#include <avr/io.h> /* RAMEND and FLASHEND for the per-MCU choices below */
+
 #if defined (__AVR_ATtiny44__) || defined (__AVR_ATtiny84__)
 #define USB_CFG_IOPORTNAME      B
 #define USB_CFG_DMINUS_BIT      1
@@ -133,6 +135,13 @@ section at the end of this file).
  * it is required by the standard. We have made it a config option because it
  * bloats the code considerably.
  */
+#define USB_CFG_IMPLEMENT_REMOTE_WAKEUP 1
+/* Define this to 1 if the device may wake up a suspended host. The driver
+ * then handles SET_FEATURE and CLEAR_FEATURE for DEVICE_REMOTE_WAKEUP and
+ * reports the feature in GET_STATUS. The application must advertise
+ * USBATTR_REMOTEWAKE in its configuration descriptor and signal resume itself
+ * when usbRemoteWakeupEnabled is set.
+ */
 #define USB_CFG_SUPPRESS_INTR_CODE      0
 /* Define this to 1 if you want to declare interrupt-in endpoints, but don't
  * want to send any data over them. If this macro is defined to 1, functions
@@ -155,7 +164,41 @@ section at the end of this file).
  * The value is in milliamperes. [It will be divided by two since USB
  * communicates power requirements in units of 2 mA.]
  */
-#define USB_CFG_IMPLEMENT_FN_WRITE      1
+#ifndef HW_CDC_MIN
+#define HW_CDC_MIN                      0
+#endif
+/* DigiWebUSB: define this to 1 for the smallest build, e.g. for a sketch that
+ * has to fit beside the bootloader. Data of control-out transfers is then
+ * dropped by the driver (the library ignores it anyway), the library does not
+ * answer WL_REQUEST_GET_OSCCAL and the diagnostic features (HW_CDC_STATS and
+ * friends in DigiWebUSB.h, DEBUG_LEVEL) cannot be enabled. The driver and the
+ * library must see the same value, so set it here or on the compiler's
+ * command line, not in the sketch.
+ */
+#ifndef HW_CDC_WEBUSB
+#define HW_CDC_WEBUSB                   1
+#endif
+/* DigiWebUSB: set this to 0 to leave out WebUSB, i.e. its BOS capability and
+ * the landing page and allowed origins requests. The constructor's URL and
+ * origin arguments are ignored then. Browsers still reach the device through
+ * Web Serial, which only needs the CDC interface.
+ */
+#ifndef HW_CDC_WINUSB
+#define HW_CDC_WINUSB                   1
+#endif
+/* DigiWebUSB: set this to 0 to leave out the MS OS 2.0 descriptors that bind
+ * WinUSB to the data interface on Windows. Windows then binds usbser.sys to
+ * the device, or nothing on versions before 10. Without WebUSB and WinUSB
+ * the device reports USB 2.0 instead of 2.1 and has no BOS descriptor.
+ * Like HW_CDC_MIN, these must be the same for the driver and the library.
+ */
+#define USB_CFG_HAVE_BOS_DESCRIPTOR     (HW_CDC_WEBUSB || HW_CDC_WINUSB)
+/* Define this to 1 if the device answers GET_DESCRIPTOR for the BOS
+ * descriptor (type 15) in usbFunctionDescriptor(). The driver's device
+ * descriptor then reports USB version 2.1 instead of 2.0, which is what
+ * makes the host ask for it. DigiWebUSB has one if WebUSB or WinUSB is on.
+ */
+#define USB_CFG_IMPLEMENT_FN_WRITE      (!HW_CDC_MIN)
 /* Set this to 1 if you want usbFunctionWrite() to be called for control-out
  * transfers. Set it to 0 if you don't need it and want to save a couple of
  * bytes.
@@ -203,10 +246,23 @@ section at the end of this file).
 /* This macro (if defined) is executed when a USB SET_ADDRESS request was
  * received.
  */
+/* #define DEBUG_LEVEL                     1 */
+/* Define this to 1 for the driver's DBG1() logs or to 2 for DBG1() and
+ * DBG2(), which dump every packet. The ATtiny parts have no UART, so the
+ * logs go into a RAM ring (see oddebug.h) that the host reads with the
+ * vendor request WL_REQUEST_GET_DEBUG_LOG.
+ */
+#if defined (__AVR_ATtiny45__) || defined (__AVR_ATtiny85__) || \
+    defined (__AVR_ATtiny87__) || defined (__AVR_ATtiny167__)
+#define USB_COUNT_SOF                   1
+#else
 #define USB_COUNT_SOF                   0
+#endif
 /* define this macro to 1 if you need the global variable "usbSofCount" which
  * counts SOF packets. This feature requires that the hardware interrupt is
- * connected to D- instead of D+.
+ * connected to D- instead of D+. The pin change interrupts of the ATtiny
+ * parts below can be moved to D- freely, so DigiWebUSB uses the SOF count
+ * there to detect a suspended bus.
  */
 /* #ifdef __ASSEMBLER__
  * macro myAssemblerMacro
@@ -242,13 +298,29 @@ section at the end of this file).
 /* define this macro to 1 if you want the function usbMeasureFrameLength()
  * compiled in. This function can be used to calibrate the AVR's RC oscillator.
  */
+#if USB_COUNT_SOF
+#include "osctune.h"
+#endif
+/* Where the interrupt is wired to D- (see USB_COUNT_SOF), the oscillator is
+ * also kept in sync with the SOF pulses after the initial calibration. This
+ * needs timer 0 running with a prescaler of 64, as set up by the Arduino core
+ * for millis(). The hook costs up to 24 cycles per frame, see osctune.h for
+ * what that means for a packet right after the keep-alive.
+ */
+#ifndef USB_USE_FAST_CRC
+#if FLASHEND >= 0x3fff
+#define USB_USE_FAST_CRC                1
+#else
 #define USB_USE_FAST_CRC                0
+#endif
+#endif
 /* The assembler module has two implementations for the CRC algorithm. One is
  * faster, the other is smaller. This CRC routine is only used for transmitted
  * messages where timing is not critical. The faster routine needs 31 cycles
  * per byte while the smaller one needs 61 to 69 cycles. The faster routine
  * may be worth the 32 bytes bigger code size if you transmit lots of data and
- * run the AVR close to its limit.
+ * run the AVR close to its limit. DigiWebUSB uses it on parts with 16 KB of
+ * flash or more (ATtiny167), where the bootloader leaves room to spare.
  */
 
 /* -------------------------- Device Description --------------------------- */
@@ -384,7 +456,7 @@ section at the end of this file).
  */
 
 #define USB_CFG_DESCR_PROPS_DEVICE                  0
-#define USB_CFG_DESCR_PROPS_CONFIGURATION           USB_PROP_IS_DYNAMIC
+#define USB_CFG_DESCR_PROPS_CONFIGURATION           USB_PROP_LENGTH(67)
 #define USB_CFG_DESCR_PROPS_STRINGS                 0
 #define USB_CFG_DESCR_PROPS_STRING_0                0
 #define USB_CFG_DESCR_PROPS_STRING_VENDOR           0
@@ -392,7 +464,11 @@ section at the end of this file).
 #define USB_CFG_DESCR_PROPS_STRING_SERIAL_NUMBER    0
 #define USB_CFG_DESCR_PROPS_HID                     0
 #define USB_CFG_DESCR_PROPS_HID_REPORT              0
-#define USB_CFG_DESCR_PROPS_UNKNOWN                 0
+#define USB_CFG_DESCR_PROPS_UNKNOWN                 USB_PROP_IS_DYNAMIC
+/* DigiWebUSB: the device and string descriptors are the driver's, the CDC
+ * configuration descriptor is usbDescriptorConfiguration in DigiWebUSB.cpp
+ * and the BOS descriptor comes from usbFunctionDescriptor().
+ */
 
 /* ----------------------- Optional MCU Description ------------------------ */
 
@@ -418,7 +494,7 @@ section at the end of this file).
 
  #if defined (__AVR_ATtiny45__) || defined (__AVR_ATtiny85__) 
 #define USB_INTR_CFG            PCMSK
-#define USB_INTR_CFG_SET        (1<<USB_CFG_DPLUS_BIT)
+#define USB_INTR_CFG_SET        (1<<USB_CFG_DMINUS_BIT) /* D- for USB_COUNT_SOF */
 #define USB_INTR_ENABLE_BIT     PCIE
 #define USB_INTR_PENDING_BIT    PCIF
 #define USB_INTR_VECTOR         SIG_PIN_CHANGE
@@ -426,7 +502,7 @@ section at the end of this file).
 
 #if defined (__AVR_ATtiny87__) || defined (__AVR_ATtiny167__)
 #define USB_INTR_CFG            PCMSK1
-#define USB_INTR_CFG_SET        (1 << USB_CFG_DPLUS_BIT)
+#define USB_INTR_CFG_SET        (1 << USB_CFG_DMINUS_BIT) /* D- for USB_COUNT_SOF */
 #define USB_INTR_CFG_CLR        0
 #define USB_INTR_ENABLE         PCICR
 #define USB_INTR_ENABLE_BIT     PCIE1
@@ -11,7 +11,6 @@
 #include "usbportability.h"
 #include "usbdrv.h"
 #include "oddebug.h"
-const uchar _deb [20];
 /*
 General Description:
 This module implements the C-part of the USB driver. See usbdrv.h for a
@@ -26,6 +25,9 @@ uchar       usbInputBufOffset;  /* offset in usbRxBuf used for low level receivi
 uchar       usbDeviceAddr;      /* assigned during enumeration, defaults to 0 */
 uchar       usbNewDeviceAddr;   /* device ID which should be set after status phase */
 uchar       usbConfiguration;   /* currently selected configuration. Administered by driver, but not used */
+#if USB_CFG_IMPLEMENT_REMOTE_WAKEUP
+uchar       usbRemoteWakeupEnabled; /* DEVICE_REMOTE_WAKEUP feature set by host */
+#endif
 volatile schar usbRxLen;        /* = 0; number of bytes in usbRxBuf; 0 means free, -1 for flow control */
 uchar       usbCurrentTok;      /* last token received or endpoint number for last OUT token if != 0 */
 uchar       usbRxToken;         /* token for data we received; or endpont number for last OUT */
@@ -77,7 +79,7 @@ const PROGMEM char usbDescriptorString0[] = { /* language descriptor */
 #if USB_CFG_DESCR_PROPS_STRING_VENDOR == 0 && USB_CFG_VENDOR_NAME_LEN
 #undef USB_CFG_DESCR_PROPS_STRING_VENDOR
 #define USB_CFG_DESCR_PROPS_STRING_VENDOR   sizeof(usbDescriptorStringVendor)
-const PROGMEM int  usbDescriptorStringVendor[] = {
+const PROGMEM USB_INT16_T usbDescriptorStringVendor[] = {
     USB_STRING_DESCRIPTOR_HEADER(USB_CFG_VENDOR_NAME_LEN),
     USB_CFG_VENDOR_NAME
 };
@@ -86,7 +88,7 @@ const PROGMEM int  usbDescriptorStringVendor[] = {
 #if USB_CFG_DESCR_PROPS_STRING_PRODUCT == 0 && USB_CFG_DEVICE_NAME_LEN
 #undef USB_CFG_DESCR_PROPS_STRING_PRODUCT
 #define USB_CFG_DESCR_PROPS_STRING_PRODUCT   sizeof(usbDescriptorStringDevice)
-const PROGMEM int  usbDescriptorStringDevice[] = {
+const PROGMEM USB_INT16_T usbDescriptorStringDevice[] = {
     USB_STRING_DESCRIPTOR_HEADER(USB_CFG_DEVICE_NAME_LEN),
     USB_CFG_DEVICE_NAME
 };
@@ -95,7 +97,7 @@ const PROGMEM int  usbDescriptorStringDevice[] = {
 #if USB_CFG_DESCR_PROPS_STRING_SERIAL_NUMBER == 0 && USB_CFG_SERIAL_NUMBER_LEN
 #undef USB_CFG_DESCR_PROPS_STRING_SERIAL_NUMBER
 #define USB_CFG_DESCR_PROPS_STRING_SERIAL_NUMBER    sizeof(usbDescriptorStringSerialNumber)
-const PROGMEM int usbDescriptorStringSerialNumber[] = {
+const PROGMEM USB_INT16_T usbDescriptorStringSerialNumber[] = {
     USB_STRING_DESCRIPTOR_HEADER(USB_CFG_SERIAL_NUMBER_LEN),
     USB_CFG_SERIAL_NUMBER
 };
@@ -111,7 +113,11 @@ const PROGMEM int usbDescriptorStringSerialNumber[] = {
 const PROGMEM char usbDescriptorDevice[] = {    /* USB device descriptor */
     18,         /* sizeof(usbDescriptorDevice): length of descriptor in bytes */
     USBDESCR_DEVICE,        /* descriptor type */
-    0x10, 0x02,             /* USB version supported */
+#if USB_CFG_HAVE_BOS_DESCRIPTOR
+    0x10, 0x02,             /* USB version supported: 2.1, has a BOS descriptor */
+#else
+    0x00, 0x02,             /* USB version supported */
+#endif
     USB_CFG_DEVICE_CLASS,
     USB_CFG_DEVICE_SUBCLASS,
     0,                      /* protocol */
@@ -315,9 +321,7 @@ uchar       flags = USB_FLG_MSGPTR_IS_ROM;
 
     SWITCH_START(rq->wValue.bytes[1])
     SWITCH_CASE(USBDESCR_DEVICE)    /* 1 */
-        //GET_DESCRIPTOR(USB_CFG_DESCR_PROPS_DEVICE, usbDescriptorDevice)
-len = usbFunctionDescriptor(rq);
-
+        GET_DESCRIPTOR(USB_CFG_DESCR_PROPS_DEVICE, usbDescriptorDevice)
     SWITCH_CASE(USBDESCR_CONFIG)    /* 2 */
         GET_DESCRIPTOR(USB_CFG_DESCR_PROPS_CONFIGURATION, usbDescriptorConfiguration)
     SWITCH_CASE(USBDESCR_STRING)    /* 3 */
@@ -335,11 +339,6 @@ len = usbFunctionDescriptor(rq);
             GET_DESCRIPTOR(USB_CFG_DESCR_PROPS_STRING_PRODUCT, usbDescriptorStringDevice)
         SWITCH_CASE(3)
             GET_DESCRIPTOR(USB_CFG_DESCR_PROPS_STRING_SERIAL_NUMBER, usbDescriptorStringSerialNumber)
-	//	len = usbFunctionDescriptor(rq);
-	SWITCH_CASE(15)
-            //GET_DESCRIPTOR(USB_CFG_DESCR_PROPS_STRING_SERIAL_NUMBER, usbDescriptorStringSerialNumber)
-                len = usbFunctionDescriptor(rq);
-
         SWITCH_DEFAULT
             if(USB_CFG_DESCR_PROPS_UNKNOWN & USB_PROP_IS_DYNAMIC){
                 len = usbFunctionDescriptor(rq);
@@ -353,9 +352,9 @@ len = usbFunctionDescriptor(rq);
         GET_DESCRIPTOR(USB_CFG_DESCR_PROPS_HID_REPORT, usbDescriptorHidReport)
 #endif
     SWITCH_DEFAULT
-        //if(USB_CFG_DESCR_PROPS_UNKNOWN & USB_PROP_IS_DYNAMIC){
+        if(USB_CFG_DESCR_PROPS_UNKNOWN & USB_PROP_IS_DYNAMIC){
             len = usbFunctionDescriptor(rq);
-        //}
+        }
     SWITCH_END
     usbMsgFlags = flags;
     return len;
@@ -380,18 +379,29 @@ uchar   index = rq->wIndex.bytes[0];
         uchar recipient = rq->bmRequestType & USBRQ_RCPT_MASK;  /* assign arith ops to variables to enforce byte size */
         if(USB_CFG_IS_SELF_POWERED && recipient == USBRQ_RCPT_DEVICE)
             dataPtr[0] =  USB_CFG_IS_SELF_POWERED;
+#if USB_CFG_IMPLEMENT_REMOTE_WAKEUP
+        if(recipient == USBRQ_RCPT_DEVICE && usbRemoteWakeupEnabled)
+            dataPtr[0] |= 2;    /* bit 1 == remote wakeup enabled */
+#endif
 #if USB_CFG_IMPLEMENT_HALT
         if(recipient == USBRQ_RCPT_ENDPOINT && index == 0x81)   /* request status for endpoint 1 */
             dataPtr[0] = usbTxLen1 == USBPID_STALL;
 #endif
         dataPtr[1] = 0;
         len = 2;
-#if USB_CFG_IMPLEMENT_HALT
+#if USB_CFG_IMPLEMENT_HALT || USB_CFG_IMPLEMENT_REMOTE_WAKEUP
     SWITCH_CASE2(USBRQ_CLEAR_FEATURE, USBRQ_SET_FEATURE)    /* 1, 3 */
+#if USB_CFG_IMPLEMENT_REMOTE_WAKEUP
+        if(value == 1 && (rq->bmRequestType & USBRQ_RCPT_MASK) == USBRQ_RCPT_DEVICE){ /* feature 1 == DEVICE_REMOTE_WAKEUP */
+            usbRemoteWakeupEnabled = rq->bRequest == USBRQ_SET_FEATURE;
+        }
+#endif
+#if USB_CFG_IMPLEMENT_HALT
         if(value == 0 && index == 0x81){    /* feature 0 == HALT for endpoint == 1 */
             usbTxLen1 = rq->bRequest == USBRQ_CLEAR_FEATURE ? USBPID_NAK : USBPID_STALL;
             usbResetDataToggling();
         }
+#endif
 #endif
     SWITCH_CASE(USBRQ_SET_ADDRESS)          /* 5 */
         usbNewDeviceAddr = value;
@@ -604,6 +614,10 @@ uchar   i;
     /* RESET condition, called multiple times during reset */
     usbNewDeviceAddr = 0;
     usbDeviceAddr = 0;
+    usbConfiguration = 0;
+#if USB_CFG_IMPLEMENT_REMOTE_WAKEUP
+    usbRemoteWakeupEnabled = 0;
+#endif
     usbResetStall();
     DBG1(0xff, 0, 0);
 isNotReset:
@@ -349,8 +349,14 @@ USB_PUBLIC void usbFunctionWriteOut(uchar *data, uchar len);
  *     USB_INTR_ENABLE &= ~(1 << USB_INTR_ENABLE_BIT)
  * or use cli() to disable interrupts globally.
  */
-extern unsigned usbCrc16(unsigned data, uchar len);
-#define usbCrc16(data, len) usbCrc16((unsigned)(data), len)
+#ifdef __cplusplus
+extern "C"{
+#endif
+extern unsigned usbCrc16(USB_ADDR_T data, uchar len);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#define usbCrc16(data, len) usbCrc16((USB_ADDR_T)(data), len)
 /* This function calculates the binary complement of the data CRC used in
  * USB data packets. The value is used to build raw transmit packets.
  * You may want to use this function for data checksums or to verify received
@@ -360,11 +366,11 @@ extern unsigned usbCrc16(unsigned data, uchar len);
 #ifdef __cplusplus
 extern "C"{
 #endif
-extern unsigned usbCrc16Append(unsigned data, uchar len);
+extern unsigned usbCrc16Append(USB_ADDR_T data, uchar len);
 #ifdef __cplusplus
 } // extern "C"
 #endif
-#define usbCrc16Append(data, len)    usbCrc16Append((unsigned)(data), len)
+#define usbCrc16Append(data, len)    usbCrc16Append((USB_ADDR_T)(data), len)
 /* This function is equivalent to usbCrc16() above, except that it appends
  * the 2 bytes CRC (lowbyte first) in the 'data' buffer after reading 'len'
  * bytes.
@@ -386,6 +392,13 @@ extern uchar    usbConfiguration;
  * You may want to reflect the "configured" status with a LED on the device or
  * switch on high power parts of the circuit only if the device is configured.
  */
+#if USB_CFG_IMPLEMENT_REMOTE_WAKEUP
+extern uchar    usbRemoteWakeupEnabled;
+/* This value is set when the host enables the DEVICE_REMOTE_WAKEUP feature
+ * with SET_FEATURE and cleared by CLEAR_FEATURE or a bus reset. The device
+ * may only signal resume to a suspended host while it is set.
+ */
+#endif
 #if USB_COUNT_SOF
 extern volatile uchar   usbSofCount;
 /* This variable is incremented on every SOF packet. It is only available if
@@ -497,6 +510,9 @@ extern volatile schar   usbRxLen;
  * arrays as declared below:
  */
 #ifndef __ASSEMBLER__
+#ifdef __cplusplus
+extern "C"{
+#endif
 extern
 #if !(USB_CFG_DESCR_PROPS_DEVICE & USB_PROP_IS_RAM)
 const PROGMEM
@@ -509,9 +525,6 @@ const PROGMEM
 #endif
 char usbDescriptorConfiguration[];
 
-#ifdef __cplusplus
-extern "C"{
-#endif
 extern
 #if !(USB_CFG_DESCR_PROPS_HID_REPORT & USB_PROP_IS_RAM)
 const PROGMEM
@@ -531,19 +544,19 @@ extern
 #if !(USB_CFG_DESCR_PROPS_STRING_VENDOR & USB_PROP_IS_RAM)
 const PROGMEM
 #endif
-int usbDescriptorStringVendor[];
+USB_INT16_T usbDescriptorStringVendor[];
 
 extern
 #if !(USB_CFG_DESCR_PROPS_STRING_PRODUCT & USB_PROP_IS_RAM)
 const PROGMEM
 #endif
-int usbDescriptorStringDevice[];
+USB_INT16_T usbDescriptorStringDevice[];
 
 extern
 #if !(USB_CFG_DESCR_PROPS_STRING_SERIAL_NUMBER & USB_PROP_IS_RAM)
 const PROGMEM
 #endif
-int usbDescriptorStringSerialNumber[];
+USB_INT16_T usbDescriptorStringSerialNumber[];
 
 #endif /* __ASSEMBLER__ */
 
@@ -617,6 +630,14 @@ int usbDescriptorStringSerialNumber[];
 #define USB_CFG_HAVE_INTRIN_ENDPOINT3   0
 #endif
 
+#ifndef USB_CFG_IMPLEMENT_REMOTE_WAKEUP
+#define USB_CFG_IMPLEMENT_REMOTE_WAKEUP 0
+#endif
+
+#ifndef USB_CFG_HAVE_BOS_DESCRIPTOR
+#define USB_CFG_HAVE_BOS_DESCRIPTOR     0
+#endif
+
 #define USB_BUFSIZE     11  /* PID, 8 bytes data, 2 bytes CRC */
 
 /* ----- Try to find registers and bits responsible for ext interrupt 0 ----- */
@@ -712,7 +733,7 @@ extern usbTxStatus_t   usbTxStatus1, usbTxStatus3;
 
 
 typedef union usbWord{
-    unsigned    word;
+    USB_UINT16_T word;
     uchar       bytes[2];
 }usbWord_t;
 
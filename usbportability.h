@@ -137,6 +137,20 @@ static inline void  sei(void)
 
 #endif  /* development environment */
 
+/* The driver is written for a 16 bit int. Where int is wider, define these
+ * to 16 bit types, and USB_ADDR_T to an integer that holds a data pointer,
+ * before usbdrv.h is included.
+ */
+#ifndef USB_INT16_T
+#   define USB_INT16_T  int
+#endif
+#ifndef USB_UINT16_T
+#   define USB_UINT16_T unsigned
+#endif
+#ifndef USB_ADDR_T
+#   define USB_ADDR_T   unsigned
+#endif
+
 /* for conveniecne, ensure that PRG_RDB exists */
 #ifndef PRG_RDB
 #   define PRG_RDB(addr)    USB_READ_FLASH(addr)